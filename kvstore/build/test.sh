@@ -24,6 +24,10 @@ TEST_SECTIONS=(
     "A3"
     "A4"
     "A5"
+    "A6"
+    "A7"
+    "A8"
+    "A9"
     "B1"
     "B2"
     "B3"
@@ -37,6 +41,10 @@ SECTION_DIRS["A2"]="kvstore_parallel_tests"
 SECTION_DIRS["A3"]="kvstore_sequential_tests"
 SECTION_DIRS["A4"]="kvstore_parallel_tests"
 SECTION_DIRS["A5"]="kvstore_performance_tests"
+SECTION_DIRS["A6"]="kvstore_sequential_tests"
+SECTION_DIRS["A7"]="kvstore_parallel_tests"
+SECTION_DIRS["A8"]="kvstore_sequential_tests"
+SECTION_DIRS["A9"]="kvstore_parallel_tests"
 SECTION_DIRS["B1"]="shardcontroller_tests"
 SECTION_DIRS["B2"]="server_tests"
 SECTION_DIRS["B3"]="shardkv_client_tests"
@@ -47,6 +55,10 @@ SECTION_ARGS["A2"]="simple"
 SECTION_ARGS["A3"]="concurrent"
 SECTION_ARGS["A4"]="concurrent"
 SECTION_ARGS["A5"]="concurrent"
+SECTION_ARGS["A6"]="epoch"
+SECTION_ARGS["A7"]="epoch"
+SECTION_ARGS["A8"]="sharded"
+SECTION_ARGS["A9"]="sharded"
 SECTION_ARGS["B1"]=""
 SECTION_ARGS["B2"]=""
 SECTION_ARGS["B3"]=""
@@ -0,0 +1,94 @@
+#include "conn_pool.hpp"
+
+#include <poll.h>
+
+ConnPool& ConnPool::shared() {
+  static ConnPool pool;
+  return pool;
+}
+
+ConnPool::Lease ConnPool::acquire(const std::string& address) {
+  {
+    std::unique_lock lock(this->mtx);
+    auto now = steady_clock::now();
+    this->evict_idle_locked(now - this->idle_timeout);
+
+    auto it = this->idle.find(address);
+    while (it != this->idle.end() && !it->second.empty()) {
+      // Most recently used first, as it's the likeliest to still be open.
+      std::shared_ptr<ServerConn> conn = std::move(it->second.back().conn);
+      it->second.pop_back();
+      if (is_healthy(*conn)) return Lease(this, std::move(conn), true);
+      conn->close();
+    }
+  }
+
+  // Connect without holding the lock, so other addresses aren't held up, and
+  // on the newest framing the server speaks, for its smaller headers.
+  std::shared_ptr<ServerConn> conn =
+      connect_to_server(address, PROTOCOL_LATEST);
+  if (!conn) return Lease();
+  return Lease(this, std::move(conn), false);
+}
+
+void ConnPool::release(std::shared_ptr<ServerConn> conn) {
+  std::unique_lock lock(this->mtx);
+  auto now = steady_clock::now();
+  this->evict_idle_locked(now - this->idle_timeout);
+
+  auto& conns = this->idle[conn->address];
+  if (conns.size() >= this->max_idle) {
+    conn->close();
+    return;
+  }
+  conns.push_back(IdleConn{std::move(conn), now});
+}
+
+void ConnPool::evict_idle() {
+  std::unique_lock lock(this->mtx);
+  this->evict_idle_locked(steady_clock::now() - this->idle_timeout);
+}
+
+void ConnPool::clear() {
+  std::unique_lock lock(this->mtx);
+  for (auto&& [address, conns] : this->idle) {
+    for (auto&& idle_conn : conns) idle_conn.conn->close();
+  }
+  this->idle.clear();
+}
+
+size_t ConnPool::idle_count(const std::string& address) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->idle.find(address);
+  return it == this->idle.end() ? 0 : it->second.size();
+}
+
+void ConnPool::evict_idle_locked(steady_clock::time_point cutoff) {
+  for (auto it = this->idle.begin(); it != this->idle.end();) {
+    auto& conns = it->second;
+    // Connections are kept in the order they went idle, so the stale ones are
+    // at the front.
+    size_t n_stale = 0;
+    while (n_stale < conns.size() && conns[n_stale].since < cutoff) {
+      conns[n_stale].conn->close();
+      n_stale++;
+    }
+    conns.erase(conns.begin(), conns.begin() + n_stale);
+    if (conns.empty()) {
+      it = this->idle.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+bool ConnPool::is_healthy(const ServerConn& conn) {
+  // An idle connection should have nothing to read. If it's readable, either
+  // the server closed it (or reset it), or it sent something nobody asked
+  // for; either way, it's no good.
+  pollfd pfd{};
+  pfd.fd = conn.fd;
+  pfd.events = POLLIN;
+  int ret = poll(&pfd, 1, 0);
+  return ret == 0;
+}
@@ -0,0 +1,139 @@
+#ifndef CONN_POOL_HPP
+#define CONN_POOL_HPP
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "net/network_conn.hpp"
+
+/**
+ * A thread-safe pool of open connections to servers, by address, so that
+ * clients making many small requests don't pay for a new connection (and the
+ * server for accepting it) each time.
+ *
+ * A connection is checked out with acquire(), and goes back to the pool when
+ * the Lease is destroyed. Before an idle connection is handed out again, it's
+ * checked to still be open; connections left idle longer than the idle
+ * timeout, or beyond the first max_idle for an address, are closed instead.
+ */
+class ConnPool {
+ public:
+  // Most idle connections kept per address; enough for a few threads each.
+  static constexpr size_t DEFAULT_MAX_IDLE = 8;
+  static constexpr milliseconds DEFAULT_IDLE_TIMEOUT = 30s;
+
+  explicit ConnPool(size_t max_idle = DEFAULT_MAX_IDLE,
+                    milliseconds idle_timeout = DEFAULT_IDLE_TIMEOUT)
+      : max_idle(max_idle), idle_timeout(idle_timeout) {
+  }
+  ~ConnPool() {
+    this->clear();
+  }
+
+  ConnPool(const ConnPool&) = delete;
+  ConnPool& operator=(const ConnPool&) = delete;
+
+  // The pool clients use unless they're given another.
+  static ConnPool& shared();
+
+  /**
+   * A connection checked out of the pool, for one caller to use at a time.
+   * Empty if no connection could be made.
+   */
+  class Lease {
+   public:
+    Lease() = default;
+    Lease(ConnPool* pool, std::shared_ptr<ServerConn> conn, bool reused)
+        : pool(pool), conn(std::move(conn)), reused(reused) {
+    }
+    Lease(Lease&& other) noexcept
+        : pool(other.pool),
+          conn(std::move(other.conn)),
+          reused(other.reused) {
+    }
+    Lease& operator=(Lease&& other) noexcept {
+      this->release();
+      this->pool = other.pool;
+      this->conn = std::move(other.conn);
+      this->reused = other.reused;
+      return *this;
+    }
+    ~Lease() {
+      this->release();
+    }
+
+    ServerConn* operator->() const {
+      return this->conn.get();
+    }
+    explicit operator bool() const {
+      return this->conn != nullptr;
+    }
+
+    // Whether the connection was used before, rather than opened for this
+    // lease. A request that fails on a reused connection may only have failed
+    // because the server closed it while it sat idle.
+    bool was_reused() const {
+      return this->reused;
+    }
+
+    // Closes the connection instead of returning it to the pool. Call this
+    // once a send or receive on it fails, as there's no telling what state
+    // it's been left in.
+    void discard() {
+      if (this->conn) this->conn->close();
+      this->conn = nullptr;
+    }
+
+   private:
+    ConnPool* pool = nullptr;
+    std::shared_ptr<ServerConn> conn;
+    bool reused = false;
+
+    void release() {
+      if (this->conn) this->pool->release(std::move(this->conn));
+      this->conn = nullptr;
+    }
+  };
+
+  // Checks out an open connection to address, reusing an idle one if there's
+  // one that's still healthy.
+  Lease acquire(const std::string& address);
+
+  // Closes connections that have been idle for longer than the idle timeout.
+  // Also happens as connections are acquired and released.
+  void evict_idle();
+
+  // Closes every idle connection.
+  void clear();
+
+  // Number of idle connections to address.
+  size_t idle_count(const std::string& address);
+
+ private:
+  struct IdleConn {
+    std::shared_ptr<ServerConn> conn;
+    steady_clock::time_point since;
+  };
+
+  const size_t max_idle;
+  const milliseconds idle_timeout;
+
+  std::mutex mtx;
+  // Idle connections by address, most recently used last.
+  std::unordered_map<std::string, std::vector<IdleConn>> idle;
+
+  void release(std::shared_ptr<ServerConn> conn);
+
+  // Closes the connections idle since before `cutoff`. Caller must hold mtx.
+  void evict_idle_locked(steady_clock::time_point cutoff);
+
+  // Whether an idle connection is still open, with nothing unexpected waiting
+  // to be read from it.
+  static bool is_healthy(const ServerConn& conn);
+};
+
+#endif /* end of include guard */
@@ -1,66 +1,127 @@
 #include "shardkv_client.hpp"
 
-std::optional<std::string> ShardKvClient::Get(const std::string& key) {
-  // Query shardcontroller for config
-  auto config = this->Query();
-  if (!config) return std::nullopt;
+#include <numeric>
+
+// Whether a server turned a request away because, by its configuration, some
+// key in it belongs to another server (c.f. KvServer::process_request).
+static bool not_responsible(const Response& res) {
+  auto* error_res = std::get_if<ErrorResponse>(&res);
+  return error_res && error_res->msg.starts_with("server not responsible");
+}
 
-  // find responsible server in config
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return std::nullopt;
+// Whether a server turned a request away because the shard of some key in it
+// has moved there, but its pairs are still on their way (c.f.
+// KvServer::refusal_for).
+static bool shard_moving(const Response& res) {
+  auto* error_res = std::get_if<ErrorResponse>(&res);
+  return error_res && error_res->msg.starts_with("shard still moving");
+}
+
+std::optional<std::string> ShardKvClient::Get(const std::string& key) {
+  std::optional<Response> res = this->route(key, GetRequest{key});
+  if (!res) return std::nullopt;
+  if (auto* get_res = std::get_if<GetResponse>(&*res)) {
+    return get_res->value;
+  } else if (auto* error_res = std::get_if<ErrorResponse>(&*res)) {
+    cerr_color(YELLOW, "Failed to Get value from server: ", error_res->msg);
+  }
 
-  return SimpleClient{*server}.Get(key);
+  return std::nullopt;
 }
 
 bool ShardKvClient::Put(const std::string& key, const std::string& value) {
-  // Query shardcontroller for config
-  auto config = this->Query();
-  if (!config) return false;
+  std::optional<Response> res = this->route(key, PutRequest{key, value});
+  if (!res) return false;
+  if (auto* put_res = std::get_if<PutResponse>(&*res)) {
+    return true;
+  } else if (auto* error_res = std::get_if<ErrorResponse>(&*res)) {
+    cerr_color(YELLOW, "Failed to Put value to server: ", error_res->msg);
+  }
 
-  // find responsible server in config, then make Put request
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return false;
-  return SimpleClient{*server}.Put(key, value);
+  return false;
 }
 
 bool ShardKvClient::Append(const std::string& key, const std::string& value) {
-  // Query shardcontroller for config
-  auto config = this->Query();
-  if (!config) return false;
+  std::optional<Response> res = this->route(key, AppendRequest{key, value});
+  if (!res) return false;
+  if (auto* append_res = std::get_if<AppendResponse>(&*res)) {
+    return true;
+  } else if (auto* error_res = std::get_if<ErrorResponse>(&*res)) {
+    cerr_color(YELLOW, "Failed to Append value to server: ", error_res->msg);
+  }
 
-  // find responsible server in config, then make Append request
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return false;
-  return SimpleClient{*server}.Append(key, value);
+  return false;
 }
 
 std::optional<std::string> ShardKvClient::Delete(const std::string& key) {
-  // Query shardcontroller for config
-  auto config = this->Query();
-  if (!config) return std::nullopt;
+  std::optional<Response> res = this->route(key, DeleteRequest{key});
+  if (!res) return std::nullopt;
+  if (auto* delete_res = std::get_if<DeleteResponse>(&*res)) {
+    return delete_res->value;
+  } else if (auto* error_res = std::get_if<ErrorResponse>(&*res)) {
+    cerr_color(YELLOW, "Failed to Delete value on server: ", error_res->msg);
+  }
 
-  // find responsible server in config, then make Delete request
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return std::nullopt;
-  return SimpleClient{*server}.Delete(key);
+  return std::nullopt;
 }
 
 std::optional<std::vector<std::string>> ShardKvClient::MultiGet(
     const std::vector<std::string>& keys) {
-  std::vector<std::string> values;
-  values.reserve(keys.size());
-  // TODO (Part B, Step 3): Implement!
+  std::vector<std::string> values(keys.size());
+  auto make_req = [&](const std::vector<size_t>& indices) -> Request {
+    MultiGetRequest req;
+    req.keys.reserve(indices.size());
+    for (size_t i : indices) req.keys.push_back(keys[i]);
+    return req;
+  };
+  auto gather = [&](const std::vector<size_t>& indices, const Response& res) {
+    if (auto* multiget_res = std::get_if<MultiGetResponse>(&res)) {
+      if (multiget_res->values.size() != indices.size()) return false;
+      for (size_t j = 0; j < indices.size(); j++) {
+        values[indices[j]] = multiget_res->values[j];
+      }
+      return true;
+    } else if (auto* error_res = std::get_if<ErrorResponse>(&res)) {
+      cerr_color(YELLOW, "Failed to MultiGet values on server: ",
+                 error_res->msg);
+    }
+    return false;
+  };
+
+  if (!this->scatter(keys, make_req, gather)) return std::nullopt;
   return values;
 }
 
 bool ShardKvClient::MultiPut(const std::vector<std::string>& keys,
                              const std::vector<std::string>& values) {
-  // TODO (Part B, Step 3): Implement!
-  return true;
+  if (keys.size() != values.size()) return false;
+
+  auto make_req = [&](const std::vector<size_t>& indices) -> Request {
+    MultiPutRequest req;
+    req.keys.reserve(indices.size());
+    req.values.reserve(indices.size());
+    for (size_t i : indices) {
+      req.keys.push_back(keys[i]);
+      req.values.push_back(values[i]);
+    }
+    return req;
+  };
+  auto gather = [&](const std::vector<size_t>&, const Response& res) {
+    if (auto* multiput_res = std::get_if<MultiPutResponse>(&res)) {
+      return true;
+    } else if (auto* error_res = std::get_if<ErrorResponse>(&res)) {
+      cerr_color(YELLOW, "Failed to MultiPut values on server: ",
+                 error_res->msg);
+    }
+    return false;
+  };
+
+  return this->scatter(keys, make_req, gather);
 }
 
 // Shardcontroller functions
 std::optional<ShardControllerConfig> ShardKvClient::Query() {
+  this->queries++;
   QueryRequest req;
   if (!this->shardcontroller_conn->send_request(req)) return std::nullopt;
 
@@ -81,8 +142,192 @@ bool ShardKvClient::Move(const std::string& dest_server,
   std::optional<Response> res = this->shardcontroller_conn->recv_response();
   if (!res) return false;
   if (auto* move_res = std::get_if<MoveResponse>(&*res)) {
+    // The cached configuration is now out of date
+    std::unique_lock lock(this->config_mtx);
+    this->config = nullptr;
     return true;
   }
 
   return false;
 }
+
+std::shared_ptr<const ShardTable> ShardKvClient::cached_config(
+    const std::shared_ptr<const ShardTable>& stale) {
+  std::unique_lock lock(this->config_mtx);
+  if (this->config && this->config != stale) return this->config;
+
+  std::optional<ShardControllerConfig> fresh = this->Query();
+  if (!fresh) {
+    cerr_color(RED, "Failed to query shardcontroller at ",
+               this->shardcontroller_addr, '.');
+    return nullptr;
+  }
+  this->config = std::make_shared<const ShardTable>(*fresh);
+  return this->config;
+}
+
+void ShardKvClient::watch_loop() {
+  uint64_t epoch = 0;
+  while (true) {
+    if (!this->watcher_conn->send_request(WatchRequest{epoch})) return;
+    std::optional<Response> res = this->watcher_conn->recv_response();
+    if (!res) return;
+    auto* watch_res = std::get_if<WatchResponse>(&*res);
+    if (!watch_res) return;
+    if (watch_res->config.epoch <= epoch) continue;
+    epoch = watch_res->config.epoch;
+
+    // A query may have fetched an even newer one meanwhile
+    auto fresh = std::make_shared<const ShardTable>(watch_res->config);
+    std::unique_lock lock(this->config_mtx);
+    if (!this->config || this->config->epoch() < epoch) this->config = fresh;
+  }
+}
+
+void ShardKvClient::drop_config(
+    const std::shared_ptr<const ShardTable>& stale) {
+  std::unique_lock lock(this->config_mtx);
+  if (this->config == stale) this->config = nullptr;
+}
+
+std::optional<Response> ShardKvClient::route(const std::string& key,
+                                             const Request& req) {
+  std::shared_ptr<const ShardTable> config = this->cached_config();
+  std::optional<Response> res;
+  size_t redirects = 0, waits = 0;
+  while (config) {
+    // No server may have had the key's shard when the configuration was
+    // queried, so check for a newer one before giving up.
+    const std::string* server = config->get_server(key);
+    if (!server) {
+      if (redirects++ == MAX_REDIRECTS) break;
+      config = this->cached_config(config);
+      continue;
+    }
+
+    res = SimpleClient(*server, *this->pool).Call(req);
+    if (!res) {
+      // The server may have left, in which case its shards are elsewhere now;
+      // have the next request query for where.
+      this->drop_config(config);
+      return std::nullopt;
+    }
+
+    if (shard_moving(*res)) {
+      if (!this->back_off(&waits)) break;
+    } else if (!not_responsible(*res) ||
+               !this->follow_redirect(&config, &redirects, &waits)) {
+      break;
+    }
+  }
+  return res;
+}
+
+bool ShardKvClient::scatter(
+    const std::vector<std::string>& keys,
+    const std::function<Request(const std::vector<size_t>&)>& make_req,
+    const std::function<bool(const std::vector<size_t>&, const Response&)>&
+        gather) {
+  // A server's share of the keys, and the connection its request went out on
+  struct SubBatch {
+    std::vector<size_t> indices;
+    ConnPool::Lease conn;
+  };
+
+  // Positions of the keys still to be sent
+  std::vector<size_t> pending(keys.size());
+  std::iota(pending.begin(), pending.end(), 0);
+
+  std::shared_ptr<const ShardTable> config = this->cached_config();
+  size_t redirects = 0, waits = 0;
+  while (config) {
+    std::map<std::string, std::vector<size_t>> by_server;
+    bool all_found = true;
+    for (size_t i : pending) {
+      const std::string* server = config->get_server(keys[i]);
+      if (!server) {
+        all_found = false;
+        break;
+      }
+      by_server[*server].push_back(i);
+    }
+    if (!all_found) {
+      if (redirects++ == MAX_REDIRECTS) return false;
+      config = this->cached_config(config);
+      continue;
+    }
+
+    // Send every server its share before waiting on any of them
+    bool ok = true;
+    bool lost_conn = false;
+    std::vector<SubBatch> batches;
+    for (auto&& [server, indices] : by_server) {
+      Request req = make_req(indices);
+      ConnPool::Lease conn = this->pool->acquire(server);
+      // As in SimpleClient::Call, a reused connection the server has since
+      // closed is replaced; nothing was sent on it.
+      while (conn && !conn->send_request(req)) {
+        bool reused = conn.was_reused();
+        conn.discard();
+        if (!reused) break;
+        conn = this->pool->acquire(server);
+      }
+      if (!conn) {
+        cerr_color(RED, "Failed to send request to KvServer at ", server, '.');
+        ok = false;
+        lost_conn = true;
+        break;
+      }
+      batches.push_back({std::move(indices), std::move(conn)});
+    }
+
+    // Read every response that's owed, even after a failure, so that the
+    // connections go back to the pool with nothing left to read on them.
+    pending.clear();
+    bool redirected = false;
+    for (auto&& batch : batches) {
+      std::optional<Response> res = batch.conn->recv_response();
+      if (!res) {
+        batch.conn.discard();
+        ok = false;
+        lost_conn = true;
+      } else if (not_responsible(*res) || shard_moving(*res)) {
+        redirected = redirected || not_responsible(*res);
+        pending.insert(pending.end(), batch.indices.begin(),
+                       batch.indices.end());
+      } else if (!gather(batch.indices, *res)) {
+        ok = false;
+      }
+    }
+    // A server that can't be reached may have left; have the next request
+    // query for where its shards went.
+    if (lost_conn) this->drop_config(config);
+    if (!ok) return false;
+    if (pending.empty()) return true;
+    if (redirected) {
+      if (!this->follow_redirect(&config, &redirects, &waits)) return false;
+    } else {
+      // Only shards still moving held keys up; the config is right.
+      if (!this->back_off(&waits)) return false;
+    }
+  }
+  return false;
+}
+
+bool ShardKvClient::follow_redirect(std::shared_ptr<const ShardTable>* config,
+                                    size_t* redirects, size_t* waits) {
+  std::shared_ptr<const ShardTable> stale = *config;
+  *config = this->cached_config(stale);
+  // If the configuration hasn't changed, the server turned the request away
+  // because it hasn't caught up with it yet, so give it time to.
+  if (*config && stale->epoch() != 0 && (*config)->epoch() == stale->epoch()) {
+    return this->back_off(waits);
+  }
+  return (*redirects)++ < MAX_REDIRECTS;
+}
+
+bool ShardKvClient::back_off(size_t* waits) {
+  if ((*waits)++ == MAX_MOVING_WAITS) return false;
+  std::this_thread::sleep_for(MOVING_BACKOFF);
+  return true;
+}
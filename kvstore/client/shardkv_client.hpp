@@ -2,21 +2,29 @@
 #define SHARDKV_CLIENT_HPP
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "client.hpp"
 #include "common/config.hpp"
+#include "conn_pool.hpp"
 #include "net/network_conn.hpp"
 #include "net/network_messages.hpp"
 #include "simple_client.hpp"
 
 class ShardKvClient : public Client {
  public:
-  explicit ShardKvClient(const std::string& sm_addr)
-      : shardcontroller_addr(sm_addr) {
+  explicit ShardKvClient(const std::string& sm_addr,
+                         ConnPool& pool = ConnPool::shared())
+      : shardcontroller_addr(sm_addr), pool(&pool) {
     this->shardcontroller_conn = connect_to_server(this->shardcontroller_addr);
     if (!this->shardcontroller_conn) {
       cerr_color(RED, "Failed to connect to shardcontroller at ",
@@ -25,10 +33,21 @@ class ShardKvClient : public Client {
     }
     cout_color(BLUE, "Connected to shardcontroller at ",
                this->shardcontroller_addr, '.');
+
+    // Without a watcher, the configuration is still refreshed whenever a
+    // server turns a request away, so this is no reason to give up.
+    this->watcher_conn = connect_to_server(this->shardcontroller_addr);
+    if (this->watcher_conn) {
+      this->watcher = std::thread(&ShardKvClient::watch_loop, this);
+    }
   }
 
   ~ShardKvClient() {
     this->shardcontroller_conn->shutdown();
+    if (this->watcher_conn) {
+      this->watcher_conn->shutdown();
+      this->watcher.join();
+    }
   }
 
   // ShardKvStore functions
@@ -54,9 +73,86 @@ class ShardKvClient : public Client {
   std::optional<ShardControllerConfig> Query();
   bool Move(const std::string& dest_server, const std::vector<Shard>& shards);
 
+  // Number of Query requests sent to the shardcontroller so far, including
+  // those made to refresh the cached configuration.
+  size_t query_count() const {
+    return this->queries;
+  }
+
  private:
+  // Times a request is sent again, each time with a freshly queried
+  // configuration, after a server replies that it isn't responsible for the
+  // key. More than one may be needed while shards are being moved, as servers
+  // and the client each pick up configuration changes in their own time.
+  static constexpr size_t MAX_REDIRECTS = 3;
+  // Times a request is sent again, MOVING_BACKOFF apart, after a server
+  // replies that the key's shard is moving there but its pairs haven't all
+  // arrived yet, or that it isn't responsible for the key by a configuration
+  // it hasn't caught up with yet.
+  static constexpr size_t MAX_MOVING_WAITS = 500;
+  static constexpr std::chrono::milliseconds MOVING_BACKOFF{10};
+
   std::string shardcontroller_addr;
   std::shared_ptr<ServerConn> shardcontroller_conn;
+  // Connections to the servers, shared with the SimpleClients it makes.
+  ConnPool* pool;
+
+  // The configuration requests are routed by, compiled into a ShardTable,
+  // queried from the shardcontroller the first time it's needed and only again
+  // once it turns out to be stale. Also serializes requests over
+  // shardcontroller_conn made to refresh it.
+  std::mutex config_mtx;
+  std::shared_ptr<const ShardTable> config;
+  std::atomic<size_t> queries = 0;
+
+  // Watches the shardcontroller's configuration on a connection of its own,
+  // replacing the cached one as soon as it changes, so that requests are
+  // rarely routed by a stale one.
+  std::shared_ptr<ServerConn> watcher_conn;
+  std::thread watcher;
+  void watch_loop();
+
+  // Returns the cached configuration, querying the shardcontroller if there's
+  // none, or if the cached one is `stale` (a configuration a caller found to
+  // be out of date; if another caller has already replaced it, there's no
+  // need to query again). Returns nullptr if the query fails.
+  std::shared_ptr<const ShardTable> cached_config(
+      const std::shared_ptr<const ShardTable>& stale = nullptr);
+
+  // Forgets the cached configuration if it's still `stale`, so that the next
+  // request queries the shardcontroller again.
+  void drop_config(const std::shared_ptr<const ShardTable>& stale);
+
+  // After a server replies that it isn't responsible for a key, refreshes
+  // *config. If it's unchanged, the server hasn't caught up with it yet, so
+  // this backs off as back_off does; otherwise, it counts as a redirect.
+  // Returns false once out of redirects or waits.
+  bool follow_redirect(std::shared_ptr<const ShardTable>* config,
+                       size_t* redirects, size_t* waits);
+  // Waits MOVING_BACKOFF before a request is sent again, unless it's been
+  // sent MAX_MOVING_WAITS times already, in which case it returns false.
+  bool back_off(size_t* waits);
+
+  // Sends req to the server responsible for key according to the cached
+  // configuration, and returns its response. If the server says it isn't
+  // responsible for the key, refreshes the configuration and tries again, up
+  // to MAX_REDIRECTS times; if it says the key's shard is still moving there,
+  // or it hasn't caught up with the configuration, waits for it to.
+  std::optional<Response> route(const std::string& key, const Request& req);
+
+  // Splits keys among the servers responsible for them, and sends each server
+  // the request make_req builds from the positions (in keys) of its share.
+  // Every request is sent before any response is read, so the servers work
+  // on them at the same time. Each response is passed to gather along with
+  // the positions it's for; keys a server says it isn't responsible for are
+  // sent again with a refreshed configuration, up to MAX_REDIRECTS times,
+  // and keys whose shards are still moving are sent again once they may have
+  // arrived. Returns false if any request failed, or gather returned false.
+  bool scatter(
+      const std::vector<std::string>& keys,
+      const std::function<Request(const std::vector<size_t>&)>& make_req,
+      const std::function<bool(const std::vector<size_t>&, const Response&)>&
+          gather);
 };
 
 #endif /* end of include guard */
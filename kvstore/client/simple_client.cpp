@@ -1,17 +1,8 @@
 #include "simple_client.hpp"
 
 std::optional<std::string> SimpleClient::Get(const std::string& key) {
-  std::shared_ptr<ServerConn> conn = connect_to_server(this->server_addr);
-  if (!conn) {
-    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
-               '.');
-    return std::nullopt;
-  }
-
   GetRequest req{key};
-  if (!conn->send_request(req)) return std::nullopt;
-
-  std::optional<Response> res = conn->recv_response();
+  std::optional<Response> res = this->Call(req);
   if (!res) return std::nullopt;
   if (auto* get_res = std::get_if<GetResponse>(&*res)) {
     return get_res->value;
@@ -23,17 +14,8 @@ std::optional<std::string> SimpleClient::Get(const std::string& key) {
 }
 
 bool SimpleClient::Put(const std::string& key, const std::string& value) {
-  std::shared_ptr<ServerConn> conn = connect_to_server(this->server_addr);
-  if (!conn) {
-    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
-               '.');
-    return false;
-  }
-
   PutRequest req{key, value};
-  if (!conn->send_request(req)) return false;
-
-  std::optional<Response> res = conn->recv_response();
+  std::optional<Response> res = this->Call(req);
   if (!res) return false;
   if (auto* put_res = std::get_if<PutResponse>(&*res)) {
     return true;
@@ -45,17 +27,8 @@ bool SimpleClient::Put(const std::string& key, const std::string& value) {
 }
 
 bool SimpleClient::Append(const std::string& key, const std::string& value) {
-  std::shared_ptr<ServerConn> conn = connect_to_server(this->server_addr);
-  if (!conn) {
-    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
-               '.');
-    return false;
-  }
-
   AppendRequest req{key, value};
-  if (!conn->send_request(req)) return false;
-
-  std::optional<Response> res = conn->recv_response();
+  std::optional<Response> res = this->Call(req);
   if (!res) return false;
   if (auto* append_res = std::get_if<AppendResponse>(&*res)) {
     return true;
@@ -67,17 +40,8 @@ bool SimpleClient::Append(const std::string& key, const std::string& value) {
 }
 
 std::optional<std::string> SimpleClient::Delete(const std::string& key) {
-  std::shared_ptr<ServerConn> conn = connect_to_server(this->server_addr);
-  if (!conn) {
-    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
-               '.');
-    return std::nullopt;
-  }
-
   DeleteRequest req{key};
-  if (!conn->send_request(req)) return std::nullopt;
-
-  std::optional<Response> res = conn->recv_response();
+  std::optional<Response> res = this->Call(req);
   if (!res) return std::nullopt;
   if (auto* delete_res = std::get_if<DeleteResponse>(&*res)) {
     return delete_res->value;
@@ -90,17 +54,8 @@ std::optional<std::string> SimpleClient::Delete(const std::string& key) {
 
 std::optional<std::vector<std::string>> SimpleClient::MultiGet(
     const std::vector<std::string>& keys) {
-  std::shared_ptr<ServerConn> conn = connect_to_server(this->server_addr);
-  if (!conn) {
-    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
-               '.');
-    return std::nullopt;
-  }
-
   MultiGetRequest req{keys};
-  if (!conn->send_request(req)) return std::nullopt;
-
-  std::optional<Response> res = conn->recv_response();
+  std::optional<Response> res = this->Call(req);
   if (!res) return std::nullopt;
   if (auto* multiget_res = std::get_if<MultiGetResponse>(&*res)) {
     return multiget_res->values;
@@ -113,17 +68,8 @@ std::optional<std::vector<std::string>> SimpleClient::MultiGet(
 
 bool SimpleClient::MultiPut(const std::vector<std::string>& keys,
                             const std::vector<std::string>& values) {
-  std::shared_ptr<ServerConn> conn = connect_to_server(this->server_addr);
-  if (!conn) {
-    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
-               '.');
-    return false;
-  }
-
   MultiPutRequest req{keys, values};
-  if (!conn->send_request(req)) return false;
-
-  std::optional<Response> res = conn->recv_response();
+  std::optional<Response> res = this->Call(req);
   if (!res) return false;
   if (auto* multiput_res = std::get_if<MultiPutResponse>(&*res)) {
     return true;
@@ -134,6 +80,46 @@ bool SimpleClient::MultiPut(const std::vector<std::string>& keys,
   return false;
 }
 
+std::vector<std::optional<Response>> SimpleClient::Pipeline(
+    const std::vector<Request>& requests) {
+  ConnPool::Lease conn = this->pool->acquire(this->server_addr);
+  if (!conn) {
+    cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
+               '.');
+    return std::vector<std::optional<Response>>(requests.size());
+  }
+
+  std::vector<std::optional<Response>> responses = conn->pipeline(requests);
+  if (!responses.empty() && !responses.back()) conn.discard();
+  return responses;
+}
+
+std::optional<Response> SimpleClient::Call(const Request& req) {
+  while (true) {
+    ConnPool::Lease conn = this->pool->acquire(this->server_addr);
+    if (!conn) {
+      cerr_color(RED, "Failed to connect to KvServer at ", this->server_addr,
+                 '.');
+      return std::nullopt;
+    }
+
+    if (!conn->send_request(req)) {
+      // The server may have closed an idle connection since it was checked,
+      // and nothing was sent on it, so it's safe to try again on another.
+      // A new connection failing is a real failure.
+      conn.discard();
+      if (conn.was_reused()) continue;
+      return std::nullopt;
+    }
+
+    // Past this point the server may have acted on the request, so don't
+    // retry it; it might not be safe to do twice (an Append, say).
+    std::optional<Response> res = conn->recv_response();
+    if (!res) conn.discard();
+    return res;
+  }
+}
+
 bool SimpleClient::GDPRDelete(const std::string& user) {
   // TODO: Write your GDPR deletion code here!
   // You can invoke operations directly on the client object, like so:
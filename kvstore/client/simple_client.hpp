@@ -3,14 +3,17 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "client.hpp"
+#include "conn_pool.hpp"
 #include "net/network_conn.hpp"
 
 class SimpleClient : public Client {
  public:
-  explicit SimpleClient(const std::string& server_addr)
-      : server_addr(server_addr) {
+  explicit SimpleClient(const std::string& server_addr,
+                        ConnPool& pool = ConnPool::shared())
+      : server_addr(server_addr), pool(&pool) {
   }
   ~SimpleClient() = default;
 
@@ -31,8 +34,23 @@ class SimpleClient : public Client {
 
   bool GDPRDelete(const std::string& user);
 
+  // Sends all of the requests over one connection without waiting on each in
+  // turn (see ServerConn::pipeline), for callers with many independent
+  // requests to make, like bulk loads. Returns the responses in order; those
+  // that couldn't be sent or received contain no value.
+  std::vector<std::optional<Response>> Pipeline(
+      const std::vector<Request>& requests);
+
+  // Sends a request to the server over a pooled connection and returns its
+  // response, or an empty std::optional if it couldn't be sent or received.
+  // For callers that need to look at an ErrorResponse, not just that the
+  // request failed.
+  std::optional<Response> Call(const Request& req);
+
  private:
   std::string server_addr;
+  // Where connections to the server come from, and go back to.
+  ConnPool* pool;
 };
 
 #endif /* end of include guard */
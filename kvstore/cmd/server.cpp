@@ -1,8 +1,12 @@
 #include "server/server.hpp"
 
+#include <charconv>
 #include <cstdlib>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "kvstore/kvstore.hpp"
 #include "repl/repl.hpp"
@@ -10,13 +14,84 @@
 #include "server/cmd/leavecommand.hpp"
 #include "server/cmd/printcommand.hpp"
 
+static void print_usage() {
+  cerr_color(RED,
+             "\nIf on Concurrent Store:\n"
+             "\t./server <port> [n_workers] [--store=concurrent|epoch] "
+             "[--wal=<path>] [--sync=always|none|<ms>]\n"
+             "\t\t[--snapshot=<path>] [--snapshot-every=<seconds>]\n"
+             "If on Distributed Store:\n"
+             "\t./server <port> <shardcontroller hostname:port> [n_workers] "
+             "[--store=concurrent|epoch]");
+}
+
+// Parses the whole of s as a positive number into *out, returning whether it
+// was one (std::stoi would throw on a typo, and accept trailing junk).
+static bool parse_positive(std::string_view s, int* out) {
+  auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc() && end == s.data() + s.size() && *out > 0;
+}
+
 int main(int argc, char* argv[]) {
+  // Pull out the optional `--store=<concurrent|epoch>`, `--wal=<path>`,
+  // `--sync=<always|none|ms>`, `--snapshot=<path>` and
+  // `--snapshot-every=<seconds>` flags, leaving the positional arguments in
+  // place.
+  StoreType store_type = StoreType::CONCURRENT;
+  WalOptions wal;
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--store=concurrent") {
+      store_type = StoreType::CONCURRENT;
+    } else if (arg == "--store=epoch") {
+      store_type = StoreType::EPOCH;
+    } else if (arg.starts_with("--wal=")) {
+      wal.path = arg.substr(std::string("--wal=").size());
+    } else if (arg == "--sync=always") {
+      wal.sync = SyncPolicy::ALWAYS;
+    } else if (arg == "--sync=none") {
+      wal.sync = SyncPolicy::NEVER;
+    } else if (arg.starts_with("--sync=")) {
+      // The syncer would spin if it waited no time at all between syncs
+      int ms = 0;
+      if (!parse_positive(arg.substr(std::string("--sync=").size()), &ms)) {
+        cerr_color(RED, "--sync=<ms> needs a positive interval");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+      wal.sync = SyncPolicy::INTERVAL;
+      wal.interval = std::chrono::milliseconds(ms);
+    } else if (arg.starts_with("--snapshot=")) {
+      wal.snapshot_path = arg.substr(std::string("--snapshot=").size());
+    } else if (arg.starts_with("--snapshot-every=")) {
+      int seconds = 0;
+      if (!parse_positive(arg.substr(std::string("--snapshot-every=").size()),
+                          &seconds)) {
+        cerr_color(RED, "--snapshot-every=<seconds> needs a positive interval");
+        print_usage();
+        return EXIT_FAILURE;
+      }
+      wal.snapshot_interval = std::chrono::seconds(seconds);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  argc = args.size();
+  argv = args.data();
+
+  // A snapshot is of the logged store, and only saves replaying the log.
+  if (wal.path.empty() && !wal.snapshot_path.empty()) {
+    cerr_color(RED, "--snapshot needs --wal");
+    return EXIT_FAILURE;
+  }
+  if (wal.snapshot_path.empty() && wal.snapshot_interval.count() > 0) {
+    cerr_color(RED, "--snapshot-every needs --snapshot");
+    return EXIT_FAILURE;
+  }
+
   if (argc < 2 || argc > 4) {
-    cerr_color(RED,
-               "\nIf on Concurrent Store:\n"
-               "\t./server <port> [n_workers]\n"
-               "If on Distributed Store:\n"
-               "\t./server <port> <shardcontroller hostname:port> [n_workers]");
+    print_usage();
     return EXIT_FAILURE;
   }
 
@@ -45,9 +120,14 @@ int main(int argc, char* argv[]) {
   // If no shardcontroller address specified, Concurrent Store; otherwise,
   // Distributed Store
   if (shardcontroller_addr.empty()) {
-    server = std::make_shared<KvServer>(addr, n_workers);
+    server = std::make_shared<KvServer>(addr, n_workers, store_type, wal);
   } else {
-    server = std::make_shared<KvServer>(addr, shardcontroller_addr, n_workers);
+    if (!wal.path.empty()) {
+      cerr_color(RED, "--wal is only supported on Concurrent Store");
+      return EXIT_FAILURE;
+    }
+    server = std::make_shared<KvServer>(addr, shardcontroller_addr, n_workers,
+                                        store_type);
   }
 
   int ret = server->start();
@@ -0,0 +1,172 @@
+#include "common/compression.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Shortest match worth encoding; a token, offset and match take 3 bytes.
+static constexpr size_t MIN_MATCH = 4;
+// The format requires the last 5 bytes to be literals, and the last match to
+// start at least 12 bytes before the end, so that decoders can copy in words
+// without checking for the end every time.
+static constexpr size_t LAST_LITERALS = 5;
+static constexpr size_t MF_LIMIT = 12;
+// Farthest back a match can be, as offsets take 2 bytes.
+static constexpr size_t MAX_OFFSET = 65535;
+// Positions of the last few 4-byte sequences seen, by hash.
+static constexpr int HASH_BITS = 12;
+// After every 2^SKIP_STRENGTH bytes without a match, look for one at every
+// other byte, then every third, and so on, so that incompressible data goes
+// by quickly.
+static constexpr int SKIP_STRENGTH = 6;
+
+static uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash_seq(uint32_t seq) {
+  return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes the part of a literal or match length that didn't fit in its token
+// nibble.
+static uint8_t* put_length(uint8_t* op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = uint8_t(len);
+  return op;
+}
+
+// Reads a length written by put_length onto *len. Returns false if it runs
+// past end.
+static bool get_length(const uint8_t** ip, const uint8_t* end, size_t* len) {
+  uint8_t b;
+  do {
+    if (*ip >= end) return false;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+// Writes a sequence: lit literals from anchor, then (unless it's the last
+// sequence) a match of match_len bytes from offset back.
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* anchor, size_t lit,
+                             size_t offset, size_t match_len, bool last) {
+  uint8_t* token = op++;
+  *token = uint8_t(std::min<size_t>(lit, 15) << 4);
+  if (lit >= 15) op = put_length(op, lit - 15);
+  std::memcpy(op, anchor, lit);
+  op += lit;
+  if (last) return op;
+
+  *op++ = uint8_t(offset);
+  *op++ = uint8_t(offset >> 8);
+  size_t len = match_len - MIN_MATCH;
+  *token |= uint8_t(std::min<size_t>(len, 15));
+  if (len >= 15) op = put_length(op, len - 15);
+  return op;
+}
+
+size_t lz_compress_bound(size_t len) {
+  return len + len / 255 + 16;
+}
+
+size_t lz_decompress_bound(size_t len) {
+  // Every 255 extension bytes of a match length add 255 bytes of output
+  return len * 255 + 16;
+}
+
+size_t lz_compress(std::span<const std::byte> src_bytes, std::byte* dst) {
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(src_bytes.data());
+  const uint8_t* end = src + src_bytes.size();
+  uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+  const uint8_t* anchor = src;
+
+  if (src_bytes.size() > MF_LIMIT) {
+    // Offsets from src of the last position each hash was seen at
+    uint32_t table[1 << HASH_BITS] = {};
+    const uint8_t* match_limit = end - MF_LIMIT;
+    const uint8_t* match_end_limit = end - LAST_LITERALS;
+
+    const uint8_t* ip = src + 1;
+    size_t misses = 0;
+    while (ip < match_limit) {
+      uint32_t seq = read32(ip);
+      uint32_t h = hash_seq(seq);
+      const uint8_t* ref = src + table[h];
+      table[h] = uint32_t(ip - src);
+      if (ref >= ip || size_t(ip - ref) > MAX_OFFSET || read32(ref) != seq) {
+        ip += 1 + (misses++ >> SKIP_STRENGTH);
+        continue;
+      }
+      misses = 0;
+
+      // Extend the match backwards over literals, then forwards
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const uint8_t* match_end = ip + MIN_MATCH;
+      const uint8_t* ref_end = ref + MIN_MATCH;
+      while (match_end < match_end_limit && *match_end == *ref_end) {
+        match_end++;
+        ref_end++;
+      }
+
+      op = put_sequence(op, anchor, ip - anchor, ip - ref, match_end - ip,
+                        false);
+      ip = anchor = match_end;
+    }
+  }
+
+  op = put_sequence(op, anchor, end - anchor, 0, 0, true);
+  return op - reinterpret_cast<uint8_t*>(dst);
+}
+
+bool lz_decompress(std::span<const std::byte> src_bytes,
+                   std::span<std::byte> dst_bytes) {
+  const uint8_t* ip = reinterpret_cast<const uint8_t*>(src_bytes.data());
+  const uint8_t* iend = ip + src_bytes.size();
+  uint8_t* dst = reinterpret_cast<uint8_t*>(dst_bytes.data());
+  uint8_t* op = dst;
+  uint8_t* oend = dst + dst_bytes.size();
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t lit = token >> 4;
+    if (lit == 15 && !get_length(&ip, iend, &lit)) return false;
+    if (lit > size_t(iend - ip) || lit > size_t(oend - op)) return false;
+    std::memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    // The last sequence has no match
+    if (ip == iend) break;
+
+    if (iend - ip < 2) return false;
+    size_t offset = ip[0] | (size_t(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > size_t(op - dst)) return false;
+
+    size_t len = token & 15;
+    if (len == 15 && !get_length(&ip, iend, &len)) return false;
+    len += MIN_MATCH;
+    if (len > size_t(oend - op)) return false;
+
+    const uint8_t* match = op - offset;
+    if (offset >= len) {
+      std::memcpy(op, match, len);
+      op += len;
+    } else {
+      // The match overlaps what it's copied to, repeating the last offset
+      // bytes; copy a byte at a time so that each sees the one before.
+      for (size_t i = 0; i < len; i++) *op++ = *match++;
+    }
+  }
+  return op == oend;
+}
@@ -0,0 +1,29 @@
+#ifndef COMMON_COMPRESSION_HPP
+#define COMMON_COMPRESSION_HPP
+
+#include <cstddef>
+#include <span>
+
+// A fast block compressor, writing the LZ4 block format: runs of literal bytes
+// alternate with matches, each copying at least 4 bytes from up to 64KB back.
+// It trades compression ratio for speed, so that compressing messages costs
+// less than sending the bytes it saves.
+
+// Largest size lz_compress can compress len bytes to (incompressible data
+// grows a little).
+size_t lz_compress_bound(size_t len);
+
+// Compresses src into dst, which must have room for lz_compress_bound(
+// src.size()) bytes. Returns the compressed size.
+size_t lz_compress(std::span<const std::byte> src, std::byte* dst);
+
+// Decompresses src, compressed by lz_compress, into dst, which must be exactly
+// the size src was before it was compressed. Returns false if src is corrupt,
+// or doesn't decompress to exactly that many bytes.
+bool lz_decompress(std::span<const std::byte> src, std::span<std::byte> dst);
+
+// Most a block of len compressed bytes can decompress to, for telling whether
+// a claimed original size is plausible before making room for it.
+size_t lz_decompress_bound(size_t len);
+
+#endif /* end of include guard */
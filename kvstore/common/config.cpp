@@ -1,10 +1,31 @@
 #include "common/config.hpp"
 
+#include <algorithm>
+#include <cctype>
+
 #include "common/color.hpp"
 
+// Compares the first bound.size() characters of key, upper-cased, to bound,
+// as Shard::contains compares a key to its bounds once it's upper-cased.
+static int compare_prefix(std::string_view key, const std::string& bound) {
+  size_t n = std::min(key.size(), bound.size());
+  for (size_t i = 0; i < n; i++) {
+    int c = std::toupper(static_cast<unsigned char>(key[i]));
+    int b = static_cast<unsigned char>(bound[i]);
+    if (c != b) return c < b ? -1 : 1;
+  }
+  // A shorter key is a prefix of the bound, which sorts after it.
+  return key.size() < bound.size() ? -1 : 0;
+}
+
+bool shard_contains(const Shard& shard, std::string_view key) {
+  return compare_prefix(key, shard.lower) >= 0 &&
+         compare_prefix(key, shard.upper) <= 0;
+}
+
 std::string ShardControllerConfig::print() {
   std::stringstream ss;
-  ss << "Shardcontroller configuration: \n";
+  ss << "Shardcontroller configuration (epoch " << this->epoch << "): \n";
   for (auto&& [server, shards] : this->server_to_shards) {
     ss << "- " << server << ": ";
     for (auto&& s : shards) {
@@ -17,10 +38,12 @@ std::string ShardControllerConfig::print() {
 }
 
 std::optional<std::string> ShardControllerConfig::get_server(
-    const std::string& key) {
-  std::string key_uppercase = to_upper(key);
-  // TODO (Part B, Step 2): Implement!
-  // You should use key_uppercase (instead of key) in your implementation
+    const std::string& key) const {
+  for (auto&& [server, shards] : this->server_to_shards) {
+    for (auto&& shard : shards) {
+      if (shard_contains(shard, key)) return server;
+    }
+  }
   cerr_color(
       RED,
       "Shardcontroller config does not contain any server responsible for "
@@ -28,3 +51,29 @@ std::optional<std::string> ShardControllerConfig::get_server(
       key);
   return std::nullopt;
 }
+
+ShardTable::ShardTable(const ShardControllerConfig& config)
+    : config_epoch(config.epoch) {
+  for (auto&& [server, shards] : config.server_to_shards) {
+    for (auto&& shard : shards) {
+      this->entries.push_back({shard, this->servers.size()});
+    }
+    this->servers.push_back(server);
+  }
+  std::stable_sort(this->entries.begin(), this->entries.end(),
+                   [](const Entry& a, const Entry& b) {
+                     return a.shard.lower < b.shard.lower;
+                   });
+}
+
+const std::string* ShardTable::get_server(std::string_view key) const {
+  // Shards don't overlap, so the only one that can contain the key is the
+  // last one whose lower bound it isn't before.
+  auto it = std::partition_point(
+      this->entries.begin(), this->entries.end(),
+      [&](const Entry& e) { return compare_prefix(key, e.shard.lower) >= 0; });
+  if (it == this->entries.begin()) return nullptr;
+  --it;
+  if (compare_prefix(key, it->shard.upper) > 0) return nullptr;
+  return &this->servers[it->server];
+}
@@ -1,9 +1,11 @@
 #ifndef COMMON_CONFIG_HPP
 #define COMMON_CONFIG_HPP
 
+#include <cstdint>
 #include <map>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "common/shard.hpp"
@@ -12,11 +14,49 @@
 struct ShardControllerConfig {
   // map each server address to the shards it's responsible for
   std::map<std::string, std::vector<Shard>> server_to_shards;
+  // Bumped by the shardcontroller every time the config changes, so that
+  // anyone holding a copy can tell whether it's out of date, and ask to hear
+  // when it changes (see WatchRequest).
+  uint64_t epoch = 0;
 
   // Pretty printing of configuration
   std::string print();
   // Gets the server with the shard for the key.
-  std::optional<std::string> get_server(const std::string& key);
+  std::optional<std::string> get_server(const std::string& key) const;
+};
+
+// Whether the shard contains the key, compared case-insensitively, as keys
+// are looked up in a config.
+bool shard_contains(const Shard& shard, std::string_view key);
+
+// A ShardControllerConfig compiled for routing: every server's shards in one
+// array, sorted by lower bound, so that finding the server for a key is a
+// binary search over the shards that allocates nothing, rather than a walk
+// over every server's shards with an upper-cased copy of the key. Build one
+// whenever the config changes; it doesn't follow changes to the config it was
+// built from.
+class ShardTable {
+ public:
+  ShardTable() = default;
+  explicit ShardTable(const ShardControllerConfig& config);
+
+  // Gets the server with the shard for the key, or nullptr if no server has
+  // it. The server stays valid as long as the table does.
+  const std::string* get_server(std::string_view key) const;
+  // The epoch of the config the table was built from.
+  uint64_t epoch() const {
+    return this->config_epoch;
+  }
+
+ private:
+  struct Entry {
+    Shard shard;
+    // Index into servers
+    size_t server;
+  };
+  std::vector<std::string> servers;
+  std::vector<Entry> entries;
+  uint64_t config_epoch = 0;
 };
 
 #endif /* end of include guard */
@@ -0,0 +1,47 @@
+#include "common/crc32.hpp"
+
+#include <array>
+#include <cstring>
+
+// The Castagnoli polynomial, bit-reversed, since the CRC is computed least
+// significant bit first.
+static constexpr uint32_t POLY = 0x82F63B78;
+
+// TABLES[0][b] is the CRC of byte b; TABLES[k][b] is the CRC of byte b
+// followed by k zero bytes. Together they let the loop below fold in 8 bytes
+// at a time ("slicing-by-8") rather than one.
+static constexpr std::array<std::array<uint32_t, 256>, 8> TABLES = [] {
+  std::array<std::array<uint32_t, 256>, 8> tables{};
+  for (uint32_t b = 0; b < 256; b++) {
+    uint32_t crc = b;
+    for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+    tables[0][b] = crc;
+  }
+  for (size_t k = 1; k < tables.size(); k++) {
+    for (uint32_t b = 0; b < 256; b++) {
+      uint32_t prev = tables[k - 1][b];
+      tables[k][b] = (prev >> 8) ^ tables[0][prev & 0xFF];
+    }
+  }
+  return tables;
+}();
+
+uint32_t crc32c(std::span<const std::byte> data, uint32_t crc) {
+  const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+  size_t n = data.size();
+  crc = ~crc;
+  while (n >= 8) {
+    // Little-endian, as is everything this runs on (see DbBucket).
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    word ^= crc;
+    crc = TABLES[7][word & 0xFF] ^ TABLES[6][(word >> 8) & 0xFF] ^
+          TABLES[5][(word >> 16) & 0xFF] ^ TABLES[4][(word >> 24) & 0xFF] ^
+          TABLES[3][(word >> 32) & 0xFF] ^ TABLES[2][(word >> 40) & 0xFF] ^
+          TABLES[1][(word >> 48) & 0xFF] ^ TABLES[0][word >> 56];
+    p += 8;
+    n -= 8;
+  }
+  while (n--) crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xFF];
+  return ~crc;
+}
@@ -0,0 +1,15 @@
+#ifndef COMMON_CRC32_HPP
+#define COMMON_CRC32_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// CRC-32C (Castagnoli), as iSCSI, ext4 and most log formats use, for telling
+// whether bytes read back are the bytes that were written.
+
+// Returns the CRC of data. Passing the CRC of some earlier bytes as `crc`
+// continues it, so crc32c(b, crc32c(a)) is the CRC of a followed by b.
+uint32_t crc32c(std::span<const std::byte> data, uint32_t crc = 0);
+
+#endif /* end of include guard */
@@ -76,6 +76,17 @@ struct Shard {
            s.compare(0, granularity(), upper) <= 0;
   }
 
+  // Returns the range [start, end) of keys the shard contains, for a
+  // ScanRequest; keys in a scan are ordered case-insensitively, as shards
+  // compare them. An empty end means the range has no upper bound.
+  std::pair<std::string, std::string> key_range() const {
+    std::string end = upper;
+    // Every key that starts with `upper` sorts before `upper` with its last
+    // character bumped up by one.
+    if (!end.empty()) end.back()++;
+    return {lower, end};
+  }
+
   friend std::ostream& operator<<(std::ostream& os, const Shard& s) {
     return os << '[' << s.lower << ", " << s.upper << ']';
   }
@@ -1,5 +1,11 @@
 #include "common/utils.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <filesystem>
+
 std::vector<std::string> split(const std::string& s, char delim) {
   std::vector<std::string> res;
 
@@ -32,3 +38,22 @@ std::string to_lower(const std::string& s) {
                  [](unsigned char c) { return std::tolower(c); });
   return res;
 }
+
+bool write_all(int fd, std::span<const std::byte> buf) {
+  while (!buf.empty()) {
+    ssize_t n = write(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    buf = buf.subspan(n);
+  }
+  return true;
+}
+
+bool sync_dir(const std::string& path) {
+  std::filesystem::path dir = std::filesystem::path(path).parent_path();
+  int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
@@ -3,7 +3,9 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstddef>
 #include <numeric>
+#include <span>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -22,4 +24,11 @@ bool is_number(const std::string& s);
 std::string to_upper(const std::string& s);
 std::string to_lower(const std::string& s);
 
+// Writes all of buf to fd, retrying short writes. Returns false on error.
+bool write_all(int fd, std::span<const std::byte> buf);
+
+// Syncs the directory path is in, so that files created, renamed or deleted
+// in it stay that way after a crash. Returns false on error.
+bool sync_dir(const std::string& path);
+
 #endif /* end of include guard */
\ No newline at end of file
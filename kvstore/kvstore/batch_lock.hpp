@@ -0,0 +1,47 @@
+#ifndef BATCH_LOCK_HPP
+#define BATCH_LOCK_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Helpers for multi-key requests that lock only the stripes their keys fall
+ * in, rather than the whole store.
+ *
+ * Every request acquires its stripes in ascending index order. Two requests
+ * that share stripes therefore always contend on the lowest shared stripe
+ * first, and can never each hold a lock the other is waiting for; requests on
+ * disjoint stripes don't contend at all.
+ */
+
+// Returns the distinct stripes (hash % n_stripes) that `hashes` fall in, in
+// ascending order.
+inline std::vector<size_t> sorted_stripes(const std::vector<size_t>& hashes,
+                                          size_t n_stripes) {
+  std::vector<size_t> stripe_ids;
+  stripe_ids.reserve(hashes.size());
+  for (size_t hash : hashes) {
+    stripe_ids.push_back(hash % n_stripes);
+  }
+  std::sort(stripe_ids.begin(), stripe_ids.end());
+  stripe_ids.erase(std::unique(stripe_ids.begin(), stripe_ids.end()),
+                   stripe_ids.end());
+  return stripe_ids;
+}
+
+// Locks each stripe in `stripe_ids`, which must be sorted, with a lock of type
+// `Lock` on the mutex that `stripe(s)` returns. The locks are released when
+// the returned vector is destroyed.
+template <typename Lock, typename StripeFn>
+std::vector<Lock> lock_stripes(const std::vector<size_t>& stripe_ids,
+                               StripeFn&& stripe) {
+  std::vector<Lock> locks;
+  locks.reserve(stripe_ids.size());
+  for (size_t s : stripe_ids) {
+    locks.emplace_back(stripe(s));
+  }
+  return locks;
+}
+
+#endif /* end of include guard */
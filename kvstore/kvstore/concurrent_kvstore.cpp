@@ -1,48 +1,137 @@
 #include "concurrent_kvstore.hpp"
 
 #include <mutex>
-#include <optional>
 
 bool ConcurrentKvStore::Get(const GetRequest* req, GetResponse* res) {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  size_t hash = this->store.hash(req->key);
+  std::shared_lock lock(this->store.stripe(this->store.stripeIndex(hash)));
 
+  const DbItem* item = this->store.getIfExists(hash, req->key);
+  if (!item) return false;
+  res->value = item->value();
   return true;
 }
 
 bool ConcurrentKvStore::Put(const PutRequest* req, PutResponse*) {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  {
+    size_t hash = this->store.hash(req->key);
+    std::unique_lock lock(this->store.stripe(this->store.stripeIndex(hash)));
 
+    bool created = this->store.insertItem(hash, req->key, req->value);
+    if (created && this->index) this->index->insert(req->key);
+  }
+  this->store.maintain();
   return true;
 }
 
 bool ConcurrentKvStore::Append(const AppendRequest* req, AppendResponse*) {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  {
+    size_t hash = this->store.hash(req->key);
+    std::unique_lock lock(this->store.stripe(this->store.stripeIndex(hash)));
 
+    bool created = this->store.appendItem(hash, req->key, req->value);
+    if (created && this->index) this->index->insert(req->key);
+  }
+  this->store.maintain();
   return true;
 }
 
 bool ConcurrentKvStore::Delete(const DeleteRequest* req, DeleteResponse* res) {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  {
+    size_t hash = this->store.hash(req->key);
+    std::unique_lock lock(this->store.stripe(this->store.stripeIndex(hash)));
 
+    if (!this->store.removeItem(hash, req->key, &res->value)) return false;
+    if (this->index) this->index->erase(req->key);
+  }
+  this->store.maintain();
   return true;
 }
 
 bool ConcurrentKvStore::MultiGet(const MultiGetRequest* req,
                                  MultiGetResponse* res) {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  std::vector<size_t> hashes;
+  hashes.reserve(req->keys.size());
+  for (auto&& key : req->keys) {
+    hashes.push_back(this->store.hash(key));
+  }
 
+  // Hold every stripe the keys fall in, to read them all atomically.
+  auto locks =
+      this->store.lockStripes<std::shared_lock<std::shared_mutex>>(hashes);
+
+  std::vector<std::string> values;
+  values.reserve(req->keys.size());
+  for (size_t i = 0; i < req->keys.size(); i++) {
+    const DbItem* item = this->store.getIfExists(hashes[i], req->keys[i]);
+    if (!item) return false;
+    values.emplace_back(item->value());
+  }
+  res->values = std::move(values);
   return true;
 }
 
 bool ConcurrentKvStore::MultiPut(const MultiPutRequest* req,
                                  MultiPutResponse*) {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  if (req->keys.size() != req->values.size()) return false;
+
+  std::vector<size_t> hashes;
+  hashes.reserve(req->keys.size());
+  for (auto&& key : req->keys) {
+    hashes.push_back(this->store.hash(key));
+  }
 
+  {
+    auto locks =
+        this->store.lockStripes<std::unique_lock<std::shared_mutex>>(hashes);
+    for (size_t i = 0; i < req->keys.size(); i++) {
+      bool created =
+          this->store.insertItem(hashes[i], req->keys[i], req->values[i]);
+      if (created && this->index) this->index->insert(req->keys[i]);
+    }
+  }
+  this->store.maintain();
   return true;
 }
 
 std::vector<std::string> ConcurrentKvStore::AllKeys() {
-  // TODO (Part A, Step 3 and Step 4): Implement!
+  std::vector<std::string> keys;
+  for (size_t s = 0; s < this->store.stripeCount(); s++) {
+    std::shared_lock lock(this->store.stripe(s));
+    this->store.forEachItem(
+        s, [&](const DbItem& item) { keys.emplace_back(item.key()); });
+  }
+  return keys;
+}
+
+bool ConcurrentKvStore::Scan(const ScanRequest* req, ScanResponse* res) {
+  if (!this->index) return KvStore::Scan(req, res);
 
-  return {};
+  // The index may briefly hold a key that's just been removed from the map
+  // (or miss one just added), so look each key up under its stripe lock.
+  this->index->scan(req->start, req->end, [&](std::string_view key) {
+    if (req->limit > 0 && res->keys.size() == req->limit) return false;
+    size_t hash = this->store.hash(key);
+    std::shared_lock lock(this->store.stripe(this->store.stripeIndex(hash)));
+    if (const DbItem* item = this->store.getIfExists(hash, key)) {
+      res->values.emplace_back(item->value());
+      res->keys.emplace_back(key);
+    }
+    return true;
+  });
+  return true;
+}
+
+bool ConcurrentKvStore::ListKeys(const ListKeysRequest* req,
+                                 ListKeysResponse* res) {
+  // Whole buckets are read at a time, so a page can run over the limit by a
+  // bucket's worth of keys. No lock is held between buckets.
+  size_t cursor = req->cursor;
+  do {
+    cursor = this->store.walkStep(cursor, [&](const DbItem& item) {
+      res->keys.emplace_back(item.key());
+    });
+  } while (cursor != 0 && (req->limit == 0 || res->keys.size() < req->limit));
+  res->cursor = cursor;
+  return true;
 }
@@ -1,107 +1,711 @@
 #ifndef CONCURRENT_KVSTORE_HPP
 #define CONCURRENT_KVSTORE_HPP
 
-#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <functional>
-#include <list>
 #include <map>
-#include <optional>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "batch_lock.hpp"
 #include "common/utils.hpp"
 #include "kvstore.hpp"
 #include "net/server_commands.hpp"
+#include "ordered_index.hpp"
+#include "record_arena.hpp"
 
 /**
- * Struct encapsulating a database item. This is optional, but you may find this
- * helpful in your DbMap implementation.
+ * Struct encapsulating a database item: a handle to the record holding its key
+ * and value, in the RecordArena of the item's stripe.
  */
 struct DbItem {
-  std::string key;
-  std::string value;
+  char* record = nullptr;
 
-  DbItem(std::string& k, std::string& v) {
-    this->key = k;
-    this->value = v;
+  std::string_view key() const {
+    return RecordArena::key(this->record);
   }
+  std::string_view value() const {
+    return RecordArena::value(this->record);
+  }
+};
+
+// Memory used by a DbMap; see DbMap::memoryStats().
+struct DbMemoryStats {
+  size_t n_keys = 0;
+  // Bytes of the keys and values themselves.
+  size_t payload_bytes = 0;
+  // Arena chunks held, and how much of them is taken up by records in use and
+  // by records awaiting compaction.
+  size_t arena_reserved_bytes = 0;
+  size_t arena_live_bytes = 0;
+  size_t arena_dead_bytes = 0;
+  // Bucket arrays, including every bucket's control bytes and slots.
+  size_t table_bytes = 0;
+
+  double bytesPerKey() const {
+    if (this->n_keys == 0) return 0;
+    return static_cast<double>(this->arena_reserved_bytes + this->table_bytes) /
+           this->n_keys;
+  }
+};
+
+/**
+ * A single bucket of the DbMap: a flat, open-addressing hash table.
+ *
+ * Item handles are stored inline in one slot array, next to an array of one-byte
+ * control words (SwissTable-style). A control byte is either EMPTY, DELETED, or
+ * the low 7 bits of its item's hash. Lookups scan the control bytes a group (8
+ * bytes, i.e. one machine word) at a time, and only compare keys of slots whose
+ * hash byte matches; a probe therefore usually touches a single control word
+ * and the one slot that actually holds the key, instead of chasing list nodes.
+ *
+ * Not thread-safe; the DbMap's bucket locks protect it.
+ */
+class DbBucket {
+ public:
+  DbBucket() = default;
+
+  DbBucket(const DbBucket&) = delete;
+  DbBucket& operator=(const DbBucket&) = delete;
+
+  // Number of items in the bucket.
+  size_t size() const {
+    return this->n_items;
+  }
+
+  // Returns the item with key `key`, or nullptr if it doesn't exist.
+  DbItem* find(std::string_view key) {
+    return this->find(key, DbBucket::hash(key));
+  }
+
+  // Adds `item`, whose key must not be in the bucket yet.
+  void insert(DbItem item) {
+    uint64_t hash = DbBucket::hash(item.key());
+    assert(!this->find(item.key(), hash));
+    if (this->n_items + this->n_deleted + 1 > maxLoad(this->capacity)) {
+      this->rehash();
+    }
+
+    size_t slot = this->findInsertSlot(hash);
+    if (this->ctrl[slot] == DELETED) this->n_deleted--;
+    this->ctrl[slot] = DbBucket::h2(hash);
+    this->slots[slot] = item;
+    this->n_items++;
+  }
+
+  // Removes `item`, which must point into this bucket.
+  void erase(DbItem* item) {
+    size_t slot = item - this->slots.get();
+    size_t group = slot / GROUP_WIDTH;
+    // If the group still has an empty slot, no probe sequence ever continued
+    // past it, so the slot can become empty again; otherwise leave a tombstone.
+    if (matchEmpty(this->loadGroup(group))) {
+      this->ctrl[slot] = EMPTY;
+    } else {
+      this->ctrl[slot] = DELETED;
+      this->n_deleted++;
+    }
+    *item = DbItem();
+    this->n_items--;
+  }
+
+  // Calls `fn` on every item in the bucket.
+  template <typename Fn>
+  void forEach(Fn&& fn) const {
+    for (size_t i = 0; i < this->capacity; i++) {
+      if (this->ctrl[i] >= 0) fn(std::as_const(this->slots[i]));
+    }
+  }
+  template <typename Fn>
+  void forEach(Fn&& fn) {
+    for (size_t i = 0; i < this->capacity; i++) {
+      if (this->ctrl[i] >= 0) fn(this->slots[i]);
+    }
+  }
+
+  // Calls `fn` on every item, then empties the bucket and releases its memory.
+  template <typename Fn>
+  void drain(Fn&& fn) {
+    for (size_t i = 0; i < this->capacity; i++) {
+      if (this->ctrl[i] >= 0) fn(this->slots[i]);
+    }
+    this->ctrl.reset();
+    this->slots.reset();
+    this->capacity = this->n_items = this->n_deleted = 0;
+  }
+
+  // Bytes of heap memory held by the bucket's control bytes and slots.
+  size_t memoryBytes() const {
+    return this->capacity * (sizeof(int8_t) + sizeof(DbItem));
+  }
+
+ private:
+  static_assert(std::endian::native == std::endian::little,
+                "control word matching assumes a little-endian host");
 
-  bool operator==(const DbItem& item) {
-    return (this->key == item.key && this->value == item.value);
+  // Control bytes per group; one group is loaded as a single word.
+  static constexpr size_t GROUP_WIDTH = 8;
+
+  static constexpr int8_t EMPTY = -128;   // 0b10000000
+  static constexpr int8_t DELETED = -2;   // 0b11111110
+  static constexpr uint64_t LSBS = 0x0101010101010101ULL;
+  static constexpr uint64_t MSBS = 0x8080808080808080ULL;
+
+  // Control bytes; `capacity` of them, all EMPTY initially.
+  std::unique_ptr<int8_t[]> ctrl;
+  // Slot array, parallel to `ctrl`.
+  std::unique_ptr<DbItem[]> slots;
+  // Always 0 or a power of two that's a multiple of GROUP_WIDTH.
+  size_t capacity = 0;
+  size_t n_items = 0;
+  size_t n_deleted = 0;
+
+  // The DbMap's hasher picks the bucket, so we can't reuse it here (keys that
+  // share a bucket might all share a hash, too); hash the key again and mix it
+  // so that every bit is usable.
+  static uint64_t hash(std::string_view key) {
+    uint64_t x = std::hash<std::string_view>{}(key);
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+  // Position hash, and the 7-bit fragment stored in the control byte.
+  static size_t h1(uint64_t hash) {
+    return hash >> 7;
+  }
+  static int8_t h2(uint64_t hash) {
+    return hash & 0x7F;
+  }
+
+  static size_t maxLoad(size_t capacity) {
+    return capacity - capacity / 8;
+  }
+
+  uint64_t loadGroup(size_t group) const {
+    uint64_t word;
+    std::memcpy(&word, &this->ctrl[group * GROUP_WIDTH], sizeof(word));
+    return word;
+  }
+
+  // Bitmasks with the high bit of each matching byte set. matchByte may report
+  // false positives, which are weeded out by comparing keys.
+  static uint64_t matchByte(uint64_t word, int8_t h2) {
+    uint64_t x = word ^ (LSBS * static_cast<uint8_t>(h2));
+    return (x - LSBS) & ~x & MSBS;
+  }
+  static uint64_t matchEmpty(uint64_t word) {
+    return word & ~(word << 6) & MSBS;
+  }
+  static uint64_t matchEmptyOrDeleted(uint64_t word) {
+    return word & ~(word << 7) & MSBS;
+  }
+  static size_t lowestByte(uint64_t mask) {
+    return std::countr_zero(mask) / 8;
+  }
+
+  // Finds the item with key `key`, whose hash is `hash`.
+  DbItem* find(std::string_view key, uint64_t hash) {
+    if (this->capacity == 0) return nullptr;
+
+    size_t mask = this->capacity / GROUP_WIDTH - 1;
+    size_t group = DbBucket::h1(hash) & mask;
+    for (size_t i = 1;; i++) {
+      uint64_t ctrl_word = this->loadGroup(group);
+      for (uint64_t m = matchByte(ctrl_word, DbBucket::h2(hash)); m;
+           m &= m - 1) {
+        size_t slot = group * GROUP_WIDTH + lowestByte(m);
+        if (this->slots[slot].key() == key) return &this->slots[slot];
+      }
+      // The key would have been placed in this group if there was room.
+      if (matchEmpty(ctrl_word)) return nullptr;
+      group = (group + i) & mask;
+    }
+  }
+
+  // Finds the first empty or deleted slot on `hash`'s probe sequence. There
+  // must be one.
+  size_t findInsertSlot(uint64_t hash) const {
+    size_t mask = this->capacity / GROUP_WIDTH - 1;
+    size_t group = DbBucket::h1(hash) & mask;
+    for (size_t i = 1;; i++) {
+      if (uint64_t m = matchEmptyOrDeleted(this->loadGroup(group))) {
+        return group * GROUP_WIDTH + lowestByte(m);
+      }
+      group = (group + i) & mask;
+    }
+  }
+
+  // Grows the table (or, if it's mostly tombstones, rebuilds it at the same
+  // size) and re-inserts every item.
+  void rehash() {
+    size_t new_capacity = GROUP_WIDTH;
+    while (maxLoad(new_capacity) < 2 * (this->n_items + 1)) new_capacity *= 2;
+
+    std::unique_ptr<int8_t[]> old_ctrl = std::move(this->ctrl);
+    std::unique_ptr<DbItem[]> old_slots = std::move(this->slots);
+    size_t old_capacity = this->capacity;
+
+    this->ctrl = std::make_unique<int8_t[]>(new_capacity);
+    std::memset(this->ctrl.get(), EMPTY, new_capacity);
+    this->slots = std::make_unique<DbItem[]>(new_capacity);
+    this->capacity = new_capacity;
+    this->n_deleted = 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+      if (old_ctrl[i] < 0) continue;
+      uint64_t hash = DbBucket::hash(old_slots[i].key());
+      size_t slot = this->findInsertSlot(hash);
+      this->ctrl[slot] = DbBucket::h2(hash);
+      this->slots[slot] = old_slots[i];
+    }
   }
 };
 
 /**
  * Implement your bucket-based map here!
+ *
+ * The bucket array grows with the number of items: once the average bucket
+ * holds more than MAX_LOAD_FACTOR items, a bucket array of twice the size is
+ * installed next to the current one, and writers migrate the current array's
+ * buckets into it a few at a time (MIGRATE_BATCH per write). Until every bucket
+ * has moved, a key lives either in its current bucket or, if that bucket was
+ * already migrated, in its bucket in the next array; no single request ever
+ * pays for a full rehash.
+ *
+ * Access is synchronized by a fixed array of lock stripes, independent of the
+ * number of buckets: the key with hash h is guarded by stripe h % stripeCount().
+ * The bucket count is always a multiple of the stripe count, so a bucket's keys
+ * all share one stripe, and so do the two buckets it splits into on a resize.
+ *
+ * Each stripe also owns the RecordArena its items' keys and values live in, so
+ * moving an item between buckets (on a resize) never copies its bytes. A write
+ * that leaves a stripe's arena mostly dead compacts it on the spot.
  */
 class DbMap {
  public:
-  DbMap(std::function<size_t(std::string)> hasher) : hasher(hasher) {
+  // Without a hasher, keys are hashed as std::string_views (see hash).
+  DbMap(std::function<size_t(const std::string&)> hasher,
+        size_t n_stripes = DEFAULT_STRIPE_COUNT,
+        size_t initial_bucket_count = INITIAL_BUCKET_COUNT)
+      : hasher(std::move(hasher)),
+        n_stripes(n_stripes),
+        stripes(std::make_unique<Stripe[]>(n_stripes)) {
+    assert(n_stripes > 0);
+    // Round up to a multiple of the stripe count.
+    size_t n = (initial_bucket_count + n_stripes - 1) / n_stripes * n_stripes;
+    this->table = std::make_unique<BucketArray>(n);
+    this->bucket_count = n;
+    this->base_count = n;
   }
 
-  static constexpr size_t BUCKET_COUNT = 60;
+  static constexpr size_t DEFAULT_STRIPE_COUNT = 64;
+  static constexpr size_t INITIAL_BUCKET_COUNT = 60;
+  // Average number of items per bucket above which the bucket array doubles.
+  static constexpr size_t MAX_LOAD_FACTOR = 8;
+  // Number of buckets each write migrates while the bucket array grows.
+  static constexpr size_t MIGRATE_BATCH = 4;
 
-  // Bucket associative array, with corresponding mutexes to protect access.
-  std::array<std::list<DbItem>, BUCKET_COUNT> buckets;
+  // Return the hash used to find the stripe and bucket for `key`.
+  size_t hash(const std::string& key) const {
+    if (!this->hasher) return std::hash<std::string_view>{}(key);
+    return this->hasher(key);
+  }
+  // Same, for a key that isn't a std::string, e.g. an item's key. Only a
+  // custom hasher needs it copied into one; std::hash<std::string_view>
+  // hashes it the same as std::hash<std::string> would.
+  size_t hash(std::string_view key) const {
+    if (!this->hasher) return std::hash<std::string_view>{}(key);
+    return this->hasher(std::string(key));
+  }
 
-  // TODO (Part A, Step 4): You will need to add fields to synchronize access to
-  // the hashmap buckets!
+  size_t stripeCount() const {
+    return this->n_stripes;
+  }
 
-  // Return the index of the bucket to search for `key`.
-  size_t bucket(std::string key) const {
-    return hasher(key) % BUCKET_COUNT;
+  // Return the index of the stripe guarding the key with hash `hash`.
+  size_t stripeIndex(size_t hash) const {
+    return hash % this->n_stripes;
   }
 
-  // Returns the DbItem with key 'key' in bucket `b` if it exists, std::nullopt
-  // otherwise Assumes that `b` == this->bucket(key).
-  std::optional<DbItem> getIfExists(size_t b, std::string key) {
-    assert(b < BUCKET_COUNT);
-    for (const auto& item : this->buckets[b]) {
-      if (item.key == key) {
-        return item;
-      }
+  // Return the lock of stripe `s`.
+  std::shared_mutex& stripe(size_t s) {
+    assert(s < this->n_stripes);
+    return this->stripes[s].mtx;
+  }
+
+  // Locks every stripe, in index order, with locks of type `Lock`
+  // (std::shared_lock or std::unique_lock).
+  template <typename Lock>
+  std::vector<Lock> lockAll() {
+    std::vector<Lock> locks;
+    locks.reserve(this->n_stripes);
+    for (size_t s = 0; s < this->n_stripes; s++) {
+      locks.emplace_back(this->stripes[s].mtx);
     }
-    return std::nullopt;
+    return locks;
   }
 
-  // Insert a new DbItem with key 'key' and value 'value' to bucket `b`.
-  // If key already exists, updates value to `value`.
-  // Assumes that `b` == this->bucket(key).
-  void insertItem(size_t b, std::string key, std::string value) {
-    assert(b < BUCKET_COUNT);
+  // Locks just the stripes guarding the keys with hashes `hashes`, once each
+  // and in index order (see batch_lock.hpp), with locks of type `Lock`.
+  template <typename Lock>
+  std::vector<Lock> lockStripes(const std::vector<size_t>& hashes) {
+    return lock_stripes<Lock>(
+        sorted_stripes(hashes, this->n_stripes),
+        [this](size_t s) -> std::shared_mutex& { return this->stripe(s); });
+  }
 
-    for (auto& item : this->buckets[b]) {
-      if (item.key == key) {
-        item.value = value;
-        return;
-      }
+  // Calls `fn` on every item guarded by stripe `s`. The caller must hold that
+  // stripe's lock.
+  template <typename Fn>
+  void forEachItem(size_t s, Fn&& fn) {
+    this->forEachBucket(s, [&](const DbBucket& b) { b.forEach(fn); });
+  }
+
+  // Visits one bucket of a walk over the whole map, calling `fn` on each of
+  // its items under the bucket's stripe lock, and returns the cursor of the
+  // next bucket to visit. A walk starts at cursor 0 and is over when 0 is
+  // returned again; it takes no locks between steps.
+  //
+  // The bucket count is always base_count * 2^k, so a key with hash h sits in
+  // bucket r + base_count * v, where r = h % base_count and v is the low k
+  // bits of h / base_count. A cursor is such a bucket index: the walk visits
+  // every r for a given v, then moves v on by incrementing its bits in reverse,
+  // from the top bit of the current k down (as Redis' SCAN does). When the
+  // array doubles, v's items split between v and v + 2^k, which are adjacent in
+  // that reversed order, so items from buckets already visited never end up
+  // ahead of the cursor. Every key present for the whole walk is therefore
+  // seen at least once, however the map grows in between; a key may be seen
+  // twice if the map grew mid-walk, and keys added or removed during the walk
+  // may or may not be.
+  template <typename Fn>
+  size_t walkStep(size_t cursor, Fn&& fn) {
+    size_t r = cursor % this->base_count;
+    size_t v = cursor / this->base_count;
+    size_t mask;
+    {
+      // Bucket r + base_count * v is guarded by stripe r % n_stripes, since
+      // base_count is a multiple of n_stripes.
+      std::shared_lock lock(this->stripes[r % this->n_stripes].mtx);
+      mask = this->table->n / this->base_count - 1;
+      this->forEachBucketAt(
+          r + this->base_count * (v & mask),
+          [&](const DbBucket& b) { b.forEach(fn); });
+    }
+    if (++r < this->base_count) return r + this->base_count * v;
+
+    v = reverseBits(reverseBits(v | ~mask) + 1);
+    return this->base_count * v;
+  }
+
+  // Returns the DbItem with key 'key' (whose hash is `hash`) if it exists,
+  // nullptr otherwise. The item and the views it returns are only valid while
+  // the caller holds the key's stripe lock, which it must.
+  const DbItem* getIfExists(size_t hash, std::string_view key) {
+    return this->bucketFor(hash).find(key);
+  }
+
+  // Insert a new DbItem with key 'key' and value 'value'.
+  // If key already exists, updates value to `value`. Returns whether the key
+  // is new.
+  // Assumes that `hash` is the hash of `key`, and its stripe is locked.
+  bool insertItem(size_t hash, std::string_view key, std::string_view value) {
+    size_t s = this->stripeIndex(hash);
+    RecordArena& arena = this->stripes[s].arena;
+    DbBucket& b = this->bucketFor(hash);
+    bool created = false;
+    if (DbItem* item = b.find(key)) {
+      item->record = arena.assign(item->record, value);
+    } else {
+      b.insert(DbItem{arena.allocate(key, value)});
+      this->n_items++;
+      created = true;
+    }
+    this->compactIfFragmented(s);
+    return created;
+  }
+
+  // Appends `value` to the value of the DbItem with key `key`, inserting it if
+  // it doesn't exist. Returns whether the key is new.
+  // Assumes that `hash` is the hash of `key`, and its stripe is locked.
+  bool appendItem(size_t hash, std::string_view key, std::string_view value) {
+    size_t s = this->stripeIndex(hash);
+    RecordArena& arena = this->stripes[s].arena;
+    DbBucket& b = this->bucketFor(hash);
+    bool created = false;
+    if (DbItem* item = b.find(key)) {
+      item->record = arena.append(item->record, value);
+    } else {
+      b.insert(DbItem{arena.allocate(key, value)});
+      this->n_items++;
+      created = true;
+    }
+    this->compactIfFragmented(s);
+    return created;
+  }
+
+  // Remove a DbItem with key `key`, storing its value in `value` if that isn't
+  // null. Returns whether the key existed.
+  // Assumes that `hash` is the hash of `key`, and its stripe is locked.
+  bool removeItem(size_t hash, std::string_view key,
+                  std::string* value = nullptr) {
+    size_t s = this->stripeIndex(hash);
+    DbBucket& b = this->bucketFor(hash);
+    DbItem* item = b.find(key);
+    if (!item) return false;
+
+    if (value) value->assign(item->value());
+    this->stripes[s].arena.release(item->record);
+    b.erase(item);
+    this->n_items--;
+    this->compactIfFragmented(s);
+    return true;
+  }
+
+  // Reports how much memory the map uses. Each stripe is locked in turn, so
+  // the result isn't a consistent snapshot while writes are in flight.
+  DbMemoryStats memoryStats() {
+    DbMemoryStats stats;
+    for (size_t s = 0; s < this->n_stripes; s++) {
+      std::shared_lock lock(this->stripes[s].mtx);
+      const RecordArena& arena = this->stripes[s].arena;
+      stats.payload_bytes += arena.payloadBytes();
+      stats.arena_reserved_bytes += arena.reservedBytes();
+      stats.arena_live_bytes += arena.liveBytes();
+      stats.arena_dead_bytes += arena.deadBytes();
+      this->forEachBucket(s, [&](const DbBucket& b) {
+        stats.n_keys += b.size();
+        stats.table_bytes += sizeof(Bucket) + b.memoryBytes();
+      });
     }
-    this->buckets[b].emplace_back(key, value);
+    return stats;
   }
 
-  // Remove a DbItem with key `key` from bucket `b`.
-  // Assumes that `b` == this->getBucketIndex(key).
-  bool removeItem(size_t b, std::string key) {
-    assert(b < BUCKET_COUNT);
+  // Grows the bucket array up front to hold n_items without resizing, e.g.
+  // before loading that many. Any items already there are rehashed under
+  // every stripe lock. Does nothing while a resize is under way.
+  void reserve(size_t n_items) {
+    size_t n = this->base_count;
+    while (n * MAX_LOAD_FACTOR < n_items) n *= 2;
+    if (n <= this->bucket_count.load()) return;
+    auto bigger = std::make_unique<BucketArray>(n);
 
-    size_t num_removed = this->buckets[b].remove_if(
-        [&](auto&& item) { return item.key == key; });
-    return num_removed > 0;
+    // Declared before the locks, so the old array is freed after unlocking.
+    std::unique_ptr<BucketArray> old;
+    auto locks = this->lockAll<std::unique_lock<std::shared_mutex>>();
+    if (this->next || this->table->n >= n) return;
+    for (size_t i = 0; i < this->table->n; i++) {
+      this->table->buckets[i].items.drain([&](DbItem item) {
+        size_t nb = this->hash(item.key()) % n;
+        bigger->buckets[nb].items.insert(item);
+      });
+    }
+    old = std::move(this->table);
+    this->table = std::move(bigger);
+    this->bucket_count = n;
+  }
+
+  // Grows the bucket array, or moves an in-progress resize along. Writers
+  // should call this after every write, holding no locks.
+  void maintain() {
+    if (this->next_count.load() != 0) {
+      this->migrateSome();
+    } else if (this->n_items.load() >
+               this->bucket_count.load() * MAX_LOAD_FACTOR) {
+      this->startResize();
+    }
   }
 
  private:
-  std::function<size_t(std::string)> hasher;
+  // Padded to a cache line, so that threads working on neighbouring stripes
+  // don't contend on the same line.
+  struct alignas(64) Stripe {
+    std::shared_mutex mtx;
+    RecordArena arena;
+  };
+
+  struct Bucket {
+    DbBucket items;
+    // Set once the items have moved to the next bucket array.
+    bool migrated = false;
+  };
+
+  struct BucketArray {
+    explicit BucketArray(size_t n)
+        : n(n), buckets(std::make_unique<Bucket[]>(n)) {
+    }
+    size_t n;
+    std::unique_ptr<Bucket[]> buckets;
+  };
+
+  std::function<size_t(const std::string&)> hasher;
+
+  size_t n_stripes;
+  std::unique_ptr<Stripe[]> stripes;
+
+  // The current bucket array, and (while resizing) the next one. They are only
+  // swapped while holding every stripe lock, so holding any one stripe lock
+  // keeps both stable.
+  std::unique_ptr<BucketArray> table;
+  std::unique_ptr<BucketArray> next;
+
+  // Sizes of `table` and `next` (0 when not resizing), readable without a
+  // stripe lock.
+  std::atomic<size_t> bucket_count;
+  std::atomic<size_t> next_count = 0;
+  // The initial bucket count, which every later count is a power of two
+  // multiple of.
+  size_t base_count;
+  std::atomic<size_t> n_items = 0;
+
+  // Index of the next bucket to migrate, and the number already migrated.
+  // n_migrated is only modified under a stripe lock.
+  std::atomic<size_t> migrate_pos = 0;
+  std::atomic<size_t> n_migrated = 0;
+
+  // Returns the bucket that currently holds the key with hash `hash`. The
+  // caller must hold the key's stripe lock.
+  DbBucket& bucketFor(size_t hash) {
+    Bucket* b = &this->table->buckets[hash % this->table->n];
+    if (b->migrated) b = &this->next->buckets[hash % this->next->n];
+    return b->items;
+  }
+
+  // Calls `fn` on every bucket guarded by stripe `s`. The caller must hold
+  // that stripe's lock.
+  template <typename Fn>
+  void forEachBucket(size_t s, Fn&& fn) {
+    for (size_t i = s; i < this->table->n; i += this->n_stripes) {
+      this->forEachBucketAt(i, fn);
+    }
+  }
+
+  // Calls `fn` on bucket `i` of the current array, or on the buckets its
+  // items moved to if it was migrated. The caller must hold its stripe lock.
+  template <typename Fn>
+  void forEachBucketAt(size_t i, Fn&& fn) {
+    Bucket& b = this->table->buckets[i];
+    if (!b.migrated) {
+      fn(b.items);
+      return;
+    }
+    // A migrated bucket's items were split between these two buckets.
+    fn(this->next->buckets[i].items);
+    fn(this->next->buckets[i + this->table->n].items);
+  }
+
+  static size_t reverseBits(size_t x) {
+    size_t r = 0;
+    for (size_t i = 0; i < 8 * sizeof(x); i++) {
+      r = (r << 1) | (x & 1);
+      x >>= 1;
+    }
+    return r;
+  }
+
+  // Compacts stripe `s`'s arena if it's mostly dead. The caller must hold the
+  // stripe's lock exclusively.
+  void compactIfFragmented(size_t s) {
+    RecordArena& arena = this->stripes[s].arena;
+    if (!arena.fragmented()) return;
+    arena.compact([&](auto&& relocate) {
+      this->forEachBucket(s, [&](DbBucket& b) {
+        b.forEach([&](DbItem& item) { relocate(item.record); });
+      });
+    });
+  }
+
+  void startResize() {
+    size_t n = this->bucket_count.load();
+    // Allocate the new array before locking, so that the only work done while
+    // every operation is blocked is swapping a pointer.
+    auto next = std::make_unique<BucketArray>(2 * n);
+
+    auto locks = this->lockAll<std::unique_lock<std::shared_mutex>>();
+    if (this->next || this->table->n != n) return;  // lost the race
+    this->next = std::move(next);
+    this->migrate_pos = 0;
+    this->n_migrated = 0;
+    this->next_count = 2 * n;
+  }
+
+  void migrateSome() {
+    bool finished = false;
+    for (size_t i = 0; i < MIGRATE_BATCH && !finished; i++) {
+      size_t b = this->migrate_pos.fetch_add(1);
+      // Loaded after claiming `b`: if it was claimed from the resize under way,
+      // this is at least the size of that resize's array, so a bucket it still
+      // needs is never given up on here.
+      if (b >= this->bucket_count.load()) break;
+
+      std::unique_lock lock(this->stripes[b % this->n_stripes].mtx);
+      // The resize we claimed `b` from might already be over, and another one
+      // started since, which reset migrate_pos. Migrate bucket `b` of whichever
+      // resize is under way now regardless: migrating a bucket twice does
+      // nothing, and if the claim came from this one, skipping it would leave
+      // it never finishing.
+      if (!this->next || b >= this->table->n) break;
+      finished = this->migrateBucket(b);
+    }
+    if (finished) this->finishResize();
+  }
+
+  // Moves the items of bucket `i` of the current array to the next array, if
+  // that hasn't happened yet. Returns whether this was the last bucket to move.
+  // The caller must hold the bucket's stripe lock exclusively.
+  bool migrateBucket(size_t i) {
+    Bucket& b = this->table->buckets[i];
+    if (b.migrated) return false;
+
+    // Only the handles move; the records stay put in the stripe's arena.
+    b.items.drain([&](DbItem item) {
+      size_t nb = this->hash(item.key()) % this->next->n;
+      this->next->buckets[nb].items.insert(item);
+    });
+    b.migrated = true;
+    return this->n_migrated.fetch_add(1) + 1 == this->table->n;
+  }
+
+  void finishResize() {
+    // Declared before the locks, so the old array is freed after unlocking.
+    std::unique_ptr<BucketArray> old;
+    auto locks = this->lockAll<std::unique_lock<std::shared_mutex>>();
+    old = std::move(this->table);
+    this->table = std::move(this->next);
+    this->bucket_count = this->table->n;
+    this->next_count = 0;
+  }
 };
 
 class ConcurrentKvStore : public KvStore {
  public:
   // The hasher is an *optional* argument used by the performance tests
   // See the performance test comments if you're interested in how it works,
-  // otherwise, feel free to ignore!
+  // otherwise, feel free to ignore! Without one, keys are hashed as
+  // std::hash<std::string> would, but without copying them into std::strings.
+  //
+  // `n_stripes` configures how many locks the store's keys are spread across.
+  //
+  // With `ordered` set, the store also keeps its keys in an OrderedIndex, so
+  // that Scan only visits the keys in the requested range. That makes every
+  // write that adds or removes a key a little slower, and every key take up
+  // another copy of itself.
   ConcurrentKvStore(
-      std::function<size_t(std::string)> hasher = std::hash<std::string>())
-      : store(hasher) {
+      std::function<size_t(const std::string&)> hasher = nullptr,
+      size_t n_stripes = DbMap::DEFAULT_STRIPE_COUNT, bool ordered = false)
+      : store(hasher, n_stripes),
+        index(ordered ? std::make_unique<OrderedIndex>() : nullptr) {
   }
   ~ConcurrentKvStore() = default;
 
@@ -114,9 +718,46 @@ class ConcurrentKvStore : public KvStore {
 
   std::vector<std::string> AllKeys() override;
 
+  bool Scan(const ScanRequest* req, ScanResponse* res) override;
+  bool ListKeys(const ListKeysRequest* req, ListKeysResponse* res) override;
+
+  // Reports the store's memory usage, e.g. to compute bytes per key.
+  DbMemoryStats memoryStats() {
+    return this->store.memoryStats();
+  }
+
+  // The store's lock stripes, and the one that guards key (see DbMap).
+  size_t stripeCount() const {
+    return this->store.stripeCount();
+  }
+  size_t stripeOf(const std::string& key) const {
+    return this->store.stripeIndex(this->store.hash(key));
+  }
+
+  // Calls fn(key, value) on every pair in stripe s, holding the stripe's lock
+  // (shared) throughout, so the pairs are as of a single moment, and writes
+  // to the stripe's keys wait for no longer than the one stripe takes.
+  template <typename Fn>
+  void forEachPair(size_t s, Fn&& fn) {
+    std::shared_lock lock(this->store.stripe(s));
+    this->store.forEachItem(
+        s, [&](const DbItem& item) { fn(item.key(), item.value()); });
+  }
+
+  // Makes room for n_keys keys in all, so that loading them doesn't resize
+  // the table over and over.
+  void reserve(size_t n_keys) {
+    this->store.reserve(n_keys);
+  }
+
  private:
   // Your internal key-value store implementation!
   DbMap store;
+
+  // Every key in `store`, in order, if the store was constructed `ordered`.
+  // It's only modified under the key's stripe lock, so it agrees with `store`
+  // about every key whose stripe lock is held.
+  std::unique_ptr<OrderedIndex> index;
 };
 
-#endif /* end of include guard */
\ No newline at end of file
+#endif /* end of include guard */
@@ -0,0 +1,146 @@
+#include "epoch.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// The epoch a thread advertises while it isn't pinned.
+constexpr uint64_t QUIESCENT = std::numeric_limits<uint64_t>::max();
+
+struct Retired {
+  void* ptr;
+  void (*deleter)(void*);
+  // The global epoch when ptr was retired. Only threads pinned at or before
+  // this epoch can still reach ptr.
+  uint64_t epoch;
+};
+
+// Per-thread state. Records are never freed: when a thread exits, its record
+// is released for reuse by a later thread.
+struct alignas(64) ThreadRecord {
+  std::atomic<uint64_t> epoch{QUIESCENT};
+  std::atomic<bool> in_use{true};
+  ThreadRecord* next = nullptr;
+
+  // The fields below are only accessed by the owning thread.
+  size_t depth = 0;
+  std::vector<Retired> retired;
+};
+
+// Retired nodes left behind by threads that exited before they could be
+// freed. Whatever is left at process exit is freed then.
+struct Orphans {
+  std::mutex mtx;
+  std::vector<Retired> items;
+
+  ~Orphans() {
+    for (auto& r : this->items) r.deleter(r.ptr);
+  }
+};
+
+std::atomic<uint64_t> global_epoch{1};
+std::atomic<ThreadRecord*> records{nullptr};
+Orphans orphans;
+
+ThreadRecord* acquire_record() {
+  for (ThreadRecord* r = records.load(); r; r = r->next) {
+    bool expected = false;
+    if (!r->in_use.load(std::memory_order_relaxed) &&
+        r->in_use.compare_exchange_strong(expected, true)) {
+      return r;
+    }
+  }
+
+  auto* r = new ThreadRecord;
+  r->next = records.load();
+  while (!records.compare_exchange_weak(r->next, r)) {
+  }
+  return r;
+}
+
+void collect_from(ThreadRecord* r);
+
+struct LocalRecord {
+  ThreadRecord* record = acquire_record();
+
+  ~LocalRecord() {
+    collect_from(this->record);
+    if (!this->record->retired.empty()) {
+      std::lock_guard lock(orphans.mtx);
+      orphans.items.insert(orphans.items.end(), this->record->retired.begin(),
+                           this->record->retired.end());
+      this->record->retired.clear();
+    }
+    this->record->in_use.store(false);
+  }
+};
+
+ThreadRecord* local_record() {
+  thread_local LocalRecord local;
+  return local.record;
+}
+
+// Frees every node in retired that was retired before min_epoch.
+void free_before(std::vector<Retired>& retired, uint64_t min_epoch) {
+  size_t kept = 0;
+  for (auto& r : retired) {
+    if (r.epoch < min_epoch) {
+      r.deleter(r.ptr);
+    } else {
+      retired[kept++] = r;
+    }
+  }
+  retired.resize(kept);
+}
+
+void collect_from(ThreadRecord* self) {
+  // Threads that pin from now on can't reach anything retired so far.
+  global_epoch.fetch_add(1);
+
+  uint64_t min_epoch = QUIESCENT;
+  for (ThreadRecord* r = records.load(); r; r = r->next) {
+    uint64_t e = r->epoch.load();
+    if (e < min_epoch) min_epoch = e;
+  }
+
+  free_before(self->retired, min_epoch);
+
+  std::unique_lock lock(orphans.mtx, std::try_to_lock);
+  if (lock.owns_lock()) {
+    free_before(orphans.items, min_epoch);
+  }
+}
+
+}  // namespace
+
+Epoch::Guard::Guard() {
+  ThreadRecord* r = local_record();
+  if (r->depth++ == 0) {
+    // A read-modify-write, so that the pin is visible to collectors before
+    // any of this thread's subsequent reads of shared nodes.
+    r->epoch.exchange(global_epoch.load());
+  }
+}
+
+Epoch::Guard::~Guard() {
+  ThreadRecord* r = local_record();
+  if (--r->depth == 0) {
+    r->epoch.store(QUIESCENT, std::memory_order_release);
+  }
+}
+
+void Epoch::retire(void* ptr, void (*deleter)(void*)) {
+  ThreadRecord* r = local_record();
+  r->retired.push_back({ptr, deleter, global_epoch.load()});
+  if (r->retired.size() >= COLLECT_THRESHOLD) {
+    collect_from(r);
+  }
+}
+
+void Epoch::collect() {
+  collect_from(local_record());
+}
@@ -0,0 +1,57 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <cstddef>
+
+/**
+ * Epoch-based memory reclamation, for data structures whose readers traverse
+ * shared nodes without holding any locks.
+ *
+ * A reader holds an Epoch::Guard for as long as it may dereference shared
+ * nodes. A writer that unlinks a node passes it to Epoch::retire instead of
+ * deleting it; the node is only freed once every thread that was pinned when
+ * the node was unlinked has dropped its guard, so no reader can still be
+ * looking at it.
+ *
+ * The epoch state is process-wide and shared by every data structure that
+ * uses it. Retired nodes must therefore not depend on the structure they were
+ * unlinked from still being alive.
+ */
+class Epoch {
+ public:
+  /**
+   * Pins the calling thread to the current epoch for the lifetime of the
+   * guard. Guards may be nested; only the outermost one has any effect.
+   */
+  class Guard {
+   public:
+    Guard();
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+  };
+
+  /**
+   * Hands ptr, which must already be unreachable by new readers, over to be
+   * deleted once no reader can hold a reference to it any more.
+   */
+  template <typename T>
+  static void retire(T* ptr) {
+    retire(static_cast<void*>(ptr),
+           [](void* p) { delete static_cast<T*>(p); });
+  }
+
+  static void retire(void* ptr, void (*deleter)(void*));
+
+  /**
+   * Advances the global epoch, then frees every retired node that no pinned
+   * thread can still reference. Called automatically as nodes are retired.
+   */
+  static void collect();
+
+  // Number of nodes a thread retires before it tries to collect.
+  static constexpr size_t COLLECT_THRESHOLD = 64;
+};
+
+#endif /* end of include guard */
@@ -0,0 +1,243 @@
+#include "epoch_kvstore.hpp"
+
+#include <algorithm>
+
+EpochKvStore::EpochKvStore(
+    std::function<size_t(const std::string&)> hasher, size_t n_buckets,
+    size_t n_stripes)
+    : hasher(std::move(hasher)), n_stripes(std::max<size_t>(n_stripes, 1)) {
+  // Every bucket must fall entirely within one stripe.
+  n_buckets = std::max(n_buckets, this->n_stripes);
+  this->n_buckets =
+      (n_buckets + this->n_stripes - 1) / this->n_stripes * this->n_stripes;
+  this->stripes = std::make_unique<Stripe[]>(this->n_stripes);
+  this->buckets = std::make_unique<std::atomic<Node*>[]>(this->n_buckets);
+}
+
+EpochKvStore::~EpochKvStore() {
+  // Nothing can be reading the store any more, so the nodes still linked in
+  // can be freed immediately.
+  for (size_t i = 0; i < this->n_buckets; i++) {
+    Node* node = this->buckets[i].load(std::memory_order_relaxed);
+    while (node) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      delete node;
+      node = next;
+    }
+  }
+}
+
+const EpochKvStore::Node* EpochKvStore::find(const std::atomic<Node*>& bucket,
+                                             std::string_view key) {
+  for (Node* node = bucket.load(std::memory_order_acquire); node;
+       node = node->next.load(std::memory_order_acquire)) {
+    if (node->key == key) return node;
+  }
+  return nullptr;
+}
+
+std::atomic<EpochKvStore::Node*>& EpochKvStore::findLink(
+    std::atomic<Node*>& bucket, std::string_view key) {
+  std::atomic<Node*>* link = &bucket;
+  for (Node* node = link->load(); node; node = link->load()) {
+    if (node->key == key) break;
+    link = &node->next;
+  }
+  return *link;
+}
+
+void EpochKvStore::publish(std::atomic<Node*>& bucket, std::string key,
+                           std::string value) {
+  std::atomic<Node*>& link = findLink(bucket, key);
+  Node* old = link.load();
+  if (old) {
+    // Swap in a copy, leaving the old node intact for concurrent readers.
+    Node* node = new Node(std::move(key), std::move(value), old->next.load());
+    link.store(node, std::memory_order_release);
+    Epoch::retire(old);
+  } else {
+    Node* node = new Node(std::move(key), std::move(value), bucket.load());
+    bucket.store(node, std::memory_order_release);
+  }
+}
+
+bool EpochKvStore::Get(const GetRequest* req, GetResponse* res) {
+  size_t hash = this->hasher(req->key);
+
+  Epoch::Guard guard;
+  const Node* node = find(this->bucketFor(hash), req->key);
+  if (!node) return false;
+  res->value = node->value;
+  return true;
+}
+
+bool EpochKvStore::Put(const PutRequest* req, PutResponse*) {
+  size_t hash = this->hasher(req->key);
+  size_t s = this->stripeIndex(hash);
+
+  std::lock_guard lock(this->stripes[s].mtx);
+  this->beginWrite(s);
+  publish(this->bucketFor(hash), req->key, req->value);
+  this->endWrite(s);
+  return true;
+}
+
+bool EpochKvStore::Append(const AppendRequest* req, AppendResponse*) {
+  size_t hash = this->hasher(req->key);
+  size_t s = this->stripeIndex(hash);
+
+  std::lock_guard lock(this->stripes[s].mtx);
+  std::atomic<Node*>& bucket = this->bucketFor(hash);
+  const Node* node = find(bucket, req->key);
+  std::string value = node ? node->value + req->value : req->value;
+
+  this->beginWrite(s);
+  publish(bucket, req->key, std::move(value));
+  this->endWrite(s);
+  return true;
+}
+
+bool EpochKvStore::Delete(const DeleteRequest* req, DeleteResponse* res) {
+  size_t hash = this->hasher(req->key);
+  size_t s = this->stripeIndex(hash);
+
+  std::lock_guard lock(this->stripes[s].mtx);
+  std::atomic<Node*>& link = findLink(this->bucketFor(hash), req->key);
+  Node* node = link.load();
+  if (!node) return false;
+  res->value = node->value;
+
+  // Readers already on the node can still follow its next pointer.
+  this->beginWrite(s);
+  link.store(node->next.load(), std::memory_order_release);
+  this->endWrite(s);
+  Epoch::retire(node);
+  return true;
+}
+
+bool EpochKvStore::tryMultiGet(const std::vector<std::string>& keys,
+                               const std::vector<size_t>& hashes,
+                               const std::vector<size_t>& stripe_ids,
+                               std::vector<std::string>& values,
+                               bool& consistent) {
+  consistent = false;
+
+  std::vector<uint64_t> seqs;
+  seqs.reserve(stripe_ids.size());
+  for (size_t s : stripe_ids) {
+    uint64_t seq = this->stripes[s].seq.load(std::memory_order_acquire);
+    // A writer is mid-update.
+    if (seq % 2 == 1) return true;
+    seqs.push_back(seq);
+  }
+
+  bool found = true;
+  {
+    Epoch::Guard guard;
+    values.clear();
+    for (size_t i = 0; i < keys.size(); i++) {
+      const Node* node = find(this->bucketFor(hashes[i]), keys[i]);
+      if (!node) {
+        found = false;
+        break;
+      }
+      values.push_back(node->value);
+    }
+  }
+
+  // The node pointers above were loaded with acquire ordering, so these
+  // loads can't be reordered before them: if we saw any writer's node, we also
+  // see its bump of the sequence number.
+  for (size_t i = 0; i < stripe_ids.size(); i++) {
+    if (this->stripes[stripe_ids[i]].seq.load(std::memory_order_acquire) !=
+        seqs[i]) {
+      return true;
+    }
+  }
+  consistent = true;
+  return found;
+}
+
+bool EpochKvStore::MultiGet(const MultiGetRequest* req,
+                            MultiGetResponse* res) {
+  std::vector<size_t> hashes;
+  hashes.reserve(req->keys.size());
+  for (auto&& key : req->keys) {
+    hashes.push_back(this->hasher(key));
+  }
+  std::vector<size_t> stripe_ids = sorted_stripes(hashes, this->n_stripes);
+
+  std::vector<std::string> values;
+  values.reserve(req->keys.size());
+  for (size_t attempt = 0; attempt < MULTIGET_RETRIES; attempt++) {
+    bool consistent;
+    bool found = this->tryMultiGet(req->keys, hashes, stripe_ids, values,
+                                   consistent);
+    if (consistent) {
+      if (!found) return false;
+      res->values = std::move(values);
+      return true;
+    }
+  }
+
+  // Under heavy write traffic, lock the stripes to keep writers out instead.
+  auto locks = this->lockStripes(stripe_ids);
+  values.clear();
+  for (size_t i = 0; i < req->keys.size(); i++) {
+    const Node* node = find(this->bucketFor(hashes[i]), req->keys[i]);
+    if (!node) return false;
+    values.push_back(node->value);
+  }
+  res->values = std::move(values);
+  return true;
+}
+
+bool EpochKvStore::MultiPut(const MultiPutRequest* req, MultiPutResponse*) {
+  if (req->keys.size() != req->values.size()) return false;
+
+  std::vector<size_t> hashes;
+  hashes.reserve(req->keys.size());
+  for (auto&& key : req->keys) {
+    hashes.push_back(this->hasher(key));
+  }
+  std::vector<size_t> stripe_ids = sorted_stripes(hashes, this->n_stripes);
+
+  auto locks = this->lockStripes(stripe_ids);
+
+  for (size_t s : stripe_ids) this->beginWrite(s);
+  for (size_t i = 0; i < req->keys.size(); i++) {
+    publish(this->bucketFor(hashes[i]), req->keys[i], req->values[i]);
+  }
+  for (size_t s : stripe_ids) this->endWrite(s);
+  return true;
+}
+
+std::vector<std::string> EpochKvStore::AllKeys() {
+  std::vector<std::string> keys;
+  Epoch::Guard guard;
+  for (size_t i = 0; i < this->n_buckets; i++) {
+    for (Node* node = this->buckets[i].load(std::memory_order_acquire); node;
+         node = node->next.load(std::memory_order_acquire)) {
+      keys.push_back(node->key);
+    }
+  }
+  return keys;
+}
+
+bool EpochKvStore::ListKeys(const ListKeysRequest* req, ListKeysResponse* res) {
+  // The bucket count never changes, so a cursor is just a bucket index.
+  // Whole buckets are read at a time, so a page can run over the limit by a
+  // bucket's worth of keys.
+  size_t i = req->cursor;
+  Epoch::Guard guard;
+  while (i < this->n_buckets &&
+         (req->limit == 0 || res->keys.size() < req->limit)) {
+    for (Node* node = this->buckets[i].load(std::memory_order_acquire); node;
+         node = node->next.load(std::memory_order_acquire)) {
+      res->keys.push_back(node->key);
+    }
+    i++;
+  }
+  res->cursor = i < this->n_buckets ? i : 0;
+  return true;
+}
@@ -0,0 +1,141 @@
+#ifndef EPOCH_KVSTORE_HPP
+#define EPOCH_KVSTORE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch_lock.hpp"
+#include "epoch.hpp"
+#include "kvstore.hpp"
+#include "net/server_commands.hpp"
+
+/**
+ * A KvStore for read-heavy workloads, whose Get, MultiGet and AllKeys never
+ * take a lock.
+ *
+ * Keys live in a fixed number of buckets, each a singly-linked list of
+ * immutable nodes. Writers serialize per stripe of buckets and never modify a
+ * node that a reader might see: they build a replacement node and publish it
+ * with a single atomic store, then retire the old node through Epoch, which
+ * frees it once no reader can still be traversing it.
+ *
+ * Readers don't need a lock to see a consistent node, but MultiGet also has to
+ * see all of its keys at a single point in time. Each stripe therefore carries
+ * a sequence number that writers make odd while they modify the stripe;
+ * MultiGet retries if any of its stripes were written to while it read them,
+ * and falls back to locking them after a few failed attempts.
+ *
+ * Unlike ConcurrentKvStore the bucket count is fixed, so size it for the
+ * number of keys you expect to store.
+ */
+class EpochKvStore : public KvStore {
+ public:
+  static constexpr size_t DEFAULT_BUCKET_COUNT = 1 << 16;
+  static constexpr size_t DEFAULT_STRIPE_COUNT = 64;
+
+  // Number of lock-free attempts MultiGet makes before locking its stripes.
+  static constexpr size_t MULTIGET_RETRIES = 4;
+
+  // `n_buckets` is rounded up to a multiple of `n_stripes`.
+  EpochKvStore(
+      std::function<size_t(const std::string&)> hasher =
+          std::hash<std::string>(),
+      size_t n_buckets = DEFAULT_BUCKET_COUNT,
+      size_t n_stripes = DEFAULT_STRIPE_COUNT);
+  ~EpochKvStore();
+
+  bool Get(const GetRequest* req, GetResponse* res) override;
+  bool Put(const PutRequest* req, PutResponse* res) override;
+  bool Append(const AppendRequest* req, AppendResponse* res) override;
+  bool Delete(const DeleteRequest* req, DeleteResponse* res) override;
+  bool MultiGet(const MultiGetRequest* req, MultiGetResponse* res) override;
+  bool MultiPut(const MultiPutRequest* req, MultiPutResponse* res) override;
+
+  std::vector<std::string> AllKeys() override;
+  bool ListKeys(const ListKeysRequest* req, ListKeysResponse* res) override;
+
+  EpochKvStore(const EpochKvStore&) = delete;
+  EpochKvStore& operator=(const EpochKvStore&) = delete;
+
+ private:
+  // Once published, a node's key and value never change; only `next` does.
+  struct Node {
+    const std::string key;
+    const std::string value;
+    std::atomic<Node*> next;
+
+    Node(std::string k, std::string v, Node* n)
+        : key(std::move(k)), value(std::move(v)), next(n) {
+    }
+  };
+
+  // Padded so that writers on different stripes don't share a cache line.
+  struct alignas(64) Stripe {
+    std::mutex mtx;
+    // Odd while a writer is modifying one of the stripe's buckets.
+    std::atomic<uint64_t> seq{0};
+  };
+
+  std::function<size_t(const std::string&)> hasher;
+  size_t n_stripes;
+  size_t n_buckets;
+  std::unique_ptr<Stripe[]> stripes;
+  std::unique_ptr<std::atomic<Node*>[]> buckets;
+
+  size_t stripeIndex(size_t hash) const {
+    return hash % this->n_stripes;
+  }
+
+  std::atomic<Node*>& bucketFor(size_t hash) {
+    return this->buckets[hash % this->n_buckets];
+  }
+
+  // Returns the node holding key, or nullptr. The caller must either be
+  // pinned or hold the bucket's stripe lock.
+  static const Node* find(const std::atomic<Node*>& bucket,
+                          std::string_view key);
+
+  // Returns the link that points to key's node, or the bucket's final null
+  // link if key isn't present. The caller must hold the bucket's stripe lock.
+  static std::atomic<Node*>& findLink(std::atomic<Node*>& bucket,
+                                      std::string_view key);
+
+  // Sets key to value in bucket, retiring the node it replaces. The caller
+  // must hold the bucket's stripe lock, with the stripe's seq made odd.
+  static void publish(std::atomic<Node*>& bucket, std::string key,
+                      std::string value);
+
+  // Bracket a modification of stripe s, which the caller must have locked.
+  void beginWrite(size_t s) {
+    this->stripes[s].seq.store(this->stripes[s].seq.load() + 1);
+  }
+  void endWrite(size_t s) {
+    this->stripes[s].seq.store(this->stripes[s].seq.load() + 1,
+                               std::memory_order_release);
+  }
+
+  // Reads every key in keys at a single point in time without locking,
+  // giving up if a writer gets in the way. Returns false if some key is
+  // missing.
+  bool tryMultiGet(const std::vector<std::string>& keys,
+                   const std::vector<size_t>& hashes,
+                   const std::vector<size_t>& stripe_ids,
+                   std::vector<std::string>& values, bool& consistent);
+
+  // Locks the stripes in stripe_ids, which must be sorted (see
+  // batch_lock.hpp).
+  std::vector<std::unique_lock<std::mutex>> lockStripes(
+      const std::vector<size_t>& stripe_ids) {
+    return lock_stripes<std::unique_lock<std::mutex>>(
+        stripe_ids,
+        [this](size_t s) -> std::mutex& { return this->stripes[s].mtx; });
+  }
+};
+
+#endif /* end of include guard */
@@ -0,0 +1,38 @@
+#include "kvstore.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include "ordered_index.hpp"
+
+bool KvStore::Scan(const ScanRequest* req, ScanResponse* res) {
+  std::vector<std::string> keys = this->AllKeys();
+  std::erase_if(keys, [&](const std::string& key) {
+    return !key_in_range(key, req->start, req->end);
+  });
+  std::sort(keys.begin(), keys.end(), key_less);
+
+  for (auto&& key : keys) {
+    if (req->limit > 0 && res->keys.size() == req->limit) break;
+    GetRequest get_req{key};
+    GetResponse get_res;
+    // Skip keys deleted since AllKeys() returned.
+    if (!this->Get(&get_req, &get_res)) continue;
+    res->keys.push_back(key);
+    res->values.push_back(std::move(get_res.value));
+  }
+  return true;
+}
+
+bool KvStore::ListKeys(const ListKeysRequest* req, ListKeysResponse* res) {
+  std::vector<std::string> keys = this->AllKeys();
+  std::sort(keys.begin(), keys.end());
+  if (req->cursor >= keys.size()) return true;
+
+  size_t end = keys.size();
+  if (req->limit > 0) end = std::min(end, req->cursor + req->limit);
+  res->keys.assign(std::make_move_iterator(keys.begin() + req->cursor),
+                   std::make_move_iterator(keys.begin() + end));
+  res->cursor = end < keys.size() ? end : 0;
+  return true;
+}
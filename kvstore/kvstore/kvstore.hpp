@@ -19,6 +19,17 @@ class KvStore {
   virtual bool MultiPut(const MultiPutRequest* req, MultiPutResponse*) = 0;
 
   virtual std::vector<std::string> AllKeys() = 0;
+
+  // Returns the pairs in the range `req` asks for. By default this filters
+  // and sorts AllKeys(), so stores that can walk their keys in order should
+  // override it.
+  virtual bool Scan(const ScanRequest* req, ScanResponse* res);
+
+  // Returns a page of keys from a walk over the whole store, so that callers
+  // can visit every key without holding them all at once. By default the
+  // cursor is an offset into the sorted AllKeys(), which is neither cheap nor
+  // stable under writes, so stores should override it.
+  virtual bool ListKeys(const ListKeysRequest* req, ListKeysResponse* res);
 };
 
 #endif /* end of include guard */
@@ -0,0 +1,228 @@
+#include "logged_kvstore.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include "batch_lock.hpp"
+#include "common/color.hpp"
+#include "snapshot.hpp"
+
+std::unique_ptr<LoggedKvStore> LoggedKvStore::open(
+    std::unique_ptr<KvStore> store, const WalOptions& options) {
+  if (!options.snapshot_path.empty()) {
+    cerr_color(RED, "Only a ConcurrentKvStore can be snapshotted");
+    return nullptr;
+  }
+  std::unique_ptr<WriteAheadLog> wal = WriteAheadLog::open(
+      options, [&](uint64_t, const Request& req) {
+        apply(store.get(), req, [](const std::string&) { return true; });
+      });
+  if (!wal) return nullptr;
+  return std::unique_ptr<LoggedKvStore>(
+      new LoggedKvStore(std::move(store), std::move(wal), nullptr, options));
+}
+
+std::unique_ptr<LoggedKvStore> LoggedKvStore::open(
+    std::unique_ptr<ConcurrentKvStore> store, const WalOptions& options) {
+  if (options.snapshot_path.empty()) {
+    return open(std::unique_ptr<KvStore>(std::move(store)), options);
+  }
+
+  std::optional<std::vector<uint64_t>> cuts = load_snapshot(
+      options.snapshot_path, *store,
+      std::max(std::thread::hardware_concurrency(), 1u));
+  if (!cuts) return nullptr;
+  // Without a snapshot, there's nothing to skip.
+  cuts->resize(store->stripeCount());
+
+  // New records have to come after every cut, even if the log was lost.
+  uint64_t max_cut = *std::max_element(cuts->begin(), cuts->end());
+  std::unique_ptr<WriteAheadLog> wal = WriteAheadLog::open(
+      options,
+      [&](uint64_t lsn, const Request& req) {
+        apply(store.get(), req, [&](const std::string& key) {
+          return lsn > (*cuts)[store->stripeOf(key)];
+        });
+      },
+      max_cut);
+  if (!wal) return nullptr;
+
+  ConcurrentKvStore* snapshot_store = store.get();
+  return std::unique_ptr<LoggedKvStore>(new LoggedKvStore(
+      std::move(store), std::move(wal), snapshot_store, options));
+}
+
+LoggedKvStore::LoggedKvStore(std::unique_ptr<KvStore> store,
+                             std::unique_ptr<WriteAheadLog> wal,
+                             ConcurrentKvStore* snapshot_store,
+                             const WalOptions& options)
+    : store(std::move(store)),
+      wal(std::move(wal)),
+      snapshot_store(snapshot_store),
+      options(options),
+      n_stripes(snapshot_store ? snapshot_store->stripeCount() : N_STRIPES),
+      stripes(std::make_unique<std::mutex[]>(this->n_stripes)) {
+  if (this->snapshot_store && this->options.snapshot_interval.count() > 0) {
+    this->snapshotter = std::thread(&LoggedKvStore::snapshotLoop, this);
+  }
+}
+
+LoggedKvStore::~LoggedKvStore() {
+  {
+    std::lock_guard lock(this->snapshotter_mtx);
+    this->stopping = true;
+  }
+  this->snapshotter_cv.notify_all();
+  if (this->snapshotter.joinable()) this->snapshotter.join();
+}
+
+void LoggedKvStore::apply(
+    KvStore* store, const Request& req,
+    const std::function<bool(const std::string&)>& replays) {
+  // Only writes are logged. A write that failed the first time (a Delete of a
+  // key that didn't exist) fails the same way again, so results are ignored.
+  if (auto* put = std::get_if<PutRequest>(&req)) {
+    PutResponse res;
+    if (replays(put->key)) store->Put(put, &res);
+  } else if (auto* append = std::get_if<AppendRequest>(&req)) {
+    AppendResponse res;
+    if (replays(append->key)) store->Append(append, &res);
+  } else if (auto* del = std::get_if<DeleteRequest>(&req)) {
+    DeleteResponse res;
+    if (replays(del->key)) store->Delete(del, &res);
+  } else if (auto* multiput = std::get_if<MultiPutRequest>(&req)) {
+    // The snapshot may have some of the keys' stripes as of after the
+    // MultiPut, and others as of before
+    MultiPutRequest sub_req;
+    for (size_t i = 0; i < multiput->keys.size(); i++) {
+      if (!replays(multiput->keys[i])) continue;
+      sub_req.keys.push_back(multiput->keys[i]);
+      sub_req.values.push_back(multiput->values[i]);
+    }
+    MultiPutResponse res;
+    if (!sub_req.keys.empty()) store->MultiPut(&sub_req, &res);
+  }
+}
+
+template <typename Req, typename Op>
+bool LoggedKvStore::logAndApply(MessageType type, const std::string& key,
+                                const Req& req, Op&& op) {
+  uint64_t lsn;
+  {
+    std::lock_guard lock(this->stripes[this->stripeOf(key)]);
+    lsn = this->wal->append(type, req);
+    if (lsn == 0 || !op()) return false;
+  }
+  return this->wal->wait(lsn);
+}
+
+bool LoggedKvStore::Get(const GetRequest* req, GetResponse* res) {
+  return this->store->Get(req, res);
+}
+
+bool LoggedKvStore::Put(const PutRequest* req, PutResponse* res) {
+  return this->logAndApply(MessageType::PUT, req->key, *req,
+                           [&] { return this->store->Put(req, res); });
+}
+
+bool LoggedKvStore::Append(const AppendRequest* req, AppendResponse* res) {
+  return this->logAndApply(MessageType::APPEND, req->key, *req,
+                           [&] { return this->store->Append(req, res); });
+}
+
+bool LoggedKvStore::Delete(const DeleteRequest* req, DeleteResponse* res) {
+  return this->logAndApply(MessageType::DELETE, req->key, *req,
+                           [&] { return this->store->Delete(req, res); });
+}
+
+bool LoggedKvStore::MultiGet(const MultiGetRequest* req,
+                             MultiGetResponse* res) {
+  return this->store->MultiGet(req, res);
+}
+
+bool LoggedKvStore::MultiPut(const MultiPutRequest* req,
+                             MultiPutResponse* res) {
+  // Don't log a request the store would reject.
+  if (req->keys.size() != req->values.size()) return false;
+
+  std::vector<size_t> stripe_ids;
+  stripe_ids.reserve(req->keys.size());
+  for (auto&& key : req->keys) stripe_ids.push_back(this->stripeOf(key));
+
+  uint64_t lsn;
+  {
+    auto locks = lock_stripes<std::unique_lock<std::mutex>>(
+        sorted_stripes(stripe_ids, this->n_stripes),
+        [this](size_t s) -> std::mutex& { return this->stripes[s]; });
+    lsn = this->wal->append(MessageType::MULTI_PUT, *req);
+    if (lsn == 0 || !this->store->MultiPut(req, res)) return false;
+  }
+  return this->wal->wait(lsn);
+}
+
+std::vector<std::string> LoggedKvStore::AllKeys() {
+  return this->store->AllKeys();
+}
+
+bool LoggedKvStore::Scan(const ScanRequest* req, ScanResponse* res) {
+  return this->store->Scan(req, res);
+}
+
+bool LoggedKvStore::ListKeys(const ListKeysRequest* req,
+                             ListKeysResponse* res) {
+  return this->store->ListKeys(req, res);
+}
+
+bool LoggedKvStore::snapshot() {
+  if (!this->snapshot_store) return false;
+  std::lock_guard snapshot_lock(this->snapshot_mtx);
+
+  // Seal the log so far off in a segment of its own: every stripe's cut will
+  // be past it, so it can go once the snapshot's in place.
+  if (!this->wal->rotate()) return false;
+  std::unique_ptr<SnapshotWriter> writer =
+      SnapshotWriter::create(this->options.snapshot_path, this->n_stripes);
+  if (!writer) return false;
+
+  uint64_t min_cut = UINT64_MAX;
+  for (size_t s = 0; s < this->n_stripes; s++) {
+    uint64_t cut;
+    {
+      // With the stripe locked here, every write to its keys logged so far
+      // has been applied, and no other can be.
+      std::lock_guard lock(this->stripes[s]);
+      cut = this->wal->lastLsn();
+      this->snapshot_store->forEachPair(
+          s, [&](std::string_view key, std::string_view value) {
+            writer->add(key, value);
+          });
+    }
+    if (!writer->endStripe(cut)) return false;
+    min_cut = std::min(min_cut, cut);
+  }
+
+  // The snapshot reflects the log up to its cuts, so that much of the log
+  // has to be durable before it is.
+  if (!this->wal->sync() || !writer->commit()) return false;
+  this->wal->truncate(min_cut);
+  return true;
+}
+
+void LoggedKvStore::snapshotLoop() {
+  // Whatever was replayed on opening might not be in a snapshot yet either.
+  uint64_t snapshotted = 0;
+  std::unique_lock lock(this->snapshotter_mtx);
+  while (!this->snapshotter_cv.wait_for(lock, this->options.snapshot_interval,
+                                        [this] { return this->stopping; })) {
+    uint64_t lsn = this->wal->lastLsn();
+    if (lsn == snapshotted) continue;
+    lock.unlock();
+    if (this->snapshot()) {
+      snapshotted = lsn;
+    } else {
+      cerr_color(RED, "Failed to snapshot to ", this->options.snapshot_path);
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef LOGGED_KVSTORE_HPP
+#define LOGGED_KVSTORE_HPP
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_kvstore.hpp"
+#include "kvstore.hpp"
+#include "net/server_commands.hpp"
+#include "wal.hpp"
+
+/**
+ * A KvStore that logs every write to a WriteAheadLog before making it to the
+ * store it wraps, so that the store can be rebuilt after a restart by
+ * replaying the log (see open()).
+ *
+ * A write is logged and applied under a lock on its key's stripe (or, for a
+ * MultiPut, its keys' stripes, in order; see batch_lock.hpp), so that writes
+ * to the same key are logged in the order they're applied. It's only
+ * acknowledged once the log says it's durable, which the write waits for
+ * after unlocking, so that writes to other keys can be logged in the
+ * meantime and made durable along with it. A write the log fails on fails;
+ * if it was applied before the log failed to make it durable, it isn't
+ * undone. Reads go straight to the wrapped store.
+ *
+ * A ConcurrentKvStore can also be snapshotted (see snapshot.hpp), so that a
+ * restart only replays the log since. Its stripes here are the store's own,
+ * so a stripe is snapshotted under its lock here, as of a single point in
+ * the log: its cut. Only the records after a key's stripe's cut are replayed
+ * into the snapshot, which makes replaying exact even for Appends, and the
+ * log before every stripe's cut is deleted.
+ */
+class LoggedKvStore : public KvStore {
+ public:
+  // Replays the log at options.path into store, then returns store wrapped to
+  // log to it from then on. Returns nullptr if the log couldn't be opened.
+  static std::unique_ptr<LoggedKvStore> open(std::unique_ptr<KvStore> store,
+                                             const WalOptions& options);
+  // The same, but if options.snapshot_path is set, loads the snapshot there
+  // first (with a thread per core), only replays the log since, and takes
+  // snapshots from then on.
+  static std::unique_ptr<LoggedKvStore> open(
+      std::unique_ptr<ConcurrentKvStore> store, const WalOptions& options);
+  ~LoggedKvStore();
+
+  bool Get(const GetRequest* req, GetResponse* res) override;
+  bool Put(const PutRequest* req, PutResponse* res) override;
+  bool Append(const AppendRequest* req, AppendResponse* res) override;
+  bool Delete(const DeleteRequest* req, DeleteResponse* res) override;
+  bool MultiGet(const MultiGetRequest* req, MultiGetResponse* res) override;
+  bool MultiPut(const MultiPutRequest* req, MultiPutResponse* res) override;
+
+  std::vector<std::string> AllKeys() override;
+
+  bool Scan(const ScanRequest* req, ScanResponse* res) override;
+  bool ListKeys(const ListKeysRequest* req, ListKeysResponse* res) override;
+
+  // Snapshots the store to options.snapshot_path, a stripe at a time, then
+  // deletes the log the snapshot covers. Writes to a stripe wait while it's
+  // read; every other stripe's carry on. Returns false if the store can't be
+  // snapshotted, or on error, in which case the log is kept.
+  bool snapshot();
+
+  LoggedKvStore(const LoggedKvStore&) = delete;
+  LoggedKvStore& operator=(const LoggedKvStore&) = delete;
+
+ private:
+  static constexpr size_t N_STRIPES = 64;
+
+  // snapshot_store is store, if it can be snapshotted, and nullptr otherwise.
+  LoggedKvStore(std::unique_ptr<KvStore> store,
+                std::unique_ptr<WriteAheadLog> wal,
+                ConcurrentKvStore* snapshot_store, const WalOptions& options);
+
+  std::unique_ptr<KvStore> store;
+  std::unique_ptr<WriteAheadLog> wal;
+  ConcurrentKvStore* snapshot_store;
+  WalOptions options;
+  size_t n_stripes;
+  std::unique_ptr<std::mutex[]> stripes;
+
+  // Held throughout a snapshot, so only one is taken at a time.
+  std::mutex snapshot_mtx;
+  // Takes a snapshot every options.snapshot_interval that the log has grown,
+  // until stopping is set.
+  std::thread snapshotter;
+  std::mutex snapshotter_mtx;
+  std::condition_variable snapshotter_cv;
+  bool stopping = false;
+
+  // Applies a request read back from the log to store, for the keys
+  // `replays` says to.
+  static void apply(KvStore* store, const Request& req,
+                    const std::function<bool(const std::string&)>& replays);
+
+  size_t stripeOf(const std::string& key) const {
+    if (this->snapshot_store) return this->snapshot_store->stripeOf(key);
+    return std::hash<std::string>()(key) % this->n_stripes;
+  }
+
+  // Logs req, of the given type, and applies it with `op`, under the lock of
+  // key's stripe, then waits for it to be durable.
+  template <typename Req, typename Op>
+  bool logAndApply(MessageType type, const std::string& key, const Req& req,
+                   Op&& op);
+
+  void snapshotLoop();
+};
+
+#endif /* end of include guard */
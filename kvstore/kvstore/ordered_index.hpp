@@ -0,0 +1,186 @@
+#ifndef ORDERED_INDEX_HPP
+#define ORDERED_INDEX_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "epoch.hpp"
+
+// The order range scans walk keys in. Keys are compared case-insensitively,
+// the way shards bound them (see common/shard.hpp), and keys that differ only
+// in case are ordered by their bytes. An upper-case key therefore sorts before
+// every other key that matches it case-insensitively, so a shard's bounds
+// split the order exactly where the shard's keys begin and end.
+inline bool key_less(std::string_view a, std::string_view b) {
+  size_t n = std::min(a.size(), b.size());
+  for (size_t i = 0; i < n; i++) {
+    int ca = std::toupper(static_cast<unsigned char>(a[i]));
+    int cb = std::toupper(static_cast<unsigned char>(b[i]));
+    if (ca != cb) return ca < cb;
+  }
+  if (a.size() != b.size()) return a.size() < b.size();
+  return a < b;
+}
+
+// Whether `key` is in [start, end), in key_less order. An empty `end` means
+// the range has no upper bound.
+inline bool key_in_range(std::string_view key, std::string_view start,
+                         std::string_view end) {
+  return !key_less(key, start) && (end.empty() || key_less(key, end));
+}
+
+/**
+ * A concurrent skip list of keys, in key_less order, that a hash-based store
+ * can keep alongside its map to answer range scans without visiting every key.
+ *
+ * Writers serialize on a single mutex, and only need it when a key is added
+ * or removed (not when a value changes). Readers take no lock at all: nodes are
+ * linked in bottom level first, each with a single atomic store, and unlinked
+ * nodes keep pointing forward into the list and are only freed through Epoch
+ * once no reader can be standing on them.
+ */
+class OrderedIndex {
+ public:
+  // Enough levels for a few billion keys at a branching factor of 4.
+  static constexpr int MAX_HEIGHT = 16;
+
+  OrderedIndex() : head(new Node("", MAX_HEIGHT)) {
+  }
+
+  ~OrderedIndex() {
+    Node* node = this->head;
+    while (node) {
+      Node* next = node->next[0].load(std::memory_order_relaxed);
+      delete node;
+      node = next;
+    }
+  }
+
+  OrderedIndex(const OrderedIndex&) = delete;
+  OrderedIndex& operator=(const OrderedIndex&) = delete;
+
+  // Adds `key`. Returns false if it was already present.
+  bool insert(std::string_view key) {
+    std::lock_guard lock(this->mtx);
+    Node* preds[MAX_HEIGHT];
+    Node* found = this->findPreds(key, preds);
+    if (found) return false;
+
+    int height = this->randomHeight();
+    Node* node = new Node(std::string(key), height);
+    for (int i = 0; i < height; i++) {
+      node->next[i].store(preds[i]->next[i].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+    }
+    // The release stores publish the node's key and links along with it.
+    for (int i = 0; i < height; i++) {
+      preds[i]->next[i].store(node, std::memory_order_release);
+    }
+    this->n_keys.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Removes `key`. Returns false if it wasn't present.
+  bool erase(std::string_view key) {
+    std::lock_guard lock(this->mtx);
+    Node* preds[MAX_HEIGHT];
+    Node* node = this->findPreds(key, preds);
+    if (!node) return false;
+
+    // Unlink from the top level down. The node's own links are left alone,
+    // so a reader standing on it still makes its way to its successors.
+    for (int i = node->height - 1; i >= 0; i--) {
+      preds[i]->next[i].store(node->next[i].load(std::memory_order_relaxed),
+                              std::memory_order_release);
+    }
+    this->n_keys.fetch_sub(1, std::memory_order_relaxed);
+    Epoch::retire(node);
+    return true;
+  }
+
+  // Calls `fn(key)` on the keys in [start, end) (see key_in_range) in order,
+  // until `fn` returns false. Doesn't block writers, so it sees keys added or
+  // removed during the scan either way. The view passed to `fn` is only valid
+  // for the duration of the call.
+  template <typename Fn>
+  void scan(std::string_view start, std::string_view end, Fn&& fn) const {
+    Epoch::Guard guard;
+    Node* node = this->head;
+    for (int i = MAX_HEIGHT - 1; i >= 0; i--) {
+      Node* next = node->next[i].load(std::memory_order_acquire);
+      while (next && key_less(next->key, start)) {
+        node = next;
+        next = node->next[i].load(std::memory_order_acquire);
+      }
+    }
+    node = node->next[0].load(std::memory_order_acquire);
+    while (node && (end.empty() || key_less(node->key, end))) {
+      if (!fn(std::string_view(node->key))) return;
+      node = node->next[0].load(std::memory_order_acquire);
+    }
+  }
+
+  // Number of keys in the index.
+  size_t size() const {
+    return this->n_keys.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Node {
+    const std::string key;
+    const int height;
+    std::unique_ptr<std::atomic<Node*>[]> next;
+
+    Node(std::string k, int h)
+        : key(std::move(k)),
+          height(h),
+          next(std::make_unique<std::atomic<Node*>[]>(h)) {
+    }
+  };
+
+  // Sentinel before every key, as tall as any node can be.
+  Node* const head;
+  std::mutex mtx;
+  std::atomic<size_t> n_keys{0};
+  // State of the generator for node heights; only used by writers.
+  uint64_t rng = 0x9E3779B97F4A7C15;
+
+  // Fills `preds[i]` with the last node on level i that's before `key`, and
+  // returns the node holding `key`, or nullptr. The caller must hold `mtx`.
+  Node* findPreds(std::string_view key, Node** preds) {
+    Node* node = this->head;
+    for (int i = MAX_HEIGHT - 1; i >= 0; i--) {
+      Node* next = node->next[i].load(std::memory_order_relaxed);
+      while (next && key_less(next->key, key)) {
+        node = next;
+        next = node->next[i].load(std::memory_order_relaxed);
+      }
+      preds[i] = node;
+    }
+    Node* next = node->next[0].load(std::memory_order_relaxed);
+    return next && next->key == key ? next : nullptr;
+  }
+
+  // Each level up holds a quarter of the keys of the one below.
+  int randomHeight() {
+    // xorshift64
+    this->rng ^= this->rng << 13;
+    this->rng ^= this->rng >> 7;
+    this->rng ^= this->rng << 17;
+    int height = 1;
+    uint64_t bits = this->rng;
+    while (height < MAX_HEIGHT && (bits & 3) == 0) {
+      height++;
+      bits >>= 2;
+    }
+    return height;
+  }
+};
+
+#endif /* end of include guard */
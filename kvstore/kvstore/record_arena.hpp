@@ -0,0 +1,218 @@
+#ifndef RECORD_ARENA_HPP
+#define RECORD_ARENA_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Packs key-value records contiguously into large chunks, instead of giving
+ * every key and value a heap allocation of its own.
+ *
+ * A record is a char* to a small header followed by the key's bytes and then
+ * the value's bytes:
+ *
+ *   [key_len: u32][value_len: u32][value_cap: u32][key ...][value ... (cap)]
+ *
+ * Records are bump-allocated and never freed individually: release() only
+ * counts a record's bytes as dead. Once dead bytes make up more than half of
+ * the arena, its owner should call compact(), which copies the live records
+ * into fresh chunks and frees the old ones.
+ *
+ * Not thread-safe; the DbMap's stripe locks protect it.
+ */
+class RecordArena {
+ public:
+  // Records are carved out of chunks that start at MIN_CHUNK_SIZE bytes and
+  // double with each new chunk, up to MAX_CHUNK_SIZE, so small arenas stay
+  // small...
+  static constexpr size_t MIN_CHUNK_SIZE = 1024;
+  static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024;
+  // ...except for records larger than this, which get a chunk of their own.
+  static constexpr size_t MAX_PACKED_RECORD = MAX_CHUNK_SIZE / 4;
+  // Don't bother compacting until at least this many bytes are dead.
+  static constexpr size_t MIN_COMPACT_BYTES = 4 * 1024;
+
+  RecordArena() = default;
+  RecordArena(RecordArena&&) = default;
+  RecordArena& operator=(RecordArena&&) = default;
+
+  RecordArena(const RecordArena&) = delete;
+  RecordArena& operator=(const RecordArena&) = delete;
+
+  static std::string_view key(const char* record) {
+    Header h = header(record);
+    return {record + sizeof(Header), h.key_len};
+  }
+
+  static std::string_view value(const char* record) {
+    Header h = header(record);
+    return {record + sizeof(Header) + h.key_len, h.value_len};
+  }
+
+  // Allocates a record for `key` and `value`, with room for the value to grow
+  // to `value_cap` bytes in place.
+  char* allocate(std::string_view key, std::string_view value,
+                 size_t value_cap) {
+    assert(value_cap >= value.size());
+    assert(key.size() <= MAX_LEN && value_cap <= MAX_LEN);
+    Header h{static_cast<uint32_t>(key.size()),
+             static_cast<uint32_t>(value.size()),
+             static_cast<uint32_t>(value_cap)};
+
+    char* record = this->bump(recordSize(h));
+    std::memcpy(record, &h, sizeof(h));
+    std::memcpy(record + sizeof(h), key.data(), key.size());
+    std::memcpy(record + sizeof(h) + key.size(), value.data(), value.size());
+    this->live += recordSize(h);
+    this->payload += key.size() + value.size();
+    return record;
+  }
+
+  char* allocate(std::string_view key, std::string_view value) {
+    return this->allocate(key, value, value.size());
+  }
+
+  // Marks `record` as no longer in use.
+  void release(char* record) {
+    Header h = header(record);
+    this->live -= recordSize(h);
+    this->dead += recordSize(h);
+    this->payload -= h.key_len + h.value_len;
+  }
+
+  // Replaces the value of `record`, in place if it fits, and returns where the
+  // record now lives.
+  char* assign(char* record, std::string_view value) {
+    Header h = header(record);
+    if (value.size() > h.value_cap) {
+      char* moved = this->allocate(key(record), value);
+      this->release(record);
+      return moved;
+    }
+    std::memcpy(record + sizeof(h) + h.key_len, value.data(), value.size());
+    this->setValueLen(record, h, value.size());
+    return record;
+  }
+
+  // Appends `suffix` to the value of `record`, and returns where the record
+  // now lives. When the record has to move, its value's capacity grows by half
+  // again, so repeated appends to one key are amortized.
+  char* append(char* record, std::string_view suffix) {
+    Header h = header(record);
+    size_t len = h.value_len + suffix.size();
+    if (len > h.value_cap) {
+      std::string_view k = key(record);
+      size_t cap = std::min(len + len / 2, MAX_LEN);
+      char* moved = this->allocate(k, value(record), cap);
+      this->release(record);
+      record = moved;
+      h = header(record);
+    }
+    std::memcpy(record + sizeof(h) + h.key_len + h.value_len, suffix.data(),
+                suffix.size());
+    this->setValueLen(record, h, len);
+    return record;
+  }
+
+  // Whether enough of the arena is dead that it should be compacted.
+  bool fragmented() const {
+    return this->dead >= MIN_COMPACT_BYTES && this->dead > this->live;
+  }
+
+  // Copies every live record into fresh chunks (dropping their spare value
+  // capacity), then frees the old chunks. `for_each_record(fn)` must call
+  // `fn(char*& record)` on every live record's handle, which is updated to
+  // the record's new location.
+  template <typename ForEachRecord>
+  void compact(ForEachRecord&& for_each_record) {
+    RecordArena fresh;
+    for_each_record([&](char*& record) {
+      record = fresh.allocate(key(record), value(record));
+    });
+    *this = std::move(fresh);
+  }
+
+  // Bytes of chunks held, whether in use or not.
+  size_t reservedBytes() const {
+    return this->reserved;
+  }
+  // Bytes of records in use, including headers and spare value capacity.
+  size_t liveBytes() const {
+    return this->live;
+  }
+  // Bytes of released records that compaction would reclaim.
+  size_t deadBytes() const {
+    return this->dead;
+  }
+  // Bytes of the keys and values themselves.
+  size_t payloadBytes() const {
+    return this->payload;
+  }
+
+ private:
+  struct Header {
+    uint32_t key_len;
+    uint32_t value_len;
+    uint32_t value_cap;
+  };
+
+  static constexpr size_t MAX_LEN = std::numeric_limits<uint32_t>::max();
+
+  std::vector<std::unique_ptr<char[]>> chunks;
+  // Unused tail of the chunk currently being filled.
+  char* cur = nullptr;
+  size_t left = 0;
+  size_t next_chunk_size = MIN_CHUNK_SIZE;
+
+  size_t reserved = 0;
+  size_t live = 0;
+  size_t dead = 0;
+  size_t payload = 0;
+
+  // Records aren't aligned, so headers are always copied in and out.
+  static Header header(const char* record) {
+    Header h;
+    std::memcpy(&h, record, sizeof(h));
+    return h;
+  }
+
+  void setValueLen(char* record, Header h, size_t len) {
+    this->payload += len - h.value_len;
+    h.value_len = static_cast<uint32_t>(len);
+    std::memcpy(record, &h, sizeof(h));
+  }
+
+  static size_t recordSize(const Header& h) {
+    return sizeof(Header) + h.key_len + h.value_cap;
+  }
+
+  char* bump(size_t size) {
+    if (size > MAX_PACKED_RECORD) {
+      this->chunks.push_back(std::make_unique_for_overwrite<char[]>(size));
+      this->reserved += size;
+      return this->chunks.back().get();
+    }
+    if (size > this->left) {
+      size_t chunk_size = std::max(this->next_chunk_size, size);
+      this->next_chunk_size = std::min(2 * chunk_size, MAX_CHUNK_SIZE);
+      this->chunks.push_back(
+          std::make_unique_for_overwrite<char[]>(chunk_size));
+      this->reserved += chunk_size;
+      this->cur = this->chunks.back().get();
+      this->left = chunk_size;
+    }
+    char* p = this->cur;
+    this->cur += size;
+    this->left -= size;
+    return p;
+  }
+};
+
+#endif /* end of include guard */
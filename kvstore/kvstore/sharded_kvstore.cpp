@@ -0,0 +1,257 @@
+#include "sharded_kvstore.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+
+#include "ordered_index.hpp"
+
+ShardedKvStore::ShardedKvStore(
+    std::function<std::unique_ptr<KvStore>()> make_partition)
+    : make_partition(std::move(make_partition)) {
+  for (auto&& p : this->partitions) p = this->make_partition().release();
+}
+
+ShardedKvStore::~ShardedKvStore() {
+  for (auto&& p : this->partitions) delete p.load();
+}
+
+size_t ShardedKvStore::partitionOf(std::string_view key) {
+  // Each character's index in VALID_CHARS, in either case, or the last
+  // partition for any other character.
+  static constexpr std::array<uint8_t, 256> INDICES = [] {
+    std::array<uint8_t, 256> indices{};
+    indices.fill(N_PARTITIONS - 1);
+    for (size_t i = 0; i < VALID_CHARS.size(); i++) {
+      unsigned char c = VALID_CHARS[i];
+      indices[c] = i;
+      if ('A' <= c && c <= 'Z') indices[c - 'A' + 'a'] = i;
+    }
+    return indices;
+  }();
+  if (key.empty()) return N_PARTITIONS - 1;
+  return INDICES[static_cast<unsigned char>(key[0])];
+}
+
+std::vector<size_t> ShardedKvStore::partitionsWithin(const Shard& shard) {
+  // A partition's keys are the shard buckets, at the shard's granularity,
+  // from its character followed by the first character of VALID_CHARS, to
+  // its character followed by the last.
+  std::vector<size_t> within;
+  for (size_t p = 0; p < VALID_CHARS.size(); p++) {
+    std::string lower(1, VALID_CHARS[p]), upper(1, VALID_CHARS[p]);
+    lower.resize(shard.granularity(), VALID_CHARS.front());
+    upper.resize(shard.granularity(), VALID_CHARS.back());
+    if (shard.lower <= lower && upper <= shard.upper) within.push_back(p);
+  }
+  return within;
+}
+
+bool ShardedKvStore::splitByPartition(
+    const std::vector<std::string>& keys,
+    std::vector<std::vector<size_t>>& by_partition) {
+  if (keys.empty()) return false;
+  size_t first = partitionOf(keys[0]);
+  size_t i = 1;
+  while (i < keys.size() && partitionOf(keys[i]) == first) i++;
+  if (i == keys.size()) return false;
+
+  by_partition.resize(N_PARTITIONS);
+  for (i = 0; i < keys.size(); i++) {
+    by_partition[partitionOf(keys[i])].push_back(i);
+  }
+  return true;
+}
+
+bool ShardedKvStore::Get(const GetRequest* req, GetResponse* res) {
+  Epoch::Guard guard;
+  return this->partition(partitionOf(req->key))->Get(req, res);
+}
+
+bool ShardedKvStore::Put(const PutRequest* req, PutResponse* res) {
+  Epoch::Guard guard;
+  size_t p = partitionOf(req->key);
+  std::shared_lock gate(this->write_gates[p]);
+  return this->partition(p)->Put(req, res);
+}
+
+bool ShardedKvStore::Append(const AppendRequest* req, AppendResponse* res) {
+  Epoch::Guard guard;
+  size_t p = partitionOf(req->key);
+  std::shared_lock gate(this->write_gates[p]);
+  return this->partition(p)->Append(req, res);
+}
+
+bool ShardedKvStore::Delete(const DeleteRequest* req, DeleteResponse* res) {
+  Epoch::Guard guard;
+  size_t p = partitionOf(req->key);
+  std::shared_lock gate(this->write_gates[p]);
+  return this->partition(p)->Delete(req, res);
+}
+
+bool ShardedKvStore::MultiGet(const MultiGetRequest* req,
+                              MultiGetResponse* res) {
+  Epoch::Guard guard;
+  std::vector<std::vector<size_t>> by_partition;
+  if (!splitByPartition(req->keys, by_partition)) {
+    size_t p = req->keys.empty() ? 0 : partitionOf(req->keys[0]);
+    return this->partition(p)->MultiGet(req, res);
+  }
+
+  std::shared_lock lock(this->multi_mtx);
+  std::vector<std::string> values(req->keys.size());
+  for (size_t p = 0; p < N_PARTITIONS; p++) {
+    const std::vector<size_t>& indices = by_partition[p];
+    if (indices.empty()) continue;
+    MultiGetRequest sub_req;
+    sub_req.keys.reserve(indices.size());
+    for (size_t i : indices) sub_req.keys.push_back(req->keys[i]);
+    MultiGetResponse sub_res;
+    if (!this->partition(p)->MultiGet(&sub_req, &sub_res) ||
+        sub_res.values.size() != indices.size()) {
+      return false;
+    }
+    for (size_t j = 0; j < indices.size(); j++) {
+      values[indices[j]] = std::move(sub_res.values[j]);
+    }
+  }
+  res->values = std::move(values);
+  return true;
+}
+
+bool ShardedKvStore::MultiPut(const MultiPutRequest* req,
+                              MultiPutResponse* res) {
+  if (req->keys.size() != req->values.size()) return false;
+
+  Epoch::Guard guard;
+  std::vector<std::vector<size_t>> by_partition;
+  if (!splitByPartition(req->keys, by_partition)) {
+    size_t p = req->keys.empty() ? 0 : partitionOf(req->keys[0]);
+    std::shared_lock gate(this->write_gates[p]);
+    return this->partition(p)->MultiPut(req, res);
+  }
+
+  std::unique_lock lock(this->multi_mtx);
+  for (size_t p = 0; p < N_PARTITIONS; p++) {
+    const std::vector<size_t>& indices = by_partition[p];
+    if (indices.empty()) continue;
+    MultiPutRequest sub_req;
+    sub_req.keys.reserve(indices.size());
+    sub_req.values.reserve(indices.size());
+    for (size_t i : indices) {
+      sub_req.keys.push_back(req->keys[i]);
+      sub_req.values.push_back(req->values[i]);
+    }
+    MultiPutResponse sub_res;
+    std::shared_lock gate(this->write_gates[p]);
+    if (!this->partition(p)->MultiPut(&sub_req, &sub_res)) return false;
+  }
+  return true;
+}
+
+std::vector<std::string> ShardedKvStore::AllKeys() {
+  Epoch::Guard guard;
+  std::vector<std::string> keys;
+  for (size_t p = 0; p < N_PARTITIONS; p++) {
+    std::vector<std::string> partition_keys = this->partition(p)->AllKeys();
+    keys.insert(keys.end(), std::make_move_iterator(partition_keys.begin()),
+                std::make_move_iterator(partition_keys.end()));
+  }
+  return keys;
+}
+
+bool ShardedKvStore::Scan(const ScanRequest* req, ScanResponse* res) {
+  Epoch::Guard guard;
+  // The partitions for VALID_CHARS hold consecutive runs of keys in key_less
+  // order, so scan the ones the range reaches in turn, until the limit.
+  int first = req->start.empty()
+                  ? 0
+                  : std::toupper(static_cast<unsigned char>(req->start[0]));
+  int last = req->end.empty()
+                 ? UINT8_MAX
+                 : std::toupper(static_cast<unsigned char>(req->end[0]));
+  for (size_t p = 0; p < VALID_CHARS.size(); p++) {
+    if (req->limit > 0 && res->keys.size() == req->limit) break;
+    int c = VALID_CHARS[p];
+    if (c < first || last < c) continue;
+
+    ScanRequest sub_req{req->start, req->end,
+                        req->limit > 0 ? req->limit - res->keys.size() : 0};
+    ScanResponse sub_res;
+    if (!this->partition(p)->Scan(&sub_req, &sub_res)) return false;
+    res->keys.insert(res->keys.end(),
+                     std::make_move_iterator(sub_res.keys.begin()),
+                     std::make_move_iterator(sub_res.keys.end()));
+    res->values.insert(res->values.end(),
+                       std::make_move_iterator(sub_res.values.begin()),
+                       std::make_move_iterator(sub_res.values.end()));
+  }
+
+  // Keys that start with any other character can fall anywhere among those,
+  // so merge them in.
+  ScanResponse other;
+  if (!this->partition(N_PARTITIONS - 1)->Scan(req, &other)) return false;
+  if (other.keys.empty()) return true;
+
+  ScanResponse merged;
+  size_t i = 0, j = 0;
+  while ((i < res->keys.size() || j < other.keys.size()) &&
+         (req->limit == 0 || merged.keys.size() < req->limit)) {
+    if (j < other.keys.size() &&
+        (i == res->keys.size() || key_less(other.keys[j], res->keys[i]))) {
+      merged.keys.push_back(std::move(other.keys[j]));
+      merged.values.push_back(std::move(other.values[j]));
+      j++;
+    } else {
+      merged.keys.push_back(std::move(res->keys[i]));
+      merged.values.push_back(std::move(res->values[i]));
+      i++;
+    }
+  }
+  *res = std::move(merged);
+  return true;
+}
+
+bool ShardedKvStore::ListKeys(const ListKeysRequest* req,
+                              ListKeysResponse* res) {
+  Epoch::Guard guard;
+  size_t p = req->cursor >> CURSOR_SHIFT;
+  size_t cursor = req->cursor & ((size_t{1} << CURSOR_SHIFT) - 1);
+  while (p < N_PARTITIONS &&
+         (req->limit == 0 || res->keys.size() < req->limit)) {
+    ListKeysRequest sub_req{cursor,
+                            req->limit > 0 ? req->limit - res->keys.size() : 0};
+    ListKeysResponse sub_res;
+    if (!this->partition(p)->ListKeys(&sub_req, &sub_res)) return false;
+    res->keys.insert(res->keys.end(),
+                     std::make_move_iterator(sub_res.keys.begin()),
+                     std::make_move_iterator(sub_res.keys.end()));
+    assert(sub_res.cursor < size_t{1} << CURSOR_SHIFT);
+    cursor = sub_res.cursor;
+    if (cursor == 0) p++;
+  }
+  res->cursor = p < N_PARTITIONS ? p << CURSOR_SHIFT | cursor : 0;
+  return true;
+}
+
+bool ShardedKvStore::listPartition(size_t partition, const ListKeysRequest* req,
+                                   ListKeysResponse* res) {
+  Epoch::Guard guard;
+  return this->partition(partition)->ListKeys(req, res);
+}
+
+void ShardedKvStore::dropPartition(size_t partition) {
+  std::unique_ptr<KvStore> empty = this->make_partition();
+  KvStore* old;
+  {
+    std::unique_lock gate(this->write_gates[partition]);
+    old = this->partitions[partition].exchange(empty.release(),
+                                               std::memory_order_acq_rel);
+  }
+  Epoch::retire(old);
+  // Free it now if no request is still using it, rather than whenever this
+  // thread next retires enough to collect.
+  Epoch::collect();
+}
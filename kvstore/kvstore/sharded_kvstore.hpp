@@ -0,0 +1,102 @@
+#ifndef SHARDED_KVSTORE_HPP
+#define SHARDED_KVSTORE_HPP
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/shard.hpp"
+#include "epoch.hpp"
+#include "kvstore.hpp"
+#include "net/server_commands.hpp"
+
+/**
+ * A KvStore for a sharded server, which keeps its pairs partitioned the way
+ * shards split keys: one inner store per bucket at granularity 1 (see
+ * common/shard.hpp), that is, per character of VALID_CHARS a key can start
+ * with, case-insensitively, plus one for keys that start with anything else.
+ * When a shard moves away, every partition it covers whole can be streamed
+ * to its new server and then dropped at once, rather than deleted a pair at a
+ * time, so a move costs in proportion to the pairs that move.
+ *
+ * Requests go straight to the partition their key is in. MultiGet and
+ * MultiPut are atomic within a partition, as the inner stores make them; ones
+ * that span partitions also hold multi_mtx (shared for MultiGet, exclusively
+ * for MultiPut), so they're atomic with respect to each other, too.
+ *
+ * A dropped partition is swapped for an empty one, and retired through Epoch:
+ * every request pins the epoch while it uses a partition, so the old one is
+ * only freed once no request can still be using it. Writes also hold their
+ * partition's write gate (shared) while they write, and a drop holds it
+ * exclusively while it swaps, so it waits for writes under way to finish: a
+ * write either lands before the drop, and is dropped with it, or on the empty
+ * partition after it, never on the old one once it's been swapped out.
+ */
+class ShardedKvStore : public KvStore {
+ public:
+  // One partition per character of VALID_CHARS, in order, then one for keys
+  // that don't start with one.
+  static constexpr size_t N_PARTITIONS = VALID_CHARS.size() + 1;
+
+  // `make_partition` creates each partition's store, both at first and when
+  // one is dropped.
+  explicit ShardedKvStore(
+      std::function<std::unique_ptr<KvStore>()> make_partition);
+  ~ShardedKvStore();
+
+  bool Get(const GetRequest* req, GetResponse* res) override;
+  bool Put(const PutRequest* req, PutResponse* res) override;
+  bool Append(const AppendRequest* req, AppendResponse* res) override;
+  bool Delete(const DeleteRequest* req, DeleteResponse* res) override;
+  bool MultiGet(const MultiGetRequest* req, MultiGetResponse* res) override;
+  bool MultiPut(const MultiPutRequest* req, MultiPutResponse* res) override;
+
+  std::vector<std::string> AllKeys() override;
+
+  bool Scan(const ScanRequest* req, ScanResponse* res) override;
+  bool ListKeys(const ListKeysRequest* req, ListKeysResponse* res) override;
+
+  // The partition key belongs in.
+  static size_t partitionOf(std::string_view key);
+  // The partitions every key of which the shard contains.
+  static std::vector<size_t> partitionsWithin(const Shard& shard);
+
+  // A ListKeys over just one partition's keys.
+  bool listPartition(size_t partition, const ListKeysRequest* req,
+                     ListKeysResponse* res);
+  // Replaces the partition with an empty one, dropping all of its pairs, once
+  // writes under way on it have finished.
+  void dropPartition(size_t partition);
+
+  ShardedKvStore(const ShardedKvStore&) = delete;
+  ShardedKvStore& operator=(const ShardedKvStore&) = delete;
+
+ private:
+  // A ListKeys cursor is the partition the walk is in, in its top bits, and
+  // the cursor within that partition below them.
+  static constexpr size_t CURSOR_SHIFT = 58;
+  static_assert(N_PARTITIONS <= size_t{1} << (64 - CURSOR_SHIFT));
+
+  std::function<std::unique_ptr<KvStore>()> make_partition;
+  std::array<std::atomic<KvStore*>, N_PARTITIONS> partitions;
+  std::array<std::shared_mutex, N_PARTITIONS> write_gates;
+  std::shared_mutex multi_mtx;
+
+  // The caller must be pinned (hold an Epoch::Guard) while it uses the
+  // partition.
+  KvStore* partition(size_t p) {
+    return this->partitions[p].load(std::memory_order_acquire);
+  }
+
+  // Splits the positions of keys by the partition each key is in. Returns
+  // false, leaving by_partition empty, if they're all in the same one.
+  static bool splitByPartition(const std::vector<std::string>& keys,
+                               std::vector<std::vector<size_t>>& by_partition);
+};
+
+#endif /* end of include guard */
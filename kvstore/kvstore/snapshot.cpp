@@ -0,0 +1,246 @@
+#include "snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <thread>
+
+#include "common/color.hpp"
+#include "common/crc32.hpp"
+#include "common/utils.hpp"
+
+static constexpr char MAGIC[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '1'};
+// A pair's key and value sizes.
+static constexpr size_t PAIR_HEADER_SIZE = 2 * sizeof(uint32_t);
+// A stripe table entry: offset, size, pair count and cut, then the CRC and 4
+// bytes of padding.
+static constexpr size_t ENTRY_SIZE =
+    4 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+// The stripe count, the table's CRC and 4 bytes of padding, then MAGIC.
+static constexpr size_t TRAILER_SIZE =
+    sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(MAGIC);
+
+template <typename T>
+static void put(std::vector<std::byte>& buf, const T& x) {
+  size_t n = buf.size();
+  buf.resize(n + sizeof(x));
+  std::memcpy(buf.data() + n, &x, sizeof(x));
+}
+
+template <typename T>
+static T get(const std::byte* p) {
+  T x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+std::unique_ptr<SnapshotWriter> SnapshotWriter::create(const std::string& path,
+                                                       size_t n_stripes) {
+  std::string tmp_path = path + ".tmp";
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    perror_color(RED, "open");
+    return nullptr;
+  }
+  auto writer = std::unique_ptr<SnapshotWriter>(
+      new SnapshotWriter(path, std::move(tmp_path), fd, n_stripes));
+  if (!write_all(fd, std::as_bytes(std::span(MAGIC)))) {
+    perror_color(RED, "write");
+    return nullptr;
+  }
+  return writer;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& path, std::string tmp_path,
+                               int fd, size_t n_stripes)
+    : path(path),
+      tmp_path(std::move(tmp_path)),
+      fd(fd),
+      n_stripes(n_stripes),
+      offset(sizeof(MAGIC)) {
+  this->sections.reserve(n_stripes);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (this->fd >= 0) close(this->fd);
+  if (!this->committed) unlink(this->tmp_path.c_str());
+}
+
+void SnapshotWriter::add(std::string_view key, std::string_view value) {
+  put(this->buf, static_cast<uint32_t>(key.size()));
+  put(this->buf, static_cast<uint32_t>(value.size()));
+  auto key_bytes = std::as_bytes(std::span(key));
+  auto value_bytes = std::as_bytes(std::span(value));
+  this->buf.insert(this->buf.end(), key_bytes.begin(), key_bytes.end());
+  this->buf.insert(this->buf.end(), value_bytes.begin(), value_bytes.end());
+  this->n_pairs++;
+}
+
+bool SnapshotWriter::endStripe(uint64_t cut_lsn) {
+  if (!write_all(this->fd, this->buf)) {
+    perror_color(RED, "write");
+    return false;
+  }
+  this->sections.push_back({this->offset, this->buf.size(), this->n_pairs,
+                            cut_lsn, crc32c(this->buf)});
+  this->offset += this->buf.size();
+  this->buf.clear();
+  this->n_pairs = 0;
+  return true;
+}
+
+bool SnapshotWriter::commit() {
+  if (this->sections.size() != this->n_stripes) return false;
+
+  std::vector<std::byte> table;
+  for (auto&& section : this->sections) {
+    put(table, section.offset);
+    put(table, section.size);
+    put(table, section.n_pairs);
+    put(table, section.cut_lsn);
+    put(table, section.crc);
+    put(table, uint32_t{0});
+  }
+  std::vector<std::byte> trailer;
+  put(trailer, static_cast<uint64_t>(this->n_stripes));
+  put(trailer, crc32c(table));
+  put(trailer, uint32_t{0});
+  put(trailer, MAGIC);
+  if (!write_all(this->fd, table) || !write_all(this->fd, trailer) ||
+      fdatasync(this->fd) < 0) {
+    perror_color(RED, "write");
+    return false;
+  }
+  close(this->fd);
+  this->fd = -1;
+
+  if (std::rename(this->tmp_path.c_str(), this->path.c_str()) < 0 ||
+      !sync_dir(this->path)) {
+    perror_color(RED, "rename");
+    return false;
+  }
+  this->committed = true;
+  return true;
+}
+
+std::optional<std::vector<uint64_t>> load_snapshot(const std::string& path,
+                                                   ConcurrentKvStore& store,
+                                                   size_t n_threads) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0 && errno == ENOENT) return std::vector<uint64_t>{};
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror_color(RED, "open");
+    if (fd >= 0) close(fd);
+    return std::nullopt;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(MAGIC) + TRAILER_SIZE) {
+    close(fd);
+    cerr_color(RED, path, " is not a snapshot");
+    return std::nullopt;
+  }
+  // The mapping outlives the fd
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    perror_color(RED, "mmap");
+    return std::nullopt;
+  }
+  // The threads between them read the whole file, in no particular order
+  madvise(addr, size, MADV_WILLNEED);
+  std::span<const std::byte> file(static_cast<const std::byte*>(addr), size);
+  auto fail = [&](const char* why) -> std::optional<std::vector<uint64_t>> {
+    munmap(addr, size);
+    cerr_color(RED, path, ": ", why);
+    return std::nullopt;
+  };
+
+  const std::byte* trailer = file.data() + size - TRAILER_SIZE;
+  if (std::memcmp(file.data(), MAGIC, sizeof(MAGIC)) != 0 ||
+      std::memcmp(trailer + TRAILER_SIZE - sizeof(MAGIC), MAGIC,
+                  sizeof(MAGIC)) != 0) {
+    return fail("not a snapshot");
+  }
+  auto n_stripes = get<uint64_t>(trailer);
+  if (n_stripes != store.stripeCount()) {
+    return fail("taken of a store with a different number of stripes");
+  }
+  size_t table_size = n_stripes * ENTRY_SIZE;
+  if (size - sizeof(MAGIC) - TRAILER_SIZE < table_size) {
+    return fail("stripe table is cut short");
+  }
+  size_t table_offset = size - TRAILER_SIZE - table_size;
+  auto table = file.subspan(table_offset, table_size);
+  if (crc32c(table) != get<uint32_t>(trailer + sizeof(uint64_t))) {
+    return fail("stripe table is corrupt");
+  }
+
+  std::vector<uint64_t> offsets(n_stripes), sizes(n_stripes),
+      n_pairs(n_stripes), cuts(n_stripes);
+  std::vector<uint32_t> crcs(n_stripes);
+  size_t total_pairs = 0;
+  for (size_t s = 0; s < n_stripes; s++) {
+    const std::byte* entry = table.data() + s * ENTRY_SIZE;
+    offsets[s] = get<uint64_t>(entry);
+    sizes[s] = get<uint64_t>(entry + 8);
+    n_pairs[s] = get<uint64_t>(entry + 16);
+    cuts[s] = get<uint64_t>(entry + 24);
+    crcs[s] = get<uint32_t>(entry + 32);
+    if (offsets[s] < sizeof(MAGIC) || offsets[s] > table_offset ||
+        table_offset - offsets[s] < sizes[s]) {
+      return fail("stripe table is corrupt");
+    }
+    total_pairs += n_pairs[s];
+  }
+
+  // Size the table once, rather than have it grow as the threads fill it.
+  // Each thread loads whole stripes, so they never contend on a stripe lock.
+  store.reserve(total_pairs);
+  std::atomic<size_t> next_stripe = 0;
+  std::atomic<bool> ok = true;
+  auto load_stripes = [&] {
+    PutRequest req;
+    PutResponse res;
+    for (size_t s; ok && (s = next_stripe++) < n_stripes;) {
+      auto section = file.subspan(offsets[s], sizes[s]);
+      if (crc32c(section) != crcs[s]) {
+        ok = false;
+        return;
+      }
+      size_t pos = 0;
+      for (uint64_t i = 0; i < n_pairs[s]; i++) {
+        if (section.size() - pos < PAIR_HEADER_SIZE) break;
+        auto key_size = get<uint32_t>(section.data() + pos);
+        auto value_size = get<uint32_t>(section.data() + pos + 4);
+        pos += PAIR_HEADER_SIZE;
+        if (section.size() - pos < size_t{key_size} + value_size) break;
+        const char* chars = reinterpret_cast<const char*>(section.data());
+        req.key.assign(chars + pos, key_size);
+        req.value.assign(chars + pos + key_size, value_size);
+        pos += key_size + value_size;
+        store.Put(&req, &res);
+      }
+      if (pos != section.size()) {
+        ok = false;
+        return;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < n_threads; t++) threads.emplace_back(load_stripes);
+  load_stripes();
+  for (auto&& thread : threads) thread.join();
+
+  if (!ok) return fail("a stripe is corrupt");
+  munmap(addr, size);
+  return cuts;
+}
@@ -0,0 +1,91 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "concurrent_kvstore.hpp"
+
+/**
+ * A snapshot of a ConcurrentKvStore's pairs, written a lock stripe at a time,
+ * each as of the moment its stripe was read, for a LoggedKvStore to replay
+ * only the writes since. A snapshot file is
+ *
+ *   MAGIC | one section per stripe | stripe table | trailer
+ *
+ * where a section is its stripe's pairs, each a u32 key size, u32 value size,
+ * then the key and value, and the stripe table has, for each stripe, the
+ * offset, size, pair count and CRC-32C of its section, and its cut: the LSN of
+ * the last logged write it reflects. The trailer is the number of stripes, the
+ * table's CRC, and MAGIC again. With the table at the end, a section can be
+ * written as soon as its stripe is read, and a loader can find every section
+ * up front, to load them in parallel.
+ *
+ * A snapshot is written to a temporary file next to its path, and only renamed
+ * over it once complete and synced, so the file at the path is always a whole
+ * snapshot.
+ */
+class SnapshotWriter {
+ public:
+  // Starts a snapshot of n_stripes stripes, to be renamed to path. Returns
+  // nullptr if the temporary file can't be created.
+  static std::unique_ptr<SnapshotWriter> create(const std::string& path,
+                                                size_t n_stripes);
+  // Removes the temporary file, unless the snapshot was committed.
+  ~SnapshotWriter();
+
+  // Adds a pair to the current stripe's section, in memory.
+  void add(std::string_view key, std::string_view value);
+  // Ends the current stripe's section, whose pairs reflect the log up to
+  // cut_lsn, and writes it to the file. Returns false on error.
+  bool endStripe(uint64_t cut_lsn);
+  // Writes the stripe table, once every stripe's section has been, syncs the
+  // file and renames it over path. Returns false on error.
+  bool commit();
+
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+ private:
+  struct Section {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t n_pairs;
+    uint64_t cut_lsn;
+    uint32_t crc;
+  };
+
+  SnapshotWriter(const std::string& path, std::string tmp_path, int fd,
+                 size_t n_stripes);
+
+  std::string path;
+  std::string tmp_path;
+  int fd;
+  size_t n_stripes;
+  bool committed = false;
+
+  // The current stripe's section, and how many pairs are in it.
+  std::vector<std::byte> buf;
+  uint64_t n_pairs = 0;
+  // Where the next section goes, and the sections written so far.
+  uint64_t offset;
+  std::vector<Section> sections;
+};
+
+/**
+ * Loads the snapshot at path into store, which should be empty and have as
+ * many stripes as the snapshot, with n_threads threads, each loading whole
+ * stripes' sections from the file mmapped. Returns each stripe's cut, or an
+ * empty vector if there's no snapshot at path; returns nullopt if the
+ * snapshot can't be read, is corrupt, or doesn't match store's stripes.
+ */
+std::optional<std::vector<uint64_t>> load_snapshot(const std::string& path,
+                                                   ConcurrentKvStore& store,
+                                                   size_t n_threads);
+
+#endif /* end of include guard */
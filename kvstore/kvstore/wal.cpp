@@ -0,0 +1,357 @@
+#include "wal.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+
+#include "common/color.hpp"
+#include "common/utils.hpp"
+
+static constexpr char MAGIC[8] = {'K', 'V', 'W', 'A', 'L', '0', '0', '1'};
+static constexpr size_t FILE_HEADER_SIZE = sizeof(MAGIC) + sizeof(uint64_t);
+
+// Reads the whole file at fd into buf. Returns false on error.
+static bool read_file(int fd, std::vector<std::byte>& buf) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) return false;
+  buf.resize(st.st_size);
+  size_t pos = 0;
+  while (pos < buf.size()) {
+    ssize_t n = pread(fd, buf.data() + pos, buf.size() - pos, pos);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    pos += n;
+  }
+  return true;
+}
+
+// Creates an empty segment at path, replacing any file there, whose records
+// will start from first_lsn. Returns its fd, or -1 on error.
+static int create_segment(const std::string& path, uint64_t first_lsn) {
+  int fd = ::open(path.c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
+  std::vector<std::byte> header(FILE_HEADER_SIZE);
+  std::memcpy(header.data(), MAGIC, sizeof(MAGIC));
+  std::memcpy(header.data() + sizeof(MAGIC), &first_lsn, sizeof(first_lsn));
+  if (!write_all(fd, header) || fdatasync(fd) < 0 || !sync_dir(path)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Calls replay on each intact record of the segment in `file`, and returns the
+// position just past the last one, or 0 if `file` isn't a segment. Sets
+// *first_lsn to the LSN the segment starts from, and *last_lsn to that of its
+// last record (or to *first_lsn - 1, if it has none).
+static size_t replay_segment(
+    std::span<const std::byte> file,
+    const std::function<void(uint64_t, const Request&)>& replay,
+    uint64_t* first_lsn, uint64_t* last_lsn) {
+  if (file.size() < FILE_HEADER_SIZE ||
+      std::memcmp(file.data(), MAGIC, sizeof(MAGIC)) != 0) {
+    return 0;
+  }
+  std::memcpy(first_lsn, file.data() + sizeof(MAGIC), sizeof(*first_lsn));
+
+  constexpr size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+  size_t pos = FILE_HEADER_SIZE;
+  uint64_t lsn = *first_lsn - 1;
+  while (file.size() - pos >= RECORD_HEADER_SIZE) {
+    uint32_t size, crc;
+    std::memcpy(&size, file.data() + pos, sizeof(size));
+    std::memcpy(&crc, file.data() + pos + sizeof(size), sizeof(crc));
+    if (size == 0 || file.size() - pos - RECORD_HEADER_SIZE < size) break;
+    auto body = file.subspan(pos + RECORD_HEADER_SIZE, size);
+    if (crc32c(body) != crc) break;
+    auto type = static_cast<uint8_t>(body[0]);
+    if (type >= N_MESSAGE_TYPES) break;
+    std::optional<Request> req =
+        deserialize_request(static_cast<MessageType>(type), body.subspan(1));
+    if (!req) break;
+
+    replay(++lsn, *req);
+    pos += RECORD_HEADER_SIZE + size;
+  }
+  *last_lsn = lsn;
+  return pos;
+}
+
+std::vector<std::pair<uint64_t, std::string>> WriteAheadLog::sealedSegments(
+    const std::string& path) {
+  std::filesystem::path log(path);
+  std::filesystem::path dir = log.parent_path();
+  std::string prefix = log.filename().string() + ".";
+
+  std::vector<std::pair<uint64_t, std::string>> segments;
+  std::error_code ec;
+  for (auto&& entry : std::filesystem::directory_iterator(
+           dir.empty() ? "." : dir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (!name.starts_with(prefix) || name.size() == prefix.size()) continue;
+    std::string lsn = name.substr(prefix.size());
+    if (!is_number(lsn)) continue;
+    segments.emplace_back(std::stoull(lsn), entry.path().string());
+  }
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+std::unique_ptr<WriteAheadLog> WriteAheadLog::open(
+    const WalOptions& options,
+    const std::function<void(uint64_t, const Request&)>& replay,
+    uint64_t after_lsn) {
+  std::vector<std::byte> file;
+  uint64_t first_lsn, last_lsn = 0;
+
+  // Replay the sealed segments, oldest first. They were synced when they
+  // were sealed, so a bad record in one is damage, not a write cut short;
+  // skip the rest of it, and hope the snapshot covers it.
+  for (auto&& [lsn, path] : sealedSegments(options.path)) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool read = fd >= 0 && read_file(fd, file);
+    if (fd >= 0) close(fd);
+    if (!read) {
+      perror_color(RED, "read");
+      return nullptr;
+    }
+    size_t end = replay_segment(file, replay, &first_lsn, &last_lsn);
+    if (end == 0) {
+      cerr_color(RED, path, " is not a write-ahead log");
+      return nullptr;
+    }
+    if (end < file.size()) {
+      cerr_color(RED, "Skipping the last ", file.size() - end, " bytes of ",
+                 path, ", after record ", last_lsn, ", which are corrupt");
+    }
+  }
+
+  int fd = ::open(options.path.c_str(),
+                  O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror_color(RED, "open");
+    return nullptr;
+  }
+  auto fail = [fd](const char* what) -> std::unique_ptr<WriteAheadLog> {
+    perror_color(RED, what);
+    close(fd);
+    return nullptr;
+  };
+  if (!read_file(fd, file)) return fail("read");
+
+  // A new log, or one that died before its header was written, starts after
+  // whatever came before it
+  if (file.size() < FILE_HEADER_SIZE) {
+    close(fd);
+    first_lsn = std::max(last_lsn, after_lsn) + 1;
+    fd = create_segment(options.path, first_lsn);
+    if (fd < 0) {
+      perror_color(RED, "create");
+      return nullptr;
+    }
+    return std::unique_ptr<WriteAheadLog>(
+        new WriteAheadLog(options, fd, first_lsn, first_lsn - 1));
+  }
+
+  size_t end = replay_segment(file, replay, &first_lsn, &last_lsn);
+  if (end == 0) {
+    cerr_color(RED, options.path, " is not a write-ahead log");
+    close(fd);
+    return nullptr;
+  }
+  // Cut off a torn or corrupt tail, so that new records follow the last
+  // intact one
+  if (end < file.size()) {
+    cerr_color(YELLOW, "Dropping the last ", file.size() - end, " bytes of ",
+               options.path, ", after record ", last_lsn,
+               ", which are incomplete or corrupt");
+    if (ftruncate(fd, end) < 0 || fdatasync(fd) < 0) return fail("ftruncate");
+  }
+
+  // LSNs can't skip ahead within a segment, so start a new one to skip to
+  // after_lsn, sealing this one if there's anything in it
+  if (last_lsn < after_lsn) {
+    close(fd);
+    std::string sealed = options.path + "." + std::to_string(first_lsn);
+    if (last_lsn >= first_lsn &&
+        std::rename(options.path.c_str(), sealed.c_str()) < 0) {
+      perror_color(RED, "rename");
+      return nullptr;
+    }
+    first_lsn = last_lsn = after_lsn;
+    fd = create_segment(options.path, ++first_lsn);
+    if (fd < 0) {
+      perror_color(RED, "create");
+      return nullptr;
+    }
+  }
+
+  return std::unique_ptr<WriteAheadLog>(
+      new WriteAheadLog(options, fd, first_lsn, last_lsn));
+}
+
+WriteAheadLog::WriteAheadLog(const WalOptions& options, int fd,
+                             uint64_t first_lsn, uint64_t last_lsn)
+    : options(options),
+      fd(fd),
+      first_lsn(first_lsn),
+      written(last_lsn),
+      synced(last_lsn) {
+  if (this->options.sync != SyncPolicy::NEVER) {
+    this->syncer = std::thread(&WriteAheadLog::syncLoop, this);
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  {
+    std::lock_guard lock(this->mtx);
+    this->stopping = true;
+  }
+  this->sync_cv.notify_all();
+  if (this->syncer.joinable()) this->syncer.join();
+
+  if (!this->failed && this->synced < this->written &&
+      fdatasync(this->fd) < 0) {
+    perror_color(RED, "fdatasync");
+  }
+  close(this->fd);
+}
+
+uint64_t WriteAheadLog::write(std::span<const std::byte> record) {
+  std::lock_guard lock(this->mtx);
+  if (this->failed) return 0;
+  if (!write_all(this->fd, record)) {
+    // Part of the record may have made it, and anything written after it
+    // would be cut off with it when the log is reopened.
+    perror_color(RED, "write");
+    this->failed = true;
+    this->synced_cv.notify_all();
+    return 0;
+  }
+  return ++this->written;
+}
+
+bool WriteAheadLog::wait(uint64_t lsn) {
+  std::unique_lock lock(this->mtx);
+  if (this->options.sync != SyncPolicy::ALWAYS) return !this->failed;
+  if (this->synced < lsn) {
+    this->sync_cv.notify_one();
+    this->synced_cv.wait(
+        lock, [&] { return this->synced >= lsn || this->failed; });
+  }
+  return this->synced >= lsn;
+}
+
+uint64_t WriteAheadLog::lastLsn() {
+  std::lock_guard lock(this->mtx);
+  return this->written;
+}
+
+bool WriteAheadLog::sync() {
+  std::unique_lock lock(this->mtx);
+  return this->syncLocked(lock);
+}
+
+bool WriteAheadLog::syncLocked(std::unique_lock<std::mutex>& lock) {
+  this->synced_cv.wait(lock, [this] { return !this->syncing; });
+  if (this->failed) return false;
+  if (this->written == this->synced) return true;
+
+  // Every record written by now goes out with this one sync, however many
+  // writers appended them. Writers go on appending while it's under way,
+  // and theirs go out with the next.
+  uint64_t target = this->written;
+  int fd = this->fd;
+  this->syncing = true;
+  lock.unlock();
+  bool ok = fdatasync(fd) == 0;
+  lock.lock();
+  this->syncing = false;
+  if (ok) {
+    this->synced = std::max(this->synced, target);
+  } else {
+    perror_color(RED, "fdatasync");
+    this->failed = true;
+  }
+  this->synced_cv.notify_all();
+  return ok;
+}
+
+void WriteAheadLog::syncLoop() {
+  std::unique_lock lock(this->mtx);
+  while (!this->stopping) {
+    if (this->options.sync == SyncPolicy::ALWAYS) {
+      this->sync_cv.wait(lock, [this] {
+        return (this->written > this->synced && !this->failed) ||
+               this->stopping;
+      });
+    } else {
+      this->sync_cv.wait_for(lock, this->options.interval,
+                             [this] { return this->stopping; });
+    }
+    if (this->stopping || this->failed || this->written == this->synced) {
+      continue;
+    }
+    this->syncLocked(lock);
+  }
+}
+
+bool WriteAheadLog::rotate() {
+  std::unique_lock lock(this->mtx);
+  this->synced_cv.wait(lock, [this] { return !this->syncing; });
+  if (this->failed) return false;
+  if (this->written < this->first_lsn) return true;  // nothing to seal
+
+  // Sync and seal the segment with the mutex held, so nothing is appended to
+  // it in between
+  if (fdatasync(this->fd) < 0) {
+    perror_color(RED, "fdatasync");
+    this->failed = true;
+    this->synced_cv.notify_all();
+    return false;
+  }
+  this->synced = this->written;
+  this->synced_cv.notify_all();
+
+  std::string sealed =
+      this->options.path + "." + std::to_string(this->first_lsn);
+  if (std::rename(this->options.path.c_str(), sealed.c_str()) < 0) {
+    perror_color(RED, "rename");
+    return false;
+  }
+  int fd = create_segment(this->options.path, this->written + 1);
+  if (fd < 0) {
+    // Appends carry on into the sealed segment, which is replayed all the
+    // same; it just can't be truncated yet.
+    perror_color(RED, "create");
+    return false;
+  }
+  close(this->fd);
+  this->fd = fd;
+  this->first_lsn = this->written + 1;
+  return true;
+}
+
+void WriteAheadLog::truncate(uint64_t lsn) {
+  uint64_t next_first;
+  {
+    std::lock_guard lock(this->mtx);
+    next_first = this->first_lsn;
+  }
+  // Each segment's records run up to the next one's first
+  auto segments = sealedSegments(this->options.path);
+  for (size_t i = segments.size(); i-- > 0;) {
+    if (next_first - 1 <= lsn) {
+      std::error_code ec;
+      std::filesystem::remove(segments[i].second, ec);
+    }
+    next_first = segments[i].first;
+  }
+  sync_dir(this->options.path);
+}
@@ -0,0 +1,164 @@
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/crc32.hpp"
+#include "net/network_messages.hpp"
+
+// When a WriteAheadLog makes the records written to it durable, that is,
+// fdatasyncs them:
+//  - ALWAYS: before a write is acknowledged. Writes that arrive while a sync
+//    is under way wait for the next one, and share it.
+//  - INTERVAL: every WalOptions::interval, so a crash loses at most that much.
+//  - NEVER: only when the log is closed. Records still reach the OS as they're
+//    written, so they outlive the process crashing, but not the machine.
+enum class SyncPolicy { ALWAYS, INTERVAL, NEVER };
+
+struct WalOptions {
+  // The log file; if empty, writes aren't logged.
+  std::string path;
+  SyncPolicy sync = SyncPolicy::ALWAYS;
+  std::chrono::milliseconds interval{10};
+  // Where to snapshot the store, so that only the log since needs replaying;
+  // if empty, it isn't (see LoggedKvStore). It's snapshotted every
+  // snapshot_interval that something was written, if that's nonzero.
+  std::string snapshot_path{};
+  std::chrono::seconds snapshot_interval{0};
+};
+
+/**
+ * An append-only log of the writes made to a KvStore, so that they can be
+ * replayed into a new one after a restart.
+ *
+ * The log is a series of files, or segments: the one at the log's path, which
+ * records are appended to, and ones sealed by rotate(), named after it with
+ * the LSN of their first record appended. Each starts with a header (MAGIC,
+ * then the LSN of its first record), followed by the records, each of which
+ * is
+ *
+ *   u32 size | u32 crc32c(body) | body: u8 MessageType, then the request
+ *
+ * in the same encoding as requests are sent over the network. Records are
+ * numbered with log sequence numbers (LSNs), consecutively from the header's.
+ * A record that was only partly written when the process died, or whose bytes
+ * don't match their CRC, ends its segment: it's cut off when the log is
+ * reopened, along with everything after it.
+ *
+ * Records are written to the file as they're appended, under a mutex, and a
+ * separate thread makes them durable in batches, one fdatasync for however
+ * many were appended since the last one (group commit). Thread-safe.
+ */
+class WriteAheadLog {
+ public:
+  // Opens the log at options.path, creating it if it doesn't exist, and calls
+  // replay on each of the requests in it, with its LSN, in order. Records
+  // appended from then on are numbered after after_lsn, even if the log
+  // doesn't reach that far (say, a snapshot covers records since deleted).
+  // Returns nullptr if a file isn't a log, or can't be read or written.
+  static std::unique_ptr<WriteAheadLog> open(
+      const WalOptions& options,
+      const std::function<void(uint64_t, const Request&)>& replay,
+      uint64_t after_lsn = 0);
+  // Syncs whatever hasn't been yet, then closes the file.
+  ~WriteAheadLog();
+
+  // Appends req, of the given type, and returns its LSN, or 0 if it couldn't
+  // be written. It isn't necessarily durable until wait() says so.
+  template <typename Req>
+  uint64_t append(MessageType type, const Req& req) {
+    // Leave room for the header, and fill it in once the body's encoded.
+    std::vector<std::byte> record;
+    auto out = zpp::bits::output(record);
+    if (!success(out(uint32_t{0}, uint32_t{0}, static_cast<uint8_t>(type),
+                     req))) {
+      return 0;
+    }
+    auto body = std::span<const std::byte>(record).subspan(RECORD_HEADER_SIZE);
+    uint32_t size = body.size(), crc = crc32c(body);
+    std::memcpy(record.data(), &size, sizeof(size));
+    std::memcpy(record.data() + sizeof(size), &crc, sizeof(crc));
+    return this->write(record);
+  }
+
+  // Blocks until the record with LSN lsn is as durable as the sync policy
+  // makes records before they're acknowledged. Returns false if it can't be,
+  // because the log failed.
+  bool wait(uint64_t lsn);
+
+  // The LSN of the last record appended.
+  uint64_t lastLsn();
+
+  // Makes every record appended so far durable, whatever the sync policy.
+  bool sync();
+
+  // Seals the segment being appended to, and starts a new one, so that the
+  // records in it can later be deleted with truncate(). Appends wait while it
+  // syncs and renames the old segment. Returns false on error.
+  bool rotate();
+
+  // Deletes the sealed segments all of whose records are at or before lsn,
+  // as once a snapshot covers them.
+  void truncate(uint64_t lsn);
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+ private:
+  static constexpr size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+  WriteAheadLog(const WalOptions& options, int fd, uint64_t first_lsn,
+                uint64_t last_lsn);
+
+  WalOptions options;
+
+  // Guards everything below, and orders writes to the file.
+  std::mutex mtx;
+  // The segment being appended to, and the LSN of its first record.
+  int fd;
+  uint64_t first_lsn;
+  // Notified when there's something to sync, or the log is closing.
+  std::condition_variable sync_cv;
+  // Notified whenever `synced` moves on, or the log fails.
+  std::condition_variable synced_cv;
+  // LSNs of the last record written to the file, and of the last one synced.
+  uint64_t written;
+  uint64_t synced;
+  // Set once a write or sync fails; records after that point might be lost,
+  // so nothing more is written.
+  bool failed = false;
+  bool stopping = false;
+  // Set while a sync is under way without the mutex held, which rotate()
+  // waits out before it closes the segment.
+  bool syncing = false;
+
+  // Syncs as the policy says, until the log is closed. Not started for
+  // SyncPolicy::NEVER.
+  std::thread syncer;
+
+  // Writes a whole record to the file, returning its LSN, or 0 on failure.
+  uint64_t write(std::span<const std::byte> record);
+
+  // Syncs every record written so far, once any sync already under way is
+  // over. The caller holds `lock`, on mtx, which is released during the sync.
+  bool syncLocked(std::unique_lock<std::mutex>& lock);
+
+  void syncLoop();
+
+  // The sealed segments of the log at path, by the LSN of their first record.
+  static std::vector<std::pair<uint64_t, std::string>> sealedSegments(
+      const std::string& path);
+};
+
+#endif /* end of include guard */
@@ -3,6 +3,8 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <cassert>
 #include <mutex>
 
 bool ClientConn::close() {
@@ -21,36 +23,124 @@ bool ClientConn::shutdown() {
   return true;
 }
 
-std::optional<Request> ClientConn::recv_request() {
-  Message msg{};
-
-  {
-    std::unique_lock lock(this->recv_mtx);
-    if (!recv_message(fd, &msg)) {
-      return std::nullopt;
+std::optional<Request> ClientConn::recv_request(uint32_t* id) {
+  std::unique_lock lock(this->recv_mtx);
+  MessageType type;
+  uint32_t msg_id;
+  std::span<const std::byte> body;
+  while (true) {
+    if (!this->reader.next(&type, &msg_id, &body)) {
+      if (!this->reader.read_some(this->fd)) return std::nullopt;
+      continue;
     }
+    bool is_hello = type == MessageType::HELLO;
+    if (is_hello && !this->answer_hello(body)) return std::nullopt;
+    this->seen_first = true;
+    if (!is_hello) break;
+  }
+  if (!is_request_type(type)) {
+    cerr_color(RED, "Unexpected message type from ", this->address);
+    this->reader.set_malformed();
+    return std::nullopt;
   }
+  if (id) *id = msg_id;
 
-  auto req = deserialize_request(msg);
+  auto req = deserialize_request(type, body);
   if (!req) {
     perror_color(RED, "Error deserializing request.");
   }
   return req;
 }
 
-bool ClientConn::send_response(Response response) {
-  std::optional<Message> msg = serialize_response(response);
-  if (!msg) {
+bool ClientConn::send_response(const Response& response, uint32_t id) {
+  std::unique_lock lock(this->send_mtx);
+  if (!serialize_response(response, &this->send_msg)) {
     perror_color(RED, "Error serializing response.");
     return false;
   }
+  this->send_msg.id = id;
+
+  return send_message(fd, &this->send_msg, this->send_version,
+                      this->compress);
+}
+
+bool ClientConn::recv_buffered() {
+  std::unique_lock lock(this->recv_mtx);
+  return this->reader.read_available(this->fd);
+}
+
+std::optional<Request> ClientConn::pop_request(uint32_t* id) {
+  std::unique_lock lock(this->recv_mtx);
+  MessageType type;
+  uint32_t msg_id;
+  std::span<const std::byte> body;
+  while (this->reader.next(&type, &msg_id, &body)) {
+    if (type == MessageType::HELLO) {
+      if (!this->answer_hello(body)) {
+        this->reader.set_malformed();
+        break;
+      }
+      this->seen_first = true;
+      continue;
+    }
+    this->seen_first = true;
+    if (!is_request_type(type)) {
+      // A response, say, which no client has any business sending.
+      cerr_color(RED, "Unexpected message type from ", this->address);
+      this->reader.set_malformed();
+      break;
+    }
+    auto req = deserialize_request(type, body);
+    if (req) {
+      if (id) *id = msg_id;
+      return req;
+    }
+    // Answer a request that can't be deserialized with an error, so that it
+    // isn't waited on forever, and on V1, so that the responses to the
+    // requests after it still line up with them.
+    cerr_color(RED, "Error deserializing request from ", this->address);
+    if (!this->send_response(ErrorResponse{"Malformed request"}, msg_id)) {
+      this->reader.set_malformed();
+      break;
+    }
+  }
+  // Nothing more can be made sense of from a client that sent a malformed
+  // message (or a hello out of turn, or a message that isn't a request,
+  // above). Shut down the reading side, so
+  // that the next recv_buffered fails, as it would if the client had
+  // disconnected.
+  if (this->reader.is_malformed()) ::shutdown(this->fd, SHUT_RD);
+  return std::nullopt;
+}
+
+bool ClientConn::answer_hello(std::span<const std::byte> body) {
+  std::optional<Hello> hello = deserialize_hello(body);
+  // Only the first message on a connection may be a hello.
+  if (!hello || this->seen_first) {
+    cerr_color(RED, "Unexpected hello from ", this->address);
+    return false;
+  }
+  uint8_t version = std::clamp(hello->version, PROTOCOL_V1, PROTOCOL_LATEST);
+  // Compressed bodies are only flagged from V2 on.
+  bool compress = hello->compress && version >= PROTOCOL_V2;
 
   std::unique_lock lock(this->send_mtx);
-  return send_message(fd, &*msg);
+  Message msg{};
+  if (!serialize_hello({version, compress}, &msg)) return false;
+  if (!send_message(this->fd, &msg, this->send_version)) return false;
+  this->send_version = version;
+  this->compress = compress;
+  this->reader.set_version(version);
+  return true;
 }
 
 bool ServerConn::close() {
-  ::close(this->fd);
+  // Forget the descriptor, so it's not closed again (by the destructor, say)
+  // once it might have been reused for another socket.
+  if (this->fd >= 0) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
   return true;
 }
 
@@ -59,34 +149,107 @@ bool ServerConn::shutdown() {
   return true;
 }
 
-bool ServerConn::send_request(Request req) {
-  std::optional<Message> msg = serialize_request(req);
-  if (!msg) {
+bool ServerConn::send_request(const Request& req, uint32_t id) {
+  std::unique_lock lock(this->send_mtx);
+  if (!serialize_request(req, &this->send_msg)) {
     perror_color(RED, "Error serializing request.");
     return false;
   }
+  this->send_msg.id = id;
 
-  std::unique_lock lock(this->send_mtx);
-  return send_message(fd, &*msg);
+  return send_message(fd, &this->send_msg, this->send_version,
+                      this->compress);
 }
 
-std::optional<Response> ServerConn::recv_response() {
-  Message msg{};
-
-  {
-    std::unique_lock lock(this->recv_mtx);
-    if (!recv_message(fd, &msg)) {
-      return std::nullopt;
-    }
+std::optional<Response> ServerConn::recv_response(uint32_t* id) {
+  std::unique_lock lock(this->recv_mtx);
+  MessageType type;
+  uint32_t msg_id;
+  std::span<const std::byte> body;
+  while (!this->reader.next(&type, &msg_id, &body)) {
+    if (!this->reader.read_some(this->fd)) return std::nullopt;
   }
+  if (id) *id = msg_id;
 
-  auto res = deserialize_response(msg);
+  auto res = deserialize_response(type, body);
   if (!res) {
     perror_color(RED, "Error deserializing response.");
   }
   return res;
 }
 
+std::vector<std::optional<Response>> ServerConn::pipeline(
+    const std::vector<Request>& requests) {
+  // Each request's ID is its index plus one, since 0 means no ID. V1 framing
+  // carries no IDs, but the server answers a connection's requests in order,
+  // so there each response answers the oldest request still in flight.
+  assert(requests.size() < UINT32_MAX);
+  bool has_ids = this->protocol_version() >= PROTOCOL_V2;
+  std::vector<std::optional<Response>> responses(requests.size());
+  size_t n_sent = 0, n_recvd = 0;
+  while (n_recvd < requests.size()) {
+    // Bound what's in flight: the server answers requests while we're still
+    // sending, so if we didn't read until we'd sent everything, the responses
+    // could fill up the socket buffers and stall both of us.
+    while (n_sent < requests.size() && n_sent - n_recvd < PIPELINE_WINDOW) {
+      if (!this->send_request(requests[n_sent], n_sent + 1)) return responses;
+      n_sent++;
+    }
+
+    uint32_t id = 0;
+    std::optional<Response> res = this->recv_response(&id);
+    if (!res) return responses;
+    if (!has_ids) id = n_recvd + 1;
+    if (id == 0 || id > n_sent || responses[id - 1]) {
+      cerr_color(RED, "Unexpected response ID ", id, " from ", this->address);
+      return responses;
+    }
+    responses[id - 1] = std::move(res);
+    n_recvd++;
+  }
+  return responses;
+}
+
+bool ServerConn::hello(uint8_t max_version, bool compress) {
+  Message msg{};
+  if (!serialize_hello({max_version, compress}, &msg)) return false;
+  {
+    std::unique_lock lock(this->send_mtx);
+    if (!send_message(this->fd, &msg, this->send_version)) return false;
+  }
+
+  std::unique_lock lock(this->recv_mtx);
+  MessageType type;
+  uint32_t id;
+  std::span<const std::byte> body;
+  while (!this->reader.next(&type, &id, &body)) {
+    if (!this->reader.read_some(this->fd)) return false;
+  }
+  std::optional<Hello> answer;
+  if (type == MessageType::HELLO) answer = deserialize_hello(body);
+  if (!answer || answer->version < PROTOCOL_V1 ||
+      answer->version > max_version || (answer->compress && !compress)) {
+    cerr_color(RED, "Unexpected answer to hello from ", this->address);
+    return false;
+  }
+
+  this->reader.set_version(answer->version);
+  std::unique_lock send_lock(this->send_mtx);
+  this->send_version = answer->version;
+  this->compress = answer->compress;
+  return true;
+}
+
+uint8_t ServerConn::protocol_version() {
+  std::unique_lock lock(this->send_mtx);
+  return this->send_version;
+}
+
+bool ServerConn::compressing() {
+  std::unique_lock lock(this->send_mtx);
+  return this->compress;
+}
+
 std::shared_ptr<ClientConn> accept_client(int listener_fd) {
   // NOTE: ideally, we should use a sockaddr_storage and handle INET vs INET6,
   // but since we're only supporting IPv4 here, this should be fine.
@@ -97,6 +260,7 @@ std::shared_ptr<ClientConn> accept_client(int listener_fd) {
     // perror_color(RED, "accept");
     return nullptr;
   }
+  set_nodelay(cfd);
 
   // get hostname:port for presentability.
   char hostbuf[NI_MAXHOST], servbuf[NI_MAXSERV];
@@ -112,11 +276,26 @@ std::shared_ptr<ClientConn> accept_client(int listener_fd) {
   return std::make_shared<ClientConn>(cfd, std::string(s));
 }
 
-std::shared_ptr<ServerConn> connect_to_server(const std::string& server_addr) {
+std::shared_ptr<ServerConn> connect_to_server(const std::string& server_addr,
+                                              uint8_t max_version,
+                                              bool compress) {
   int sfd = connect_to_address(server_addr);
   if (sfd < 0) {
     return nullptr;
   }
 
+  auto conn = std::make_shared<ServerConn>(sfd, server_addr);
+  if (max_version == PROTOCOL_V1 || conn->hello(max_version, compress)) {
+    return conn;
+  }
+
+  // The server didn't take the hello, most likely because it's from before
+  // versioning and can't make sense of one, so start over without one.
+  cerr_color(YELLOW, "Server at ", server_addr,
+             " didn't answer hello; falling back to V1");
+  sfd = connect_to_address(server_addr);
+  if (sfd < 0) {
+    return nullptr;
+  }
   return std::make_shared<ServerConn>(sfd, server_addr);
 }
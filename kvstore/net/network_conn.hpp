@@ -8,6 +8,9 @@
 #include "net/server_commands.hpp"
 #include "net/shardcontroller_commands.hpp"
 
+// Maximum number of requests ServerConn::pipeline keeps in flight at once.
+#define PIPELINE_WINDOW 64
+
 /*
  * A wrapper class for a connection with a client, for use by a server
  * (i.e. KvServer, Shardcontroller)
@@ -47,18 +50,55 @@ struct ClientConn {
   /*
    * Receives a request from the client, if one has been sent. Otherwise, if the
    * client has disconnected, no request has been sent, or an error occurs, the
-   * std::optional returned contains no value.
+   * std::optional returned contains no value. If id is given, it's set to the
+   * ID the client gave the request.
    */
-  std::optional<Request> recv_request();
+  std::optional<Request> recv_request(uint32_t* id = nullptr);
   /*
-   * Sends a given response to the client, returning true on success.
+   * Sends a given response to the client, tagged with the ID of the request it
+   * answers (from V2 on; see Message::id), returning true on success.
    */
-  bool send_response(Response response);
+  bool send_response(const Response& response, uint32_t id = 0);
+
+  /*
+   * For event loops, which must not block on a single client: reads whatever
+   * the client has sent so far without waiting for more, and buffers it.
+   * Returns false if the client has disconnected or an error occurs; requests
+   * buffered before then can still be popped.
+   */
+  bool recv_buffered();
+  /*
+   * Removes and returns the next request buffered by recv_buffered, if the
+   * whole of it has arrived. Otherwise, the std::optional returned contains no
+   * value. If id is given, it's set to the ID the client gave the request.
+   * Requests that can't be deserialized are answered with an ErrorResponse
+   * along the way.
+   */
+  std::optional<Request> pop_request(uint32_t* id = nullptr);
 
  private:
   // Mutexes to prevent sending/receiving from multiple threads at once
   std::mutex send_mtx;
   std::mutex recv_mtx;
+
+  // Responses are serialized into this, guarded by send_mtx, so that its
+  // buffer is reused from one to the next.
+  Message send_msg;
+  // The framing responses are sent with, and whether large ones are
+  // compressed. Guarded by send_mtx.
+  uint8_t send_version = PROTOCOL_V1;
+  bool compress = false;
+  // Requests read, but not yet received or popped. Guarded by recv_mtx.
+  MessageReader reader;
+  // Whether a message has been taken from reader yet, since only the first
+  // may be a hello. Guarded by recv_mtx.
+  bool seen_first = false;
+
+  // Answers a client's hello (see ServerConn::hello) with the newest framing
+  // version both ends support, and whether they'll compress large messages,
+  // and switches to that. Fails unless it's the first message on the
+  // connection. Caller must hold recv_mtx.
+  bool answer_hello(std::span<const std::byte> body);
 };
 
 /*
@@ -71,7 +111,7 @@ struct ServerConn {
   ~ServerConn() {
     // cerr_color(YELLOW, "in ServerConn destructor");  // in case if there's a
     // spurious error
-    ::shutdown(this->fd, SHUT_RDWR);
+    this->close();
   }
 
   // The file descriptor for the socket associated with the connection
@@ -90,20 +130,58 @@ struct ServerConn {
   bool shutdown();
 
   /*
-   * Sends a given request to the server, returning true on success.
+   * Sends a given request to the server, tagged with an ID that the server
+   * will tag its response with (from V2 on; see Message::id), returning true
+   * on success.
    */
-  bool send_request(Request request);
+  bool send_request(const Request& request, uint32_t id = 0);
   /*
    * Receives a response from the server, if one has been sent. Otherwise, if
    * the server has disconnected, no request has been sent, or an error occurs,
-   * the std::optional returned contains no value.
+   * the std::optional returned contains no value. If id is given, it's set to
+   * the ID of the request the response answers.
    */
-  std::optional<Response> recv_response();
+  std::optional<Response> recv_response(uint32_t* id = nullptr);
+
+  /*
+   * Sends all of the given requests without waiting for each response before
+   * sending the next, keeping up to PIPELINE_WINDOW of them in flight, and
+   * returns their responses in the same order. Stops at the first failure;
+   * the responses to requests from there on contain no value. Nothing else
+   * may use the connection until this returns.
+   */
+  std::vector<std::optional<Response>> pipeline(
+      const std::vector<Request>& requests);
+
+  /*
+   * Tells the server the newest framing version the client supports, and
+   * whether it would like large messages compressed both ways, and switches to
+   * the version (and compression) it answers with, returning true on success.
+   * The connection is on PROTOCOL_V1, uncompressed, until then;
+   * connect_to_server says hello if asked for a newer version. Must be the
+   * first thing sent on the connection, and nothing else may use the
+   * connection until this returns. A server from before versioning doesn't
+   * answer a hello (it hangs up, or worse), in which case this returns false.
+   */
+  bool hello(uint8_t max_version = PROTOCOL_LATEST, bool compress = false);
+  // The framing version in use, and whether large messages are compressed.
+  uint8_t protocol_version();
+  bool compressing();
 
  private:
   // Mutexes to prevent sending/receiving from multiple threads at once
   std::mutex send_mtx;
   std::mutex recv_mtx;
+
+  // Requests are serialized into this, guarded by send_mtx, so that its
+  // buffer is reused from one to the next.
+  Message send_msg;
+  // The framing requests are sent with, and whether large ones are
+  // compressed. Guarded by send_mtx.
+  uint8_t send_version = PROTOCOL_V1;
+  bool compress = false;
+  // Responses read, but not yet received. Guarded by recv_mtx.
+  MessageReader reader;
 };
 
 /*
@@ -114,10 +192,16 @@ struct ServerConn {
 std::shared_ptr<ClientConn> accept_client(int listener_fd);
 
 /*
- * Establishes a connection to a server at the specified address.
+ * Establishes a connection to a server at the specified address. If
+ * max_version is newer than V1, also negotiates the framing version, up to
+ * max_version, with it, and whether to compress large messages (worth it for
+ * big batches of compressible values, or over slow links); a server that
+ * doesn't answer the hello is reconnected to, and spoken to in V1.
  * On success, returns a shared pointer to a ServerConn wrapper of the server
  * connection, and a null pointer otherwise.
  */
-std::shared_ptr<ServerConn> connect_to_server(const std::string& server_addr);
+std::shared_ptr<ServerConn> connect_to_server(
+    const std::string& server_addr, uint8_t max_version = PROTOCOL_V1,
+    bool compress = false);
 
 #endif /* end of include guard */
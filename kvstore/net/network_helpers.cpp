@@ -1,26 +1,48 @@
 #include "net/network_helpers.hpp"
 
+// Whether a failed non-blocking send/recv only failed because it would block.
+static bool would_block() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Waits until fd is ready for events, or until deadline passes. Returns 1 if
+// it's ready, ETIMEOUT if the deadline passed, and -1 on error.
+static int wait_until(int fd, short events,
+                      steady_clock::time_point deadline) {
+  while (true) {
+    auto left = ceil<milliseconds>(deadline - steady_clock::now());
+    if (left <= 0ms) return ETIMEOUT;
+
+    struct pollfd pfd{fd, events, 0};
+    int ready = poll(&pfd, 1, left.count());
+    if (ready > 0) return 1;
+    if (ready < 0 && errno != EINTR) return -1;
+  }
+}
+
 int sendall(int fd, void* buf, size_t len, int flags, milliseconds timeout) {
   size_t n_sent = 0, n_to_send = len;
   char* data = (char*)buf;
-  auto begin = system_clock::now();
+  // With a timeout, never block in send itself, only in poll, which gives up
+  // at the deadline.
+  if (timeout > 0ms) flags |= MSG_DONTWAIT;
+  auto deadline = steady_clock::now() + timeout;
   while (n_sent < n_to_send) {
-    // If desired, check if timed out
-    if (timeout > 0ms &&
-        duration_cast<milliseconds>(system_clock::now() - begin) > timeout) {
-      return ETIMEOUT;
-    }
-
     int curr = send(fd, data + n_sent, n_to_send - n_sent, flags);
-    if (curr <= 0) {
-      return curr;
+    if (curr > 0) {
+      // Progress; the peer isn't stalled, so give it another timeout.
+      n_sent += curr;
+      if (timeout > 0ms) deadline = steady_clock::now() + timeout;
+      continue;
     }
-
-    // update bytes sent; if not completed, network is likely saturated, so wait
-    n_sent += curr;
-    if (n_sent < n_to_send) {
-      if (timeout > 0ms) std::this_thread::sleep_for(timeout / 10);
+    if (curr < 0 && errno == EINTR) continue;
+    if (curr < 0 && timeout > 0ms && would_block()) {
+      // The socket buffer is full; wait until there's room.
+      int ready = wait_until(fd, POLLOUT, deadline);
+      if (ready < 0) return ready;
+      continue;
     }
+    return curr;
   }
   return n_sent;
 }
@@ -28,28 +50,64 @@ int sendall(int fd, void* buf, size_t len, int flags, milliseconds timeout) {
 int recvall(int fd, void* buf, size_t len, int flags, milliseconds timeout) {
   size_t n_recvd = 0, n_to_recv = len;
   char* data = (char*)buf;
-  auto begin = system_clock::now();
+  // As in sendall, only block in poll when there's a timeout.
+  if (timeout > 0ms) flags |= MSG_DONTWAIT;
+  auto deadline = steady_clock::now() + timeout;
   while (n_recvd < n_to_recv) {
-    // Check if timed out
-    if (timeout > 0ms &&
-        duration_cast<milliseconds>(system_clock::now() - begin) > timeout) {
-      return ETIMEOUT;
-    }
-
     int curr = recv(fd, data + n_recvd, n_to_recv - n_recvd, flags);
-    if (curr <= 0) {
-      return curr;
+    if (curr > 0) {
+      n_recvd += curr;
+      if (timeout > 0ms) deadline = steady_clock::now() + timeout;
+      continue;
     }
-
-    // update bytes sent; if not completed, network is likely saturated, so wait
-    n_recvd += curr;
-    if (n_recvd < n_to_recv) {
-      if (timeout > 0ms) std::this_thread::sleep_for(timeout / 10);
+    if (curr < 0 && errno == EINTR) continue;
+    if (curr < 0 && timeout > 0ms && would_block()) {
+      // Nothing more has arrived yet; wait until something does.
+      int ready = wait_until(fd, POLLIN, deadline);
+      if (ready < 0) return ready;
+      continue;
     }
+    return curr;
   }
   return n_recvd;
 }
 
+int sendallv(int fd, struct iovec* iov, int iovcnt, int flags,
+             milliseconds timeout) {
+  size_t n_sent = 0;
+  // As in sendall, only block in poll when there's a timeout.
+  if (timeout > 0ms) flags |= MSG_DONTWAIT;
+  auto deadline = steady_clock::now() + timeout;
+  while (iovcnt > 0) {
+    struct msghdr hdr{};
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = iovcnt;
+    ssize_t curr = sendmsg(fd, &hdr, flags);
+    if (curr < 0 && errno == EINTR) continue;
+    if (curr < 0 && timeout > 0ms && would_block()) {
+      int ready = wait_until(fd, POLLOUT, deadline);
+      if (ready < 0) return ready;
+      continue;
+    }
+    if (curr <= 0) return curr;
+    n_sent += curr;
+    if (timeout > 0ms) deadline = steady_clock::now() + timeout;
+
+    // Skip past what was sent.
+    size_t left = curr;
+    while (iovcnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+  return n_sent;
+}
+
 int open_listener_socket(const std::string& address) {
   size_t splitIdx = address.find(':');
   if (splitIdx == std::string::npos) {
@@ -162,9 +220,17 @@ int connect_to_address(const std::string& address) {
     return -1;
   }
 
+  set_nodelay(cfd);
   return cfd;
 }
 
+void set_nodelay(int fd) {
+  int yes = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) == -1) {
+    perror_color(YELLOW, "setsockopt");
+  }
+}
+
 std::string get_host_address(const char* port) {
   // Get our hostname for readability
   char hostnamebuf[256] = {0};
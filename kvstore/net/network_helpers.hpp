@@ -3,10 +3,13 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <chrono>
@@ -24,14 +27,21 @@ using namespace std::chrono;
 #define ETIMEOUT -2
 
 /*
- * Sends/receives all of the bytes in buf, according to len. Times out after the
- * specified amount if timeout > 0 (in this case, returns ETIMEOUT. Otherwise,
- * returns the result of send/recv).
+ * Sends/receives all of the bytes in buf, according to len. If timeout > 0,
+ * times out once that long passes without any bytes going through, returning
+ * ETIMEOUT; a large message that keeps moving doesn't time out. Otherwise,
+ * returns the result of send/recv.
  */
 int sendall(int fd, void* buf, size_t len, int flags,
             milliseconds timeout = 0ms);
 int recvall(int fd, void* buf, size_t len, int flags,
             milliseconds timeout = 0ms);
+/*
+ * Same as sendall, except sends the iovcnt buffers in iov one after another,
+ * with one system call if the socket takes them all at once. Uses up iov.
+ */
+int sendallv(int fd, struct iovec* iov, int iovcnt, int flags,
+             milliseconds timeout = 0ms);
 
 /*
  * Opens a listener socket on the specified address (hostname:port).
@@ -47,6 +57,14 @@ int open_listener_socket(const std::string& address);
  */
 int connect_to_address(const std::string& address);
 
+/*
+ * Turns off Nagle's algorithm on a connected socket. Messages are mostly small,
+ * and a client may send another before the response to the last one, so
+ * without this a round trip can stall for a delayed ACK. Failure isn't fatal;
+ * the socket is only slower.
+ */
+void set_nodelay(int fd);
+
 /*
  * Creates an address string of hostname:port, from the current host and given
  * port.
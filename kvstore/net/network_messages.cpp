@@ -1,55 +1,176 @@
 #include "net/network_messages.hpp"
 
+#include <sys/uio.h>
+
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstring>
 
+#include "common/compression.hpp"
 #include "net/network_helpers.hpp"
 
-bool send_message(int fd, Message* msg, milliseconds timeout) {
+// Size of the header a message is framed with in V1, the original framing:
+// its type and the size of its body, at fixed widths, and no ID. Only the low
+// 32 bits of the size are converted to network order, so it's only meaningful
+// between hosts with the same byte order.
+static constexpr size_t V1_HEADER_SIZE = sizeof(MessageType) + sizeof(size_t);
+// Most bytes a varint takes up: 7 bits of a uint64_t per byte.
+static constexpr size_t MAX_VARINT_SIZE = 10;
+// Largest header a message is framed with in V2: a byte each for its type and
+// flags, then the size of its body and, if it has one, its ID, as varints.
+static constexpr size_t V2_MAX_HEADER_SIZE = 2 + 2 * MAX_VARINT_SIZE;
+static constexpr size_t MAX_HEADER_SIZE =
+    std::max(V1_HEADER_SIZE, V2_MAX_HEADER_SIZE);
+
+// Writes x to out as a varint: 7 bits a byte, least significant first, with
+// the high bit set on every byte but the last. Returns the end of what it
+// wrote.
+static std::byte* put_varint(std::byte* out, uint64_t x) {
+  while (x >= 0x80) {
+    *out++ = std::byte(x | 0x80);
+    x >>= 7;
+  }
+  *out++ = std::byte(x);
+  return out;
+}
+
+// Reads a varint written by put_varint from data[0, len) into *x. Returns the
+// number of bytes it took up, 0 if not all of it is there, or -1 if it's too
+// long to be one.
+static ssize_t get_varint(const std::byte* data, size_t len, uint64_t* x) {
+  *x = 0;
+  for (size_t i = 0; i < len && i < MAX_VARINT_SIZE; i++) {
+    uint64_t b = uint64_t(data[i]);
+    *x |= (b & 0x7f) << (7 * i);
+    if (!(b & 0x80)) return i + 1;
+  }
+  return len >= MAX_VARINT_SIZE ? -1 : 0;
+}
+
+// Writes the header for a message with a body of sz bytes, framed according to
+// version, into header, which must have room for MAX_HEADER_SIZE bytes.
+// Returns its size.
+static size_t encode_header(const Message& msg, size_t sz, bool compressed,
+                            uint8_t version, std::byte* header) {
+  if (version == PROTOCOL_V1) {
+    assert(!compressed);
+    // Size in network order; there's no room for the ID.
+    size_t size_nbo = htonl(sz);
+    std::memcpy(header, &msg.type, sizeof(msg.type));
+    std::memcpy(header + sizeof(msg.type), &size_nbo, sizeof(size_nbo));
+    return V1_HEADER_SIZE;
+  }
+
+  uint8_t flags = msg.id != 0 ? FLAG_ID : 0;
+  if (compressed) flags |= FLAG_COMPRESSED;
+  std::byte* out = header;
+  *out++ = std::byte(msg.type);
+  *out++ = std::byte(flags);
+  out = put_varint(out, sz);
+  if (flags & FLAG_ID) out = put_varint(out, msg.id);
+  return out - header;
+}
+
+// Reads a header written by encode_header from data[0, len), setting
+// *compressed if compressed isn't null. Returns its size, 0 if not all of it
+// is there, or -1 if it's malformed.
+static ssize_t decode_header(const std::byte* data, size_t len,
+                             uint8_t version, MessageType* type, uint32_t* id,
+                             size_t* sz, bool* compressed = nullptr) {
+  if (compressed) *compressed = false;
+  if (version == PROTOCOL_V1) {
+    if (len < V1_HEADER_SIZE) return 0;
+    std::memcpy(type, data, sizeof(*type));
+    std::memcpy(sz, data + sizeof(*type), sizeof(*sz));
+    // Convert to host order
+    *id = 0;
+    *sz = ntohl(*sz);
+    if (*sz > MAX_MESSAGE_SIZE) return -1;
+    return V1_HEADER_SIZE;
+  }
+
+  if (len < 2) return 0;
+  uint8_t type_byte = uint8_t(data[0]);
+  uint8_t flags = uint8_t(data[1]);
+  if (type_byte >= N_MESSAGE_TYPES || (flags & ~(FLAG_ID | FLAG_COMPRESSED))) {
+    return -1;
+  }
+  *type = MessageType(type_byte);
+  if (compressed) *compressed = flags & FLAG_COMPRESSED;
+
+  size_t used = 2;
+  uint64_t x = 0;
+  ssize_t n = get_varint(data + used, len - used, &x);
+  if (n <= 0) return n;
+  if (x > MAX_MESSAGE_SIZE) return -1;
+  *sz = x;
+  used += n;
+
+  *id = 0;
+  if (flags & FLAG_ID) {
+    n = get_varint(data + used, len - used, &x);
+    if (n <= 0) return n;
+    if (x > UINT32_MAX) return -1;
+    *id = x;
+    used += n;
+  }
+  return used;
+}
+
+// Compresses msg's body into msg->packed, framed as a compressed body is.
+// Returns its size, or 0 if it isn't worth sending compressed.
+static size_t compress_body(Message* msg) {
+  size_t bound = MAX_VARINT_SIZE + lz_compress_bound(msg->sz);
+  // Only ever grow it; resizing it down and back up would zero it each time.
+  if (msg->packed.size() < bound) msg->packed.resize(bound);
+
+  std::byte* out = put_varint(msg->packed.data(), msg->sz);
+  out += lz_compress(msg->buf, out);
+  size_t packed_size = out - msg->packed.data();
+  if (packed_size > msg->sz - msg->sz / COMPRESS_MIN_SAVING) return 0;
+  return packed_size;
+}
+
+bool send_message(int fd, Message* msg, uint8_t version, bool compress,
+                  milliseconds timeout) {
   // must specify non-zero timeout
   assert(timeout > 0ms);
   assert(msg->sz == msg->buf.size());
-
-  // First, send message type
-  int curr = sendall(fd, &msg->type, sizeof(msg->type), MSG_NOSIGNAL);
-  if (curr < 0) {
-    if (curr == ETIMEOUT) {
-      // Print if timed out
-      cerr_color(RED, "Send on ", fd, " timed out.");
-    } else if (errno != EBADF && errno != EPIPE) {
-      // Only emit errors if it wasn't the result of the socket closing
-      perror_color(RED, "send");
-    }
+  if (msg->sz > MAX_MESSAGE_SIZE) {
+    cerr_color(RED, "Message of ", msg->sz, " bytes is too big to send.");
     return false;
   }
-  assert(curr == sizeof(msg->type));
 
-  // Convert size to network order, then send
-  size_t size_nbo = htonl(msg->sz);
-  curr = sendall(fd, &size_nbo, sizeof(size_nbo), MSG_NOSIGNAL);
+  // Send the header and body together, so that they go out in one system call
+  // (and, for small messages, one TCP segment) rather than one each.
+  std::byte* body = msg->buf.data();
+  size_t sz = msg->sz;
+  size_t packed_size = 0;
+  if (compress && version >= PROTOCOL_V2 && msg->sz >= COMPRESS_MIN_SIZE) {
+    packed_size = compress_body(msg);
+  }
+  if (packed_size > 0) {
+    body = msg->packed.data();
+    sz = packed_size;
+  }
+
+  std::byte header[MAX_HEADER_SIZE];
+  size_t header_size =
+      encode_header(*msg, sz, packed_size > 0, version, header);
+  struct iovec iov[2] = {{header, header_size}, {body, sz}};
+  int curr = sendallv(fd, iov, sz > 0 ? 2 : 1, MSG_NOSIGNAL, timeout);
   if (curr < 0) {
     if (curr == ETIMEOUT) {
+      // Print if timed out
       cerr_color(RED, "Send on ", fd, " timed out.");
     } else if (errno != EBADF && errno != EPIPE) {
+      // Only emit errors if it wasn't the result of the socket closing
       perror_color(RED, "send");
     }
     return false;
   }
-  assert(curr == sizeof(size_nbo));
-
-  if (msg->sz > 0) {
-    std::byte* data = &msg->buf[0];
-    curr = sendall(fd, data, msg->sz, 0, timeout);
-    if (curr < 0) {
-      if (curr == ETIMEOUT) {
-        cerr_color(RED, "Send on ", fd, " timed out.");
-      } else if (errno != EBADF && errno != EPIPE) {
-        perror_color(RED, "send");
-      }
-      return false;
-    }
-    assert(size_t(curr) == msg->sz);
-  }
+  assert(size_t(curr) == header_size + sz);
 
   return true;
 }
@@ -58,8 +179,9 @@ bool recv_message(int fd, Message* msg, milliseconds timeout) {
   // must specify non-zero timeout
   assert(timeout > 0ms);
 
-  // get message type
-  int curr = recvall(fd, &msg->type, sizeof(msg->type), 0);
+  // get the header; need the size to inform how much to read into the vector
+  std::byte header[V1_HEADER_SIZE];
+  int curr = recvall(fd, header, V1_HEADER_SIZE, 0);
   if (curr == 0) {
     // In this case, recv got an EOF, so other end closed the connection.
     return false;
@@ -73,28 +195,16 @@ bool recv_message(int fd, Message* msg, milliseconds timeout) {
     }
     return false;
   }
-  assert(curr == sizeof(msg->type));
-
-  // get size; need this to inform how much to read into the vector
-  curr = recvall(fd, &msg->sz, sizeof(msg->sz), 0);
-  if (curr == 0) {
-    return false;
-  } else if (curr < 0) {
-    if (curr == ETIMEOUT) {
-      cerr_color(RED, "Recv on ", fd, " timed out.");
-    } else if (errno != EBADF) {
-      perror_color(RED, "recv");
-    }
+  assert(curr == V1_HEADER_SIZE);
+  if (decode_header(header, V1_HEADER_SIZE, PROTOCOL_V1, &msg->type, &msg->id,
+                    &msg->sz) < 0) {
+    cerr_color(RED, "Malformed message on ", fd, '.');
     return false;
   }
-  // Convert to host order
-  msg->sz = ntohl(msg->sz);
-  assert(curr == sizeof(msg->sz));
 
+  msg->buf.resize(msg->sz);
   if (msg->sz > 0) {
-    msg->buf.resize(msg->sz);
-    std::byte* data = &msg->buf[0];
-    curr = recvall(fd, data, msg->sz, 0, timeout);
+    curr = recvall(fd, msg->buf.data(), msg->sz, 0, timeout);
     if (curr == 0) {
       return false;
     } else if (curr < 0) {
@@ -111,41 +221,177 @@ bool recv_message(int fd, Message* msg, milliseconds timeout) {
   return true;
 }
 
-std::optional<Message> serialize_request(Request request) {
-  Message msg{};
+bool MessageReader::next(MessageType* type, uint32_t* id,
+                         std::span<const std::byte>* body) {
+  if (this->malformed) return false;
+  const std::byte* data = this->buf.data() + this->pos;
+  size_t len = this->buf.size() - this->pos;
+
+  size_t sz = 0;
+  bool compressed = false;
+  ssize_t header_size =
+      decode_header(data, len, this->version, type, id, &sz, &compressed);
+  if (header_size < 0) this->malformed = true;
+  if (header_size <= 0 || len - header_size < sz) return false;
+
+  *body = std::span<const std::byte>(data + header_size, sz);
+  if (compressed && !this->decompress(body)) {
+    this->malformed = true;
+    return false;
+  }
+  this->pos += header_size + sz;
+  return true;
+}
+
+bool MessageReader::decompress(std::span<const std::byte>* body) {
+  uint64_t unpacked_size = 0;
+  ssize_t n = get_varint(body->data(), body->size(), &unpacked_size);
+  if (n <= 0) return false;
+  std::span<const std::byte> block = body->subspan(n);
+  // Don't make room for more than the block could possibly decompress to, or
+  // than any message may be.
+  if (unpacked_size > lz_decompress_bound(block.size()) ||
+      unpacked_size > MAX_MESSAGE_SIZE) {
+    return false;
+  }
+
+  // Only ever grow it; resizing it down and back up would zero it each time.
+  if (this->unpacked.size() < unpacked_size) {
+    this->unpacked.resize(unpacked_size);
+  }
+  std::span<std::byte> out(this->unpacked.data(), unpacked_size);
+  if (!lz_decompress(block, out)) return false;
+  *body = out;
+  return true;
+}
+
+bool MessageReader::read_some(int fd) {
+  if (this->malformed) {
+    cerr_color(RED, "Malformed message on ", fd, '.');
+    return false;
+  }
+  this->compact();
+
+  // Make room for the rest of the message under way, if its header is in, so
+  // that a large one doesn't take many reads.
+  size_t room = READ_SIZE;
+  size_t len = this->buf.size() - this->pos;
+  MessageType type;
+  uint32_t id;
+  size_t sz = 0;
+  ssize_t header_size = decode_header(this->buf.data() + this->pos, len,
+                                      this->version, &type, &id, &sz);
+  // decode_header caps sz at MAX_MESSAGE_SIZE, so this can't overflow, and
+  // the buffer grows by at most that much.
+  if (header_size > 0 && header_size + sz > len) {
+    room = std::max(room, header_size + sz - len);
+  }
+
+  while (true) {
+    size_t old_size = this->buf.size();
+    this->buf.resize(old_size + room);
+    ssize_t curr = recv(fd, &this->buf[old_size], room, 0);
+    this->buf.resize(old_size + std::max<ssize_t>(curr, 0));
+    if (curr > 0) return true;
+
+    if (curr < 0 && errno == EINTR) continue;
+    if (curr < 0 && errno != EBADF && errno != ECONNRESET) {
+      // Only emit errors if it wasn't the result of the socket closing
+      perror_color(RED, "recv");
+    }
+    // Otherwise, the other end closed the connection.
+    return false;
+  }
+}
+
+bool MessageReader::read_available(int fd) {
+  if (this->malformed) {
+    cerr_color(RED, "Malformed message on ", fd, '.');
+    return false;
+  }
+  this->compact();
+
+  while (true) {
+    size_t old_size = this->buf.size();
+    this->buf.resize(old_size + READ_SIZE);
+    ssize_t curr = recv(fd, &this->buf[old_size], READ_SIZE, MSG_DONTWAIT);
+    this->buf.resize(old_size + std::max<ssize_t>(curr, 0));
+    if (curr > 0) continue;
+
+    if (curr == 0) {
+      // The other end closed the connection.
+      return false;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Read everything that's arrived so far.
+      return true;
+    }
+    if (errno == EINTR) continue;
+    if (errno != EBADF && errno != ECONNRESET) {
+      // Only emit errors if it wasn't the result of the socket closing
+      perror_color(RED, "recv");
+    }
+    return false;
+  }
+}
+
+void MessageReader::compact() {
+  // Drop what's already been taken, once it's most of the buffer; a peer with
+  // many messages buffered is taken from a few at a time, and moving the rest
+  // down after each few would copy them over and over.
+  if (this->pos > 0 && this->pos >= this->buf.size() / 2) {
+    this->buf.erase(this->buf.begin(), this->buf.begin() + this->pos);
+    this->pos = 0;
+  }
+}
+
+bool serialize_request(const Request& request, Message* msg) {
 
   // Serialize into message, depending on type
-  auto out = zpp::bits::output(msg.buf);
+  msg->buf.clear();
+  auto out = zpp::bits::output(msg->buf);
   if (auto* req = std::get_if<JoinRequest>(&request)) {
-    msg.type = MessageType::JOIN;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::JOIN;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<LeaveRequest>(&request)) {
-    msg.type = MessageType::LEAVE;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::LEAVE;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<MoveRequest>(&request)) {
-    msg.type = MessageType::MOVE;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::MOVE;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<QueryRequest>(&request)) {
-    msg.type = MessageType::QUERY;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::QUERY;
+    if (!success(out(*req))) return false;
+  } else if (auto* req = std::get_if<WatchRequest>(&request)) {
+    msg->type = MessageType::WATCH;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<GetRequest>(&request)) {
-    msg.type = MessageType::GET;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::GET;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<PutRequest>(&request)) {
-    msg.type = MessageType::PUT;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::PUT;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<AppendRequest>(&request)) {
-    msg.type = MessageType::APPEND;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::APPEND;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<DeleteRequest>(&request)) {
-    msg.type = MessageType::DELETE;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::DELETE;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<MultiGetRequest>(&request)) {
-    msg.type = MessageType::MULTI_GET;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::MULTI_GET;
+    if (!success(out(*req))) return false;
   } else if (auto* req = std::get_if<MultiPutRequest>(&request)) {
-    msg.type = MessageType::MULTI_PUT;
-    if (!success(out(*req))) return std::nullopt;
+    msg->type = MessageType::MULTI_PUT;
+    if (!success(out(*req))) return false;
+  } else if (auto* req = std::get_if<ScanRequest>(&request)) {
+    msg->type = MessageType::SCAN;
+    if (!success(out(*req))) return false;
+  } else if (auto* req = std::get_if<ListKeysRequest>(&request)) {
+    msg->type = MessageType::LIST_KEYS;
+    if (!success(out(*req))) return false;
+  } else if (auto* req = std::get_if<TransferRequest>(&request)) {
+    msg->type = MessageType::TRANSFER;
+    if (!success(out(*req))) return false;
   } else {
     throw std::logic_error{
         "Invalid request variant! Please post privately on Edstem if this "
@@ -153,124 +399,187 @@ std::optional<Message> serialize_request(Request request) {
   }
 
   // Set size, for easier network parsing
-  msg.sz = msg.buf.size();
+  msg->sz = msg->buf.size();
 
+  return true;
+}
+
+bool serialize_hello(const Hello& hello, Message* msg) {
+  msg->type = MessageType::HELLO;
+  msg->id = 0;
+  msg->buf.clear();
+  auto out = zpp::bits::output(msg->buf);
+  if (!success(out(hello.version, hello.compress))) return false;
+  msg->sz = msg->buf.size();
+  return true;
+}
+
+std::optional<Hello> deserialize_hello(std::span<const std::byte> body) {
+  Hello hello{};
+  auto in = zpp::bits::input(body);
+  if (!success(in(hello.version, hello.compress))) return std::nullopt;
+  return hello;
+}
+
+std::optional<Message> serialize_request(const Request& request) {
+  Message msg{};
+  if (!serialize_request(request, &msg)) return std::nullopt;
   return msg;
 }
 
-std::optional<Request> deserialize_request(Message message) {
+std::optional<Request> deserialize_request(MessageType type,
+                                            std::span<const std::byte> body) {
   Request request;
   // Deserialize from message, depending on type
-  auto in = zpp::bits::input(message.buf);
-  switch (message.type) {
+  auto in = zpp::bits::input(body);
+  switch (type) {
     case MessageType::JOIN: {
       JoinRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::LEAVE: {
       LeaveRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::MOVE: {
       MoveRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::QUERY: {
       QueryRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
+      break;
+    }
+    case MessageType::WATCH: {
+      WatchRequest req{};
+      if (!success(in(req))) return std::nullopt;
+      request = std::move(req);
       break;
     }
     case MessageType::GET: {
       GetRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::PUT: {
       PutRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::APPEND: {
       AppendRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::DELETE: {
       DeleteRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::MULTI_GET: {
       MultiGetRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
     case MessageType::MULTI_PUT: {
       MultiPutRequest req{};
       if (!success(in(req))) return std::nullopt;
-      request = req;
+      request = std::move(req);
       break;
     }
-    default:
-      throw std::logic_error{
-          "Invalid message type! Please post privately on Edstem if this "
-          "occurs."};
+    case MessageType::SCAN: {
+      ScanRequest req{};
+      if (!success(in(req))) return std::nullopt;
+      request = std::move(req);
+      break;
+    }
+    case MessageType::LIST_KEYS: {
+      ListKeysRequest req{};
+      if (!success(in(req))) return std::nullopt;
+      request = std::move(req);
+      break;
+    }
+    case MessageType::TRANSFER: {
+      TransferRequest req{};
+      if (!success(in(req))) return std::nullopt;
+      request = std::move(req);
       break;
+    }
+    default:
+      return std::nullopt;
   };
 
   return request;
 }
 
-std::optional<Message> serialize_response(Response response) {
-  Message msg{};
+std::optional<Request> deserialize_request(const Message& message) {
+  return deserialize_request(message.type, message.buf);
+}
+
+bool serialize_response(const Response& response, Message* msg) {
 
   // Serialize into message, depending on type
-  auto out = zpp::bits::output(msg.buf);
+  msg->buf.clear();
+  auto out = zpp::bits::output(msg->buf);
   if (auto* res = std::get_if<JoinResponse>(&response)) {
-    msg.type = MessageType::JOIN;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::JOIN;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<LeaveResponse>(&response)) {
-    msg.type = MessageType::LEAVE;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::LEAVE;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<MoveResponse>(&response)) {
-    msg.type = MessageType::MOVE;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::MOVE;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<QueryResponse>(&response)) {
-    msg.type = MessageType::QUERY;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::QUERY;
+    // Field by field, as zpp_bits can't count the members of a struct with an
+    // std::optional in it.
+    if (!success(out(res->config, res->previous))) return false;
+  } else if (auto* res = std::get_if<WatchResponse>(&response)) {
+    msg->type = MessageType::WATCH;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<GetResponse>(&response)) {
-    msg.type = MessageType::GET;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::GET;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<PutResponse>(&response)) {
-    msg.type = MessageType::PUT;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::PUT;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<AppendResponse>(&response)) {
-    msg.type = MessageType::APPEND;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::APPEND;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<DeleteResponse>(&response)) {
-    msg.type = MessageType::DELETE;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::DELETE;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<MultiGetResponse>(&response)) {
-    msg.type = MessageType::MULTI_GET;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::MULTI_GET;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<MultiPutResponse>(&response)) {
-    msg.type = MessageType::MULTI_PUT;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::MULTI_PUT;
+    if (!success(out(*res))) return false;
+  } else if (auto* res = std::get_if<ScanResponse>(&response)) {
+    msg->type = MessageType::SCAN;
+    if (!success(out(*res))) return false;
+  } else if (auto* res = std::get_if<ListKeysResponse>(&response)) {
+    msg->type = MessageType::LIST_KEYS;
+    if (!success(out(*res))) return false;
+  } else if (auto* res = std::get_if<TransferResponse>(&response)) {
+    msg->type = MessageType::TRANSFER;
+    if (!success(out(*res))) return false;
   } else if (auto* res = std::get_if<ErrorResponse>(&response)) {
-    msg.type = MessageType::ERROR;
-    if (!success(out(*res))) return std::nullopt;
+    msg->type = MessageType::ERROR;
+    if (!success(out(*res))) return false;
   } else {
     throw std::logic_error{
         "Invalid response variant! Please post privately on Edstem if this "
@@ -278,88 +587,127 @@ std::optional<Message> serialize_response(Response response) {
   }
 
   // Set size, for easier network parsing
-  msg.sz = msg.buf.size();
+  msg->sz = msg->buf.size();
+
+  return true;
+}
 
+std::optional<Message> serialize_response(const Response& response) {
+  Message msg{};
+  if (!serialize_response(response, &msg)) return std::nullopt;
   return msg;
 }
 
-std::optional<Response> deserialize_response(Message message) {
+std::optional<Response> deserialize_response(MessageType type,
+                                              std::span<const std::byte> body) {
   Response response;
   // Deserialize from message, depending on type
-  auto in = zpp::bits::input(message.buf);
-  switch (message.type) {
+  auto in = zpp::bits::input(body);
+  switch (type) {
     case MessageType::JOIN: {
       JoinResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::LEAVE: {
       LeaveResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::MOVE: {
       MoveResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::QUERY: {
       QueryResponse res{};
+      // A shardcontroller from before configs had epochs sends none.
+      if (!success(in(res.config.server_to_shards))) return std::nullopt;
+      if (!in.remaining_data().empty() && !success(in(res.config.epoch))) {
+        return std::nullopt;
+      }
+      if (!in.remaining_data().empty() && !success(in(res.previous))) {
+        return std::nullopt;
+      }
+      response = std::move(res);
+      break;
+    }
+    case MessageType::WATCH: {
+      WatchResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::GET: {
       GetResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::PUT: {
       PutResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::APPEND: {
       AppendResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::DELETE: {
       DeleteResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::MULTI_GET: {
       MultiGetResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     case MessageType::MULTI_PUT: {
       MultiPutResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
+      break;
+    }
+    case MessageType::SCAN: {
+      ScanResponse res{};
+      if (!success(in(res))) return std::nullopt;
+      response = std::move(res);
+      break;
+    }
+    case MessageType::LIST_KEYS: {
+      ListKeysResponse res{};
+      if (!success(in(res))) return std::nullopt;
+      response = std::move(res);
+      break;
+    }
+    case MessageType::TRANSFER: {
+      TransferResponse res{};
+      if (!success(in(res))) return std::nullopt;
+      response = std::move(res);
       break;
     }
     case MessageType::ERROR: {
       ErrorResponse res{};
       if (!success(in(res))) return std::nullopt;
-      response = res;
+      response = std::move(res);
       break;
     }
     default:
-      throw std::logic_error{
-          "Invalid message type! Please post privately on Edstem if this "
-          "occurs."};
-      break;
+      return std::nullopt;
   };
 
   return response;
 }
+
+std::optional<Response> deserialize_response(const Message& message) {
+  return deserialize_response(message.type, message.buf);
+}
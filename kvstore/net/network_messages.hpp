@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <chrono>
+#include <span>
 #include <thread>
 #include <variant>
 #include <vector>
@@ -16,6 +17,8 @@
 // ... cpp chrono is so annoying
 using namespace std::chrono;
 
+// A message's type goes over the wire as its value here, so types only ever
+// get added at the end, and peers that predate them still agree on the rest.
 enum class MessageType {
   // KvServer messages
   GET,
@@ -30,25 +33,152 @@ enum class MessageType {
   MOVE,
   QUERY,
   // Error
-  ERROR
+  ERROR,
+  // Added since
+  SCAN,
+  LIST_KEYS,
+  WATCH,
+  // Framing version negotiation (see ServerConn::hello)
+  HELLO,
+  TRANSFER
 };
+// Number of message types, for telling whether a type read off the wire is
+// one of them.
+constexpr uint8_t N_MESSAGE_TYPES = uint8_t(MessageType::TRANSFER) + 1;
+// Whether a client may send a message of the given type, read off the wire,
+// as a request. Responses have their requests' types, except for errors.
+constexpr bool is_request_type(MessageType type) {
+  return int(type) >= 0 && int(type) < N_MESSAGE_TYPES &&
+         type != MessageType::ERROR && type != MessageType::HELLO;
+}
+
+// Versions of the framing messages are sent with. V1 is the original framing,
+// which every peer understands: a message's header is its type and size at
+// fixed widths, 12 bytes in all, and carries no ID. In V2, it's its type and
+// flags in a byte each, then its size and (if the ID flag is set) ID as
+// varints, so that a small request's header takes 3 bytes. Connections start
+// out on V1, and switch to the newest version both ends support if the client
+// says hello when it connects.
+constexpr uint8_t PROTOCOL_V1 = 1;
+constexpr uint8_t PROTOCOL_V2 = 2;
+constexpr uint8_t PROTOCOL_LATEST = PROTOCOL_V2;
+
+// Flags on a V2 message.
+// The message has a nonzero ID, which follows its size.
+constexpr uint8_t FLAG_ID = 1 << 0;
+// The message's body is compressed (see common/compression.hpp): it's the
+// size of the original body as a varint, then the compressed block.
+constexpr uint8_t FLAG_COMPRESSED = 1 << 1;
+
+// On connections where both ends agreed to it in their hellos, bodies at
+// least this big are sent compressed, if that makes them at least
+// 1/COMPRESS_MIN_SAVING smaller. Smaller ones go as they are, since a few bytes
+// saved aren't worth the time it takes to save them.
+constexpr size_t COMPRESS_MIN_SIZE = 1024;
+constexpr size_t COMPRESS_MIN_SAVING = 8;
+
+// Largest body, once decompressed, a message may have. A header claiming a
+// bigger one is malformed, so that a peer can't make us allocate whatever it
+// likes; a migration's batches, the biggest messages we send, stay far below.
+constexpr size_t MAX_MESSAGE_SIZE = size_t{256} << 20;
 
 struct Message {
   MessageType type;
+  // Chosen by the client for each request, and echoed back on the response to
+  // it, so that a client with several requests in flight on one connection
+  // can tell which response is which. 0 if the client doesn't care. Only
+  // carried from V2 on; on V1, it's always 0, and a connection's responses
+  // come back in the order of its requests.
+  uint32_t id = 0;
   size_t sz = 0;
   // NOTE: ideally, we wouldn't want memory allocation for every message, but it
   // might be unavoidable due to the variable sizes of strings/vectors :(
   std::vector<std::byte> buf;
+  // Where send_message compresses buf to, kept with the message so that one
+  // that's reused (e.g. a connection's) needs room for it only once.
+  std::vector<std::byte> packed;
 
   size_t size() {
     return sizeof(type) + sizeof(sz) + buf.size();
   }
 };
 
-// Generic send/receive message helper functions.
-bool send_message(int fd, Message* msg, milliseconds timeout = 400ms);
+// Generic send/receive message helper functions. send_message frames the
+// message according to version, compressing it if asked to, the version is V2
+// or later, and the message is big enough; recv_message only reads V1.
+bool send_message(int fd, Message* msg, uint8_t version = PROTOCOL_V1,
+                  bool compress = false, milliseconds timeout = 400ms);
 bool recv_message(int fd, Message* msg, milliseconds timeout = 400ms);
 
+/*
+ * Reads messages, framed as send_message sends them, off a socket through a
+ * buffer, so that a whole message (or several, if they've arrived) comes in
+ * with one recv rather than one for each part of its framing, and its body
+ * can be deserialized straight out of the buffer. Not thread-safe.
+ */
+class MessageReader {
+ public:
+  /*
+   * If a whole message is buffered, takes it, setting *type and *id, and
+   * pointing *body at its body (decompressed, if it was compressed), which
+   * stays valid until the next read or call to next. Otherwise, returns false,
+   * as it does from the first malformed message on.
+   */
+  bool next(MessageType* type, uint32_t* id, std::span<const std::byte>* body);
+
+  /*
+   * Waits for more of the next message, and reads as much of it (and any
+   * after it) as has arrived. Returns false if the other end has closed the
+   * connection, an error occurs, or a malformed message was read.
+   */
+  bool read_some(int fd);
+  /*
+   * For event loops: reads whatever has arrived so far without waiting for
+   * more. Returns false if the other end has closed the connection, an error
+   * occurs, or a malformed message was read; messages read before then can
+   * still be taken.
+   */
+  bool read_available(int fd);
+
+  // Reads messages framed according to version from here on.
+  void set_version(uint8_t version) {
+    this->version = version;
+  }
+  uint8_t get_version() const {
+    return this->version;
+  }
+  bool is_malformed() const {
+    return this->malformed;
+  }
+  // For a message that was framed fine, but that nothing after can be made
+  // sense of from (one of a type that doesn't belong, say): fails the reads,
+  // and takes no more messages, from here on.
+  void set_malformed() {
+    this->malformed = true;
+  }
+
+ private:
+  // Most bytes asked of each recv, unless a larger message is under way.
+  static constexpr size_t READ_SIZE = 4096;
+
+  // Bytes read, from pos on, that no message has been taken from yet.
+  std::vector<std::byte> buf;
+  size_t pos = 0;
+  uint8_t version = PROTOCOL_V1;
+  // Whether a header that couldn't be decoded (or a body that couldn't be
+  // decompressed) was read, after which nothing more can be; the reads fail
+  // from then on.
+  bool malformed = false;
+  // The body of the last message taken, if it was compressed.
+  std::vector<std::byte> unpacked;
+
+  // Drops bytes already taken, if that's worth the copy.
+  void compact();
+  // Points *body, a compressed body, at it decompressed into unpacked.
+  // Returns false if it's corrupt.
+  bool decompress(std::span<const std::byte>* body);
+};
+
 // define a generic Error response message.
 struct ErrorResponse {
   std::string msg;
@@ -56,23 +186,46 @@ struct ErrorResponse {
 
 using Request = std::variant<
     // Shardcontroller requests
-    JoinRequest, LeaveRequest, MoveRequest, QueryRequest,
+    JoinRequest, LeaveRequest, MoveRequest, QueryRequest, WatchRequest,
     // KvServer requests
     GetRequest, PutRequest, AppendRequest, DeleteRequest, MultiGetRequest,
-    MultiPutRequest>;
+    MultiPutRequest, ScanRequest, ListKeysRequest, TransferRequest>;
 using Response = std::variant<
     // Shardcontroller responses
-    JoinResponse, LeaveResponse, MoveResponse, QueryResponse,
+    JoinResponse, LeaveResponse, MoveResponse, QueryResponse, WatchResponse,
     // KvServer responses
     GetResponse, PutResponse, AppendResponse, DeleteResponse, MultiGetResponse,
-    MultiPutResponse,
+    MultiPutResponse, ScanResponse, ListKeysResponse, TransferResponse,
     // Error response
     ErrorResponse>;
 
-std::optional<Message> serialize_request(Request request);
-std::optional<Request> deserialize_request(Message message);
+// A HELLO message's body: the newest framing version the client supports and
+// whether it would like large messages compressed, or, in the server's answer,
+// the version both will use and whether they will.
+struct Hello {
+  uint8_t version;
+  bool compress;
+};
+bool serialize_hello(const Hello& hello, Message* msg);
+std::optional<Hello> deserialize_hello(std::span<const std::byte> body);
+
+std::optional<Message> serialize_request(const Request& request);
+std::optional<Request> deserialize_request(const Message& message);
+
+std::optional<Message> serialize_response(const Response& response);
+std::optional<Response> deserialize_response(const Message& message);
+
+// Same as above, except serializing into msg, reusing its buffer, and
+// deserializing from a message body wherever it is (e.g. in a MessageReader's
+// buffer), so that neither needs a buffer of its own for each message. A
+// type that isn't one of the requests' (or responses') deserializes to no
+// value, since it may be whatever a peer sent.
+bool serialize_request(const Request& request, Message* msg);
+std::optional<Request> deserialize_request(MessageType type,
+                                           std::span<const std::byte> body);
 
-std::optional<Message> serialize_response(Response response);
-std::optional<Response> deserialize_response(Message message);
+bool serialize_response(const Response& response, Message* msg);
+std::optional<Response> deserialize_response(MessageType type,
+                                             std::span<const std::byte> body);
 
 #endif /* end of include guard */
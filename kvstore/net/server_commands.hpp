@@ -1,6 +1,8 @@
 #ifndef NET_SERVER_COMMANDS_HPP
 #define NET_SERVER_COMMANDS_HPP
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <variant>
 #include <vector>
@@ -33,6 +35,33 @@ struct MultiPutRequest {
   std::vector<std::string> values;
 };
 
+// Asks for the pairs whose keys are in [start, end), ordered case-insensitively
+// (see key_less in kvstore/ordered_index.hpp). An empty end means no upper
+// bound, and a limit of 0 means no limit.
+struct ScanRequest {
+  std::string start;
+  std::string end;
+  size_t limit = 0;
+};
+
+// Asks for the next page of a walk over every key, starting from `cursor` (0
+// to start a walk). Pages hold about `limit` keys (0 means no limit).
+struct ListKeysRequest {
+  size_t cursor = 0;
+  size_t limit = 0;
+};
+
+// Hands pairs over from `server` to the server whose shards they're in, when
+// a config moves them there (see KvServer::process_config). `done` says that
+// `server` has handed over everything it held of the receiver's shards as of
+// the config with `epoch`, so the receiver can start serving them.
+struct TransferRequest {
+  std::string server;
+  uint64_t epoch = 0;
+  MultiPutRequest pairs;
+  bool done = false;
+};
+
 // Responses
 struct GetResponse {
   std::string value;
@@ -47,5 +76,16 @@ struct MultiGetResponse {
   std::vector<std::string> values;
 };
 struct MultiPutResponse {};
+// Pairs in ascending key order.
+struct ScanResponse {
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+};
+// `cursor` continues the walk, and is 0 once it's over.
+struct ListKeysResponse {
+  std::vector<std::string> keys;
+  size_t cursor = 0;
+};
+struct TransferResponse {};
 
 #endif /* end of include guard */
@@ -1,6 +1,9 @@
 #ifndef NET_SHARDCONTROLLER_COMMANDS_HPP
 #define NET_SHARDCONTROLLER_COMMANDS_HPP
 
+#include <chrono>
+#include <cstdint>
+#include <map>
 #include <optional>
 #include <string>
 #include <vector>
@@ -20,6 +23,12 @@ struct MoveRequest {
   std::vector<Shard> shards;
 };
 struct QueryRequest {};
+// Asks for the config once its epoch is past since_epoch, rather than as it is
+// now: the shardcontroller holds the request until the config changes, or for
+// at most WATCH_TIMEOUT, then answers with the config as it is then.
+struct WatchRequest {
+  uint64_t since_epoch;
+};
 
 // Responses
 struct JoinResponse {};
@@ -27,6 +36,18 @@ struct LeaveResponse {};
 struct MoveResponse {};
 struct QueryResponse {
   ShardControllerConfig config;
+  // The shards each server had in the config just before this one, so that
+  // servers agree on which of them hand what over to whom when shards move.
+  // A shardcontroller from before it sent these sends none.
+  std::optional<std::map<std::string, std::vector<Shard>>> previous;
+};
+struct WatchResponse {
+  ShardControllerConfig config;
 };
 
+// Longest the shardcontroller holds a Watch for, so that watchers still hear
+// from it now and then when the config doesn't change, and can tell it's
+// alive.
+constexpr std::chrono::seconds WATCH_TIMEOUT{5};
+
 #endif /* end of include guard */
@@ -3,10 +3,80 @@
 int KvServer::start() {
   this->is_stopped = false;
 
-  // Initialize KvStore
-  // TODO (Part B, Step 2): Change your underlying KvStore to the
-  // ConcurrentKvStore!
-  this->store = std::make_unique<SimpleKvStore>();
+  // Initialize KvStore. A sharded server keeps a store per partition (see
+  // ShardedKvStore), so size each for its share of the keys.
+  bool sharded = !this->shardcontroller_address.empty();
+  std::function<std::unique_ptr<KvStore>()> make_store;
+  switch (this->store_type) {
+    case StoreType::EPOCH: {
+      size_t n_buckets = EpochKvStore::DEFAULT_BUCKET_COUNT;
+      if (sharded) n_buckets /= 32;
+      make_store = [n_buckets] {
+        return std::make_unique<EpochKvStore>(std::hash<std::string>(),
+                                              n_buckets);
+      };
+      break;
+    }
+    case StoreType::CONCURRENT:
+    default:
+      // A sharded server scans the ranges of shards it no longer owns when
+      // its config changes, so keep its keys in order.
+      make_store = [sharded] {
+        return std::make_unique<ConcurrentKvStore>(
+            nullptr, DbMap::DEFAULT_STRIPE_COUNT, sharded);
+      };
+      break;
+  }
+  if (sharded) {
+    auto sharded_store = std::make_unique<ShardedKvStore>(make_store);
+    this->sharded_store = sharded_store.get();
+    this->store = std::move(sharded_store);
+  } else if (!this->wal_options.path.empty()) {
+    // A ConcurrentKvStore is opened as one, so that it can be snapshotted
+    if (this->store_type == StoreType::CONCURRENT) {
+      this->store = LoggedKvStore::open(std::make_unique<ConcurrentKvStore>(),
+                                        this->wal_options);
+    } else {
+      this->store = LoggedKvStore::open(make_store(), this->wal_options);
+    }
+    if (!this->store) {
+      cerr_color(RED, "Failed to open write-ahead log at ",
+                 this->wal_options.path);
+      return -1;
+    }
+  } else {
+    this->store = make_store();
+  }
+
+  // Create each worker's queues, its epoll instance, and the eventfd that
+  // wakes it up
+  this->conn_queues.resize(this->n_workers);
+  this->closed_queues.resize(this->n_workers);
+  this->conn_queue_mtxs.resize(this->n_workers);
+  this->sessions.resize(this->n_workers);
+  this->run_queues.resize(this->n_workers);
+  this->idle_workers.resize(this->n_workers);
+  this->epoll_fds.resize(this->n_workers);
+  this->wake_fds.resize(this->n_workers);
+  for (size_t i = 0; i < this->n_workers; i++) {
+    this->run_queues[i] = std::make_unique<WorkStealingDeque<Session*>>();
+    this->epoll_fds[i] = epoll_create1(EPOLL_CLOEXEC);
+    this->wake_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->epoll_fds[i] < 0 || this->wake_fds[i] < 0) {
+      perror_color(RED, "epoll_create1/eventfd");
+      return -1;
+    }
+    // Sessions are registered by address, so the eventfd is registered as
+    // nullptr.
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(this->epoll_fds[i], EPOLL_CTL_ADD, this->wake_fds[i], &ev) <
+        0) {
+      perror_color(RED, "epoll_ctl");
+      return -1;
+    }
+  }
 
   // Create listener socket, and start client listener
   this->listener_fd = open_listener_socket(address);
@@ -18,8 +88,6 @@ int KvServer::start() {
 
   // Initialize worker threads
   this->workers.resize(this->n_workers);
-  this->conn_queues.resize(this->n_workers);
-  this->conn_queue_mtxs.resize(this->n_workers);
   size_t i = 0;
   for (auto&& worker : this->workers) {
     worker = std::thread(&KvServer::work_loop, this, i);
@@ -43,9 +111,19 @@ int KvServer::start() {
       return -1;
     }
 
-    // TODO (Part B, Step 2): Send a join request to the shardcontroller
-    // Take a look at the functions provided in this file to see if any of them
-    // will help you!
+    this->shardcontroller_watcher_conn =
+        connect_to_server(this->shardcontroller_address);
+    if (!this->shardcontroller_watcher_conn) {
+      close(this->listener_fd);
+      return -1;
+    }
+
+    if (!this->Join()) {
+      cerr_color(RED, "Failed to join shardcontroller at ",
+                 this->shardcontroller_address);
+      close(this->listener_fd);
+      return -1;
+    }
 
     this->shardcontroller_querier =
         std::thread(&KvServer::process_config_loop, this);
@@ -63,25 +141,37 @@ void KvServer::stop() {
   cout_color(BLUE, "Joining client listener thread...");
   this->client_listener.join();
 
-  // Stop connection queue, and close & join workers
+  // Wake & join workers, then close every connection. Sessions are only
+  // dropped once every worker has stopped, since any of them may have been
+  // serving any session.
+  for (size_t i = 0; i < this->n_workers; i++) this->wake_worker(i);
+  for (auto&& thr : this->workers) thr.join();
   for (size_t i = 0; i < this->n_workers; i++) {
-    auto& queue = this->conn_queues[i];
-    this->conn_queue_mtxs[i].lock();
-    for (auto&& client : queue) {
+    for (auto&& [ptr, session] : this->sessions[i]) {
+      cout_color(BLUE, "Closing connection from ", session->conn->address);
+      session->conn->close();
+    }
+    this->sessions[i].clear();
+    this->closed_queues[i].clear();
+    for (auto&& client : this->conn_queues[i]) {
       cout_color(BLUE, "Closing connection from ", client->address);
-      client->shutdown();
+      client->close();
     }
-    this->conn_queue_mtxs[i].unlock();
+    this->conn_queues[i].clear();
+    close(this->epoll_fds[i]);
+    close(this->wake_fds[i]);
   }
-  for (auto&& thr : this->workers) thr.join();
 
   // If shardcontroller exists, tell shardcontroller the server is leaving,
   // join shardcontroller querier thread, and close shardcontroller connection
   if (!this->shardcontroller_address.empty()) {
-    // TODO (Part B, Step 2): Send a leave request to the shardcontroller
-    // Take a look at the functions provided in this file to see if any of them
-    // will help you!
+    if (!this->Leave()) {
+      cerr_color(RED, "Failed to leave shardcontroller at ",
+                 this->shardcontroller_address);
+    }
 
+    // In case the Leave didn't wake the querier's Watch
+    this->shardcontroller_watcher_conn->shutdown();
     cout_color(BLUE, "Joining query shardcontroller thread...");
     this->shardcontroller_querier.join();
     this->shardcontroller_conn->shutdown();
@@ -133,57 +223,264 @@ std::optional<QueryResponse> KvServer::query_shardcontroller(
   return *query_res;
 }
 
-bool KvServer::process_config() {
-  // TODO (Part B, Step 2): Implement!
+bool KvServer::watch_shardcontroller(uint64_t since_epoch) {
+  WatchRequest req{since_epoch};
+  if (!this->shardcontroller_watcher_conn->send_request(req)) {
+    return false;
+  }
+  auto res = this->shardcontroller_watcher_conn->recv_response();
+  return res && std::get_if<WatchResponse>(&*res);
+}
 
-  std::unique_lock lock(this->config_mtx);
+bool KvServer::process_config() {
+  // One migration at a time; requests don't wait on this, only on the brief
+  // config update below.
+  std::unique_lock migration_lock(this->migration_mtx);
 
+  // Query before taking config_mtx, so that requests don't wait on the round
+  // trip.
   auto res = this->query_shardcontroller(this->shardcontroller_querier_conn);
   if (!res) {
     cerr_color(RED, "Failed to receive query response from shardcontroller.");
     return false;
   }
+  uint64_t epoch = res->config.epoch;
+  // Everything's been handed over for this config already. (A shardcontroller
+  // without epochs always sends 0, so can't tell.)
+  if (epoch != 0 && epoch == this->migrated_epoch) return true;
+  if (epoch != this->transfer_epoch) {
+    this->transfer_epoch = epoch;
+    this->transferred.clear();
+  }
 
-  // TODO: Update this->config to reflect the result from querying the
-  // shardcontroller
-
-  // to_transfer maps server --> [<vector of keys to transfer to server>,
-  // <vector of values to transfer to server>]
-  // You're free to use a different data structure if you'd
-  // like, although note you'll have to change our transferring code if you do
-  std::map<std::string, std::array<std::vector<std::string>, 2>> to_transfer;
-
-  // TODO:
-  //  1. Get all of the server's key-value pairs (which KvStore functions might
-  //  help you with this?)
-  //  2. For each pair, check if the server is still responsible for it.
-  //  If the server is no longer responsible for the pair,
-  //  add the pair to_transfer under the key of the newly-responsible (i.e.,
-  //  destination) server and delete the pair from this server's store.
-
-  // NOTE: Comment this in to transfer the keys!
-  // // for each server responsible for moved keys:
-  // for (auto&& [s, responsible_pairs] : to_transfer) {
-  //     while (true) {
-  //         // connect to server
-  //         std::shared_ptr<ServerConn> conn = connect_to_server(s);
-  //         if (!conn) {
-  //             cerr_color(RED, "Failed to connect to server ", s);
-  //             continue;
-  //         }
-  //         // make MultiPut request
-  //         MultiPutRequest req{responsible_pairs[0], responsible_pairs[1]};
-  //         if (!conn->send_request(req)) continue;
-
-  //         // receive response, and check for success
-  //         std::optional<Response> res = conn->recv_response();
-  //         if (!res) continue;
-  //         if (std::get_if<ErrorResponse>(&*res)) continue;
-  //         break;
-  //     }
-  // }
+  // Any pairs this server still holds in another server's shards have to move
+  // there. Scanning just those shards' ranges avoids visiting every key in the
+  // store, most of which usually stay put.
+  std::map<std::string, std::vector<Shard>> to_transfer;
+  {
+    // Taking this waits for requests under way to finish; from here on, keys
+    // in shards that moved away are rejected, so no more writes land on the
+    // pairs being transferred.
+    std::unique_lock lock(this->config_mtx);
+    if (epoch != this->config.epoch) {
+      auto hold = [&](const std::map<std::string, std::vector<Shard>>& map) {
+        auto mine = map.find(this->address);
+        if (mine == map.end()) return;
+        for (auto&& shard : mine->second) {
+          if (std::find(this->held_shards.begin(), this->held_shards.end(),
+                        shard) == this->held_shards.end()) {
+            this->held_shards.push_back(shard);
+          }
+        }
+      };
+      hold(this->config.server_to_shards);
+      if (res->previous) hold(*res->previous);
+    }
+    this->update_arriving(res->config, res->previous);
+    this->config = res->config;
+    this->shard_table = ShardTable(this->config);
+    this->prune_arriving();
+    for (auto&& [server, shards] : this->config.server_to_shards) {
+      if (server == this->address || shards.empty() ||
+          this->transferred.contains(server)) {
+        continue;
+      }
+      // Only servers given some of what this server had can be waiting on it.
+      // Without the previous config, there's no telling who had what.
+      bool had_any = !res->previous;
+      for (auto&& shard : shards) {
+        for (auto&& held : this->held_shards) {
+          if (get_overlap(shard, held) != OverlapStatus::NO_OVERLAP) {
+            had_any = true;
+          }
+        }
+      }
+      if (had_any) to_transfer[server] = shards;
+    }
+  }
 
-  return true;
+  // Transfers to s everything this server holds of its shards, then tells s
+  // it's done, returning whether s took it all. The destination may not have
+  // picked up its new shards yet, in which case we try again next time,
+  // picking up from what's still here.
+  auto transfer_to = [&](const std::string& s,
+                         const std::vector<Shard>& shards) {
+    std::shared_ptr<ServerConn> conn;
+    // Sends s a TransferRequest, connecting the first time, and compressing
+    // the transfer, which may be large.
+    auto send_transfer = [&](const TransferRequest& req) {
+      if (!conn) conn = connect_to_server(s, PROTOCOL_LATEST, true);
+      if (!conn) {
+        cerr_color(RED, "Failed to connect to server ", s);
+        return false;
+      }
+      if (!conn->send_request(req)) return false;
+      std::optional<Response> res = conn->recv_response();
+      return res && !std::get_if<ErrorResponse>(&*res);
+    };
+
+    for (auto&& shard : shards) {
+      // Partitions the shard covers whole are streamed to s, then dropped at
+      // once, rather than a pair at a time.
+      std::vector<size_t> partitions;
+      if (this->sharded_store) {
+        partitions = ShardedKvStore::partitionsWithin(shard);
+      }
+      for (size_t p : partitions) {
+        ListKeysRequest list_req{0, MIGRATION_CHUNK_SIZE};
+        do {
+          if (this->is_stopped) return false;
+          ListKeysResponse list_res;
+          if (!this->sharded_store->listPartition(p, &list_req, &list_res)) {
+            return false;
+          }
+          list_req.cursor = list_res.cursor;
+          if (list_res.keys.empty()) continue;
+
+          MultiGetRequest get_req{std::move(list_res.keys)};
+          MultiGetResponse get_res;
+          if (!this->store->MultiGet(&get_req, &get_res)) return false;
+          TransferRequest req{
+              this->address,
+              epoch,
+              {std::move(get_req.keys), std::move(get_res.values)}};
+          if (!send_transfer(req)) return false;
+        } while (list_req.cursor != 0);
+        // Only drop the pairs once the destination has them all. Nothing
+        // writes to them since the config swap, which waited out requests
+        // under way; the drop waits out any other writes itself.
+        this->sharded_store->dropPartition(p);
+      }
+
+      // What's left of the shard is in partitions it only covers part of.
+      auto [start, end] = shard.key_range();
+      ScanRequest scan_req{start, end, MIGRATION_CHUNK_SIZE};
+      while (!this->is_stopped) {
+        ScanResponse scan_res;
+        if (!this->store->Scan(&scan_req, &scan_res)) return false;
+        if (scan_res.keys.empty()) break;
+
+        TransferRequest req{
+            this->address,
+            epoch,
+            {std::move(scan_res.keys), std::move(scan_res.values)}};
+        if (!send_transfer(req)) return false;
+
+        // Only drop the pairs once the destination has them.
+        const std::vector<std::string>& keys = req.pairs.keys;
+        for (auto&& key : keys) {
+          DeleteRequest delete_req{key};
+          DeleteResponse delete_res;
+          this->store->Delete(&delete_req, &delete_res);
+        }
+        if (keys.size() < MIGRATION_CHUNK_SIZE) break;
+        // The rest of the shard's keys come after the last one sent.
+        scan_req.start = keys.back();
+      }
+    }
+
+    // Let s start serving whatever it was waiting on this server for.
+    if (this->is_stopped) return false;
+    TransferRequest done_req{this->address, epoch, {}, true};
+    return send_transfer(done_req);
+  };
+
+  // Transfer the pairs a chunk at a time, without holding config_mtx, so that
+  // requests for keys that didn't move are served throughout. A destination
+  // that can't be reached holds up only its own handover.
+  bool all_transferred = true;
+  for (auto&& [s, shards] : to_transfer) {
+    if (this->is_stopped) return false;
+    if (transfer_to(s, shards)) {
+      this->transferred.insert(s);
+    } else {
+      all_transferred = false;
+    }
+  }
+  if (!all_transferred) return false;
+
+  this->migrated_epoch = epoch;
+  this->held_shards.clear();
+  return !this->is_stopped;
+}
+
+void KvServer::update_arriving(
+    const ShardControllerConfig& next,
+    const std::optional<std::map<std::string, std::vector<Shard>>>& previous) {
+  // Who had what just before next; without word from the shardcontroller, the
+  // best guess is the config this server had.
+  const std::map<std::string, std::vector<Shard>>& before =
+      previous ? *previous : this->config.server_to_shards;
+  std::vector<std::pair<Shard, std::map<std::string, uint64_t>>> arriving;
+  auto mine = next.server_to_shards.find(this->address);
+  if (mine != next.server_to_shards.end()) {
+    for (auto&& shard : mine->second) {
+      std::map<std::string, uint64_t> awaited;
+      // Whatever it was already waiting on is still owed as of the config it
+      // was owed for, however many configs ago that was.
+      for (auto&& [other, servers] : this->arriving) {
+        if (get_overlap(shard, other) != OverlapStatus::NO_OVERLAP) {
+          for (auto&& [server, epoch] : servers) {
+            uint64_t& owed = awaited[server];
+            owed = std::max(owed, epoch);
+          }
+        }
+      }
+      for (auto&& [server, shards] : before) {
+        if (server == this->address) continue;
+        for (auto&& other : shards) {
+          if (get_overlap(shard, other) != OverlapStatus::NO_OVERLAP) {
+            awaited[server] = next.epoch;
+          }
+        }
+      }
+      // With no config before this one, anyone might have some of it.
+      if (!previous && this->config.server_to_shards.empty()) {
+        for (auto&& [server, shards] : next.server_to_shards) {
+          if (server != this->address) awaited[server] = next.epoch;
+        }
+      }
+      // Servers that have left won't hand anything over.
+      std::erase_if(awaited, [&](const auto& entry) {
+        return !next.server_to_shards.contains(entry.first);
+      });
+      if (!awaited.empty()) arriving.emplace_back(shard, std::move(awaited));
+    }
+  }
+  this->arriving = std::move(arriving);
+}
+
+void KvServer::prune_arriving() {
+  std::erase_if(this->arriving, [&](auto& entry) {
+    std::erase_if(entry.second, [&](const auto& awaited) {
+      auto it = this->handed_over.find(awaited.first);
+      return it != this->handed_over.end() && it->second >= awaited.second;
+    });
+    return entry.second.empty();
+  });
+}
+
+Response KvServer::receive_transfer(TransferRequest* req) {
+  {
+    // Otherwise, the sender picked up the config first, and will try again.
+    std::shared_lock lock(this->config_mtx);
+    if (!this->responsible_for(req->pairs.keys)) {
+      return ErrorResponse{std::string("server not responsible for key(s)")};
+    }
+    MultiPutResponse put_res;
+    if (!req->pairs.keys.empty() &&
+        !this->store->MultiPut(&req->pairs, &put_res)) {
+      return ErrorResponse{std::string("internal KVStore error")};
+    }
+  }
+
+  if (req->done) {
+    std::unique_lock lock(this->config_mtx);
+    uint64_t& epoch = this->handed_over[req->server];
+    epoch = std::max(epoch, req->epoch);
+    this->prune_arriving();
+  }
+  return TransferResponse{};
 }
 
 /* ==================================================*/
@@ -193,7 +490,7 @@ bool KvServer::process_config() {
 void KvServer::accept_clients_loop() {
   size_t next_worker = 0;
   // While the server is not stopped, accept clients from the listener socket,
-  // then add them to the work queue.
+  // then hand them to the workers in turn.
   while (!this->is_stopped.load()) {
     std::shared_ptr<ClientConn> client = accept_client(this->listener_fd);
     if (!client) {
@@ -204,42 +501,214 @@ void KvServer::accept_clients_loop() {
     this->conn_queue_mtxs[next_worker].lock();
     this->conn_queues[next_worker].push_back(client);
     this->conn_queue_mtxs[next_worker].unlock();
+    this->wake_worker(next_worker);
     next_worker = (next_worker + 1) % this->n_workers;
   }
 }
 
+void KvServer::wake_worker(size_t worker_id) {
+  uint64_t one = 1;
+  if (write(this->wake_fds[worker_id], &one, sizeof(one)) < 0 &&
+      errno != EAGAIN) {
+    perror_color(RED, "write");
+  }
+}
+
 void KvServer::work_loop(size_t worker_id) {
-  // Each worker thread will run this function. While the server is not stopped,
-  // pop an accepted connection off of the work queue, and process client
-  // requests until the client closes the connection.
+  // Each worker thread will run this function. The worker waits on all of
+  // its clients at once: epoll reports which have sent something, so idle
+  // clients cost nothing. Those that have are queued on the worker's run
+  // queue, and served a turn at a time, so no one client can keep the worker
+  // from the others; and whatever the worker can't get to, idle workers steal.
+  auto& run_queue = *this->run_queues[worker_id];
+
   while (!this->is_stopped) {
-    std::shared_ptr<ClientConn> client;
-    // if this returns false, queue stopped
-    this->conn_queue_mtxs[worker_id].lock();
-    if (!this->conn_queues[worker_id].empty()) {
-      client = this->conn_queues[worker_id].front();
-      this->conn_queues[worker_id].pop_front();
-      this->conn_queue_mtxs[worker_id].unlock();
-    } else {
-      this->conn_queue_mtxs[worker_id].unlock();
+    // Only sleep if there's nothing to do here or elsewhere. Announce that
+    // this worker is idle before looking elsewhere, so that a worker queuing
+    // work after we've looked sees that it should wake us.
+    int timeout = 0;
+    if (run_queue.empty()) {
+      this->idle_workers[worker_id] = true;
+      if (std::optional<Session*> stolen = this->steal_session(worker_id)) {
+        this->idle_workers[worker_id] = false;
+        this->run_session(worker_id, *stolen);
+        continue;
+      }
+      timeout = -1;
+    }
+    if (!this->poll_sessions(worker_id, timeout)) break;
+
+    this->share_work(worker_id);
+    // Oldest first, as thieves take them, so that a client whose turn ran out
+    // goes behind the others that were queued while it was being served.
+    if (std::optional<Session*> session = run_queue.steal()) {
+      this->run_session(worker_id, *session);
+    }
+  }
+}
+
+bool KvServer::poll_sessions(size_t worker_id, int timeout) {
+  int epoll_fd = this->epoll_fds[worker_id];
+  int wake_fd = this->wake_fds[worker_id];
+  auto& run_queue = *this->run_queues[worker_id];
+  auto& sessions = this->sessions[worker_id];
+  std::array<epoll_event, MAX_EPOLL_EVENTS> events;
+
+  int n = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+  this->idle_workers[worker_id] = false;
+  if (n < 0) {
+    if (errno == EINTR) return true;
+    perror_color(RED, "epoll_wait");
+    return false;
+  }
+
+  bool woken = false;
+  for (int i = 0; i < n; i++) {
+    auto* session = static_cast<Session*>(events[i].data.ptr);
+    if (!session) {
+      woken = true;
       continue;
     }
 
+    // Queue the session unless it's already queued or being served; if
+    // it's being served, whoever is serving it must read from it again.
+    SessionState state = session->state;
     while (true) {
-      std::optional<Request> req = client->recv_request();
-      if (!req) {
-        client->close();
+      if (state == SessionState::IDLE) {
+        if (session->state.compare_exchange_weak(state,
+                                                 SessionState::QUEUED)) {
+          run_queue.push(session);
+          break;
+        }
+      } else if (state == SessionState::RUNNING) {
+        if (session->state.compare_exchange_weak(state,
+                                                 SessionState::NOTIFIED)) {
+          break;
+        }
+      } else {
         break;
       }
-      Response res = this->process_request(*req);
-      if (auto* error_res = std::get_if<ErrorResponse>(&res)) {
-        cerr_color(RED, "Request on server ", this->address,
-                   " failed: ", error_res->msg);
-      }
-      if (!client->send_response(res)) {
+    }
+  }
+
+  // Woken up: either stopping, or there are new clients to take on or
+  // closed ones to drop. Closed sessions are only dropped after the rest
+  // of the batch is handled, as it may still mention them.
+  if (woken) {
+    uint64_t count;
+    while (read(wake_fd, &count, sizeof(count)) > 0) {
+    }
+    std::deque<std::shared_ptr<ClientConn>> new_clients;
+    std::vector<Session*> closed;
+    this->conn_queue_mtxs[worker_id].lock();
+    new_clients.swap(this->conn_queues[worker_id]);
+    closed.swap(this->closed_queues[worker_id]);
+    this->conn_queue_mtxs[worker_id].unlock();
+
+    for (Session* session : closed) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->conn->fd, nullptr);
+      session->conn->close();
+      sessions.erase(session);
+    }
+
+    for (auto&& client : new_clients) {
+      auto session = std::make_unique<Session>();
+      session->conn = client;
+      session->owner = worker_id;
+      // Edge-triggered, so serve_client must read everything that's arrived
+      // each time. Adding the socket reports any requests already waiting.
+      epoll_event ev{};
+      ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+      ev.data.ptr = session.get();
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) < 0) {
+        perror_color(RED, "epoll_ctl");
         client->close();
-        break;
+        continue;
       }
+      Session* ptr = session.get();
+      sessions[ptr] = std::move(session);
+    }
+  }
+  return true;
+}
+
+void KvServer::run_session(size_t worker_id, Session* session) {
+  session->state = SessionState::RUNNING;
+  bool more = false;
+  if (!this->serve_client(worker_id, *session->conn, &more)) {
+    // Only the owner may drop the session, as it may still be handling an
+    // event for it.
+    session->state = SessionState::CLOSED;
+    this->conn_queue_mtxs[session->owner].lock();
+    this->closed_queues[session->owner].push_back(session);
+    this->conn_queue_mtxs[session->owner].unlock();
+    this->wake_worker(session->owner);
+    return;
+  }
+
+  SessionState running = SessionState::RUNNING;
+  if (more ||
+      !session->state.compare_exchange_strong(running, SessionState::IDLE)) {
+    // Either its turn ran out, or the client sent more while it was being
+    // served; queue it here, where it's likely still in cache.
+    session->state = SessionState::QUEUED;
+    this->run_queues[worker_id]->push(session);
+  }
+}
+
+bool KvServer::serve_client(size_t worker_id, ClientConn& client,
+                            bool* more) {
+  bool connected = client.recv_buffered();
+  auto last_poll = steady_clock::now();
+  for (size_t served = 0;; served++) {
+    // Until the worker gets back to epoll_wait, its other clients' requests
+    // go unseen, and so can't be stolen; a turn of slow requests would leave
+    // them all waiting on it.
+    if (steady_clock::now() - last_poll >= SESSION_POLL_INTERVAL) {
+      this->poll_sessions(worker_id, 0);
+      this->share_work(worker_id, true);
+      last_poll = steady_clock::now();
+    }
+
+    // Once the client has disconnected, there's no coming back to it, so
+    // answer everything it sent.
+    if (connected && served == MAX_REQUESTS_PER_TURN) {
+      *more = true;
+      return true;
+    }
+    uint32_t id = 0;
+    std::optional<Request> req = client.pop_request(&id);
+    if (!req) break;
+
+    Response res = this->process_request(*req);
+    if (auto* error_res = std::get_if<ErrorResponse>(&res)) {
+      cerr_color(RED, "Request on server ", this->address,
+                 " failed: ", error_res->msg);
+    }
+    if (!client.send_response(res, id)) return false;
+  }
+  return connected;
+}
+
+std::optional<KvServer::Session*> KvServer::steal_session(size_t worker_id) {
+  for (size_t i = 1; i < this->n_workers; i++) {
+    size_t victim = (worker_id + i) % this->n_workers;
+    if (std::optional<Session*> session = this->run_queues[victim]->steal()) {
+      return session;
+    }
+  }
+  return std::nullopt;
+}
+
+void KvServer::share_work(size_t worker_id, bool busy) {
+  // Unless it's busy, the worker will serve the session it pops next itself;
+  // anything beyond that is up for grabs.
+  if (this->run_queues[worker_id]->size() < (busy ? 1 : 2)) return;
+  for (size_t i = 1; i < this->n_workers; i++) {
+    size_t other = (worker_id + i) % this->n_workers;
+    if (this->idle_workers[other].exchange(false)) {
+      this->wake_worker(other);
+      return;
     }
   }
 }
@@ -248,87 +717,137 @@ bool KvServer::responsible_for(const std::string& key) {
   // For Concurrent Store, no shardcontroller exists, so no-op
   if (this->shardcontroller_address.empty()) return true;
 
-  std::shared_lock lock(this->config_mtx);
-  auto server = this->config.get_server(key);
-  if (!server) return false;
-  return *server == this->address;
+  const std::string* server = this->shard_table.get_server(key);
+  return server && *server == this->address;
 }
 
 bool KvServer::responsible_for(const std::vector<std::string>& keys) {
   // For Concurrent Store, no shardcontroller exists, so no-op
   if (this->shardcontroller_address.empty()) return true;
 
-  std::shared_lock lock(this->config_mtx);
   for (auto&& k : keys) {
-    auto server = this->config.get_server(k);
-    if (!server) return false;
-    if (*server != this->address) return false;
+    const std::string* server = this->shard_table.get_server(k);
+    if (!server || *server != this->address) return false;
   }
   return true;
 }
 
+std::optional<ErrorResponse> KvServer::refusal_for(const std::string& key) {
+  if (!this->responsible_for(key)) {
+    return ErrorResponse{std::string("server not responsible for key")};
+  }
+  for (auto&& [shard, servers] : this->arriving) {
+    if (shard_contains(shard, key)) {
+      return ErrorResponse{std::string("shard still moving to server")};
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<ErrorResponse> KvServer::refusal_for(
+    const std::vector<std::string>& keys) {
+  if (!this->responsible_for(keys)) {
+    return ErrorResponse{std::string("server not responsible for key(s)")};
+  }
+  for (auto&& [shard, servers] : this->arriving) {
+    for (auto&& k : keys) {
+      if (shard_contains(shard, k)) {
+        return ErrorResponse{std::string("shard still moving to server")};
+      }
+    }
+  }
+  return std::nullopt;
+}
+
 Response KvServer::process_request(Request req) {
+  if (auto* transfer_req = std::get_if<TransferRequest>(&req)) {
+    return this->receive_transfer(transfer_req);
+  }
+
+  // Hold the config from checking the request's keys against it until the
+  // store is done with them (see config_mtx).
+  std::shared_lock config_lock(this->config_mtx, std::defer_lock);
+  if (!this->shardcontroller_address.empty()) config_lock.lock();
+
   Response res;
   if (auto* get_req = std::get_if<GetRequest>(&req)) {
-    bool responsible = this->responsible_for(get_req->key);
+    std::optional<ErrorResponse> refusal = this->refusal_for(get_req->key);
     GetResponse get_res;
-    if (responsible && this->store->Get(get_req, &get_res)) {
+    if (refusal) {
+      res = *refusal;
+    } else if (this->store->Get(get_req, &get_res)) {
       res = get_res;
     } else {
-      res = ErrorResponse{
-          !responsible ? std::string("server not responsible for key")
-                       : std::string("key does not exist in the KVStore")};
+      res = ErrorResponse{std::string("key does not exist in the KVStore")};
     }
   } else if (auto* put_req = std::get_if<PutRequest>(&req)) {
-    bool responsible = this->responsible_for(put_req->key);
+    std::optional<ErrorResponse> refusal = this->refusal_for(put_req->key);
     PutResponse put_res;
-    if (responsible && this->store->Put(put_req, &put_res)) {
+    if (refusal) {
+      res = *refusal;
+    } else if (this->store->Put(put_req, &put_res)) {
       res = put_res;
     } else {
       // Put should never fail
-      res = ErrorResponse{!responsible
-                              ? std::string("server not responsible for key")
-                              : std::string("internal KVStore error")};
+      res = ErrorResponse{std::string("internal KVStore error")};
     }
   } else if (auto* append_req = std::get_if<AppendRequest>(&req)) {
-    bool responsible = this->responsible_for(append_req->key);
+    std::optional<ErrorResponse> refusal = this->refusal_for(append_req->key);
     AppendResponse append_res;
-    if (responsible && this->store->Append(append_req, &append_res)) {
+    if (refusal) {
+      res = *refusal;
+    } else if (this->store->Append(append_req, &append_res)) {
       res = append_res;
     } else {
-      res = ErrorResponse{!responsible
-                              ? std::string("server not responsible for key")
-                              : std::string("internal KVStore error")};
+      res = ErrorResponse{std::string("internal KVStore error")};
     }
   } else if (auto* delete_req = std::get_if<DeleteRequest>(&req)) {
-    bool responsible = this->responsible_for(delete_req->key);
+    std::optional<ErrorResponse> refusal = this->refusal_for(delete_req->key);
     DeleteResponse delete_res;
-    if (responsible && this->store->Delete(delete_req, &delete_res)) {
+    if (refusal) {
+      res = *refusal;
+    } else if (this->store->Delete(delete_req, &delete_res)) {
       res = delete_res;
     } else {
-      res = ErrorResponse{
-          !responsible ? std::string("server not responsible for key")
-                       : std::string("key does not exist in the KVStore")};
+      res = ErrorResponse{std::string("key does not exist in the KVStore")};
     }
   } else if (auto* multiget_req = std::get_if<MultiGetRequest>(&req)) {
-    bool responsible = this->responsible_for(multiget_req->keys);
+    std::optional<ErrorResponse> refusal =
+        this->refusal_for(multiget_req->keys);
     MultiGetResponse multiget_res;
-    if (responsible && this->store->MultiGet(multiget_req, &multiget_res)) {
+    if (refusal) {
+      res = *refusal;
+    } else if (this->store->MultiGet(multiget_req, &multiget_res)) {
       res = multiget_res;
     } else {
-      res = ErrorResponse{
-          !responsible ? std::string("server not responsible for key(s)")
-                       : std::string("key(s) do not exist in the KVStore")};
+      res = ErrorResponse{std::string("key(s) do not exist in the KVStore")};
     }
   } else if (auto* multiput_req = std::get_if<MultiPutRequest>(&req)) {
-    bool responsible = this->responsible_for(multiput_req->keys);
+    std::optional<ErrorResponse> refusal =
+        this->refusal_for(multiput_req->keys);
     MultiPutResponse multiput_res;
-    if (responsible && this->store->MultiPut(multiput_req, &multiput_res)) {
+    if (refusal) {
+      res = *refusal;
+    } else if (this->store->MultiPut(multiput_req, &multiput_res)) {
       res = multiput_res;
     } else {
-      res = ErrorResponse{!responsible
-                              ? std::string("server not responsible for key(s)")
-                              : std::string("internal KVStore error")};
+      res = ErrorResponse{std::string("internal KVStore error")};
+    }
+  } else if (auto* scan_req = std::get_if<ScanRequest>(&req)) {
+    // A range can span several shards, so this returns whatever part of it
+    // the server holds rather than checking responsibility.
+    ScanResponse scan_res;
+    if (this->store->Scan(scan_req, &scan_res)) {
+      res = scan_res;
+    } else {
+      res = ErrorResponse{std::string("internal KVStore error")};
+    }
+  } else if (auto* list_req = std::get_if<ListKeysRequest>(&req)) {
+    ListKeysResponse list_res;
+    if (this->store->ListKeys(list_req, &list_res)) {
+      res = list_res;
+    } else {
+      res = ErrorResponse{std::string("internal KVStore error")};
     }
   } else {
     throw std::logic_error{"invalid variant!"};
@@ -338,14 +857,33 @@ Response KvServer::process_request(Request req) {
 
 void KvServer::process_config_loop() {
   int failure_count = 0;
+  // Which epoch's transfers process_config was on, and how many servers it
+  // had handed over to, when it last failed.
+  std::pair<uint64_t, size_t> progress;
   while (!this->is_stopped) {
     if (this->process_config()) {
       failure_count = 0;
+      // Rather than polling, wait to hear of the next config; then process it
+      // right away. If the Watch fails, fall back to polling.
+      uint64_t epoch = 0;
+      {
+        std::shared_lock lock(this->config_mtx);
+        epoch = this->config.epoch;
+      }
+      if (this->watch_shardcontroller(epoch)) continue;
     } else {
-      failure_count += 1;
       // process_config can fail if the destination server for a move hasn't
       // queried the shardcontroller yet so we tolerate some failures before
-      // breaking
+      // breaking; but only in a row, since one destination being slow or down
+      // doesn't hold up the others, which still need this server's config to
+      // be processed.
+      std::pair<uint64_t, size_t> now;
+      {
+        std::lock_guard lock(this->migration_mtx);
+        now = {this->transfer_epoch, this->transferred.size()};
+      }
+      failure_count = now != progress ? 0 : failure_count + 1;
+      progress = now;
       if (failure_count > 100) {
         break;
       }
@@ -359,16 +897,22 @@ ShardControllerConfig KvServer::get_config() {
 }
 
 std::map<std::string, std::string> KvServer::all_kvpairs() {
-  auto keys = this->store->AllKeys();
   std::map<std::string, std::string> map;
-  for (auto&& k : keys) {
-    auto req = GetRequest{k};
-    auto res = GetResponse{};
-    // Only add if key still exists
-    if (this->store->Get(&req, &res)) {
-      map[k] = res.value;
+  // Page through the keys rather than copying them all out at once.
+  ListKeysRequest list_req{0, KEYS_PAGE_SIZE};
+  do {
+    ListKeysResponse list_res;
+    if (!this->store->ListKeys(&list_req, &list_res)) break;
+    for (auto&& k : list_res.keys) {
+      auto req = GetRequest{k};
+      auto res = GetResponse{};
+      // Only add if key still exists
+      if (this->store->Get(&req, &res)) {
+        map[k] = res.value;
+      }
     }
-  }
+    list_req.cursor = list_res.cursor;
+  } while (list_req.cursor != 0);
 
   return map;
 }
@@ -1,39 +1,81 @@
 #ifndef KVSERVER_HPP
 #define KVSERVER_HPP
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <shared_mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 
 #include "kvstore/concurrent_kvstore.hpp"
+#include "kvstore/epoch_kvstore.hpp"
 #include "kvstore/kvstore.hpp"
+#include "kvstore/logged_kvstore.hpp"
+#include "kvstore/sharded_kvstore.hpp"
 #include "kvstore/simple_kvstore.hpp"
 #include "net/network_conn.hpp"
 #include "net/network_helpers.hpp"
 #include "net/network_messages.hpp"
+#include "server/work_stealing_deque.hpp"
 
 #define N_WORKERS 5
+// Maximum number of ready sockets a worker handles per epoll_wait.
+#define MAX_EPOLL_EVENTS 64
+// Maximum number of requests a worker processes from one client before giving
+// the worker's other clients a turn.
+#define MAX_REQUESTS_PER_TURN 16
+// How long a worker serves a client before checking whether its other clients
+// have sent anything, so that idle workers can steal them.
+constexpr std::chrono::microseconds SESSION_POLL_INTERVAL{100};
+// Number of keys all_kvpairs() asks the store for at a time.
+#define KEYS_PAGE_SIZE 1024
+// Most pairs process_config transfers to another server in one MultiPut.
+#define MIGRATION_CHUNK_SIZE 1024
 
 using namespace std::chrono;
 
+// Which KvStore implementation a KvServer keeps its key-value pairs in.
+//  - CONCURRENT: ConcurrentKvStore, a resizable table with per-stripe
+//    reader-writer locks.
+//  - EPOCH: EpochKvStore, whose reads never lock; suited to read-heavy
+//    workloads.
+enum class StoreType { CONCURRENT, EPOCH };
+
 class KvServer {
  public:
-  explicit KvServer(const std::string& address, uint64_t n_workers)
-      : address(address), shardcontroller_address(), n_workers(n_workers) {
+  // With wal.path set, the server logs every write there, and replays
+  // whatever is logged there already when it starts (see LoggedKvStore); with
+  // wal.snapshot_path set too, it restores the snapshot there first.
+  explicit KvServer(const std::string& address, uint64_t n_workers,
+                    StoreType store_type = StoreType::CONCURRENT,
+                    const WalOptions& wal = {})
+      : address(address),
+        shardcontroller_address(),
+        n_workers(n_workers),
+        store_type(store_type),
+        wal_options(wal) {
   }
   explicit KvServer(const std::string& address,
-                    const std::string& shardcontroller_addr, uint64_t n_workers)
+                    const std::string& shardcontroller_addr, uint64_t n_workers,
+                    StoreType store_type = StoreType::CONCURRENT)
       : address(address),
         shardcontroller_address(shardcontroller_addr),
-        n_workers(n_workers) {
+        n_workers(n_workers),
+        store_type(store_type) {
   }
   ~KvServer() {
     if (!this->is_stopped) {
@@ -77,16 +119,46 @@ class KvServer {
 
   // Internal key-value store.
   std::unique_ptr<KvStore> store;
+  // The same store, if the server is sharded, in which case it's partitioned
+  // so that shards can be handed off whole; nullptr otherwise.
+  ShardedKvStore* sharded_store = nullptr;
 
   // Persistent shardcontroller connection.
   std::shared_ptr<ServerConn> shardcontroller_conn;
 
-  // Shardcontroller configuration.
+  // Shardcontroller configuration, and the same compiled for looking up which
+  // server a key belongs to, as every request does.
   ShardControllerConfig config;
+  ShardTable shard_table;
 
-  // mutex to synchronize access to the config
+  // mutex to synchronize access to the config, and to what's arriving below.
+  // Requests hold it (shared) from checking their keys against the config
+  // until they're done with them, so that once process_config has taken it to
+  // change the config, none is still under way on a key that moved.
   std::shared_mutex config_mtx;
 
+  // Shards the config gave this server that other servers may still hold
+  // pairs in, each with the servers it's waiting on to hand those over, and
+  // the epoch as of which each has to have. Requests for their keys are
+  // turned away until every one of those has.
+  std::vector<std::pair<Shard, std::map<std::string, uint64_t>>> arriving;
+  // The epoch of the latest config as of which each server has handed over
+  // everything it held of this server's shards.
+  std::map<std::string, uint64_t> handed_over;
+
+  // Held by process_config throughout, so that one call's transfers don't
+  // race another's.
+  std::mutex migration_mtx;
+  // The epoch of the last config process_config finished moving pairs for.
+  uint64_t migrated_epoch = 0;
+  // This server's shards under every config since then, which it may still
+  // hold pairs in.
+  std::vector<Shard> held_shards;
+  // The servers process_config has handed everything over to as of
+  // transfer_epoch, which it doesn't go back to while retrying the rest.
+  uint64_t transfer_epoch = 0;
+  std::set<std::string> transferred;
+
   // END of fields you need for process_config
 
   // An atomic, thread-safe boolean to denote whether the server has been
@@ -98,24 +170,73 @@ class KvServer {
   // Thread that listens for client connections and accepts them.
   std::thread client_listener;
 
-  // Thread that periodically queries the shardcontroller for the current
-  // configuration.
+  // Thread that queries the shardcontroller for the current configuration
+  // whenever it changes.
   std::thread shardcontroller_querier;  // bro this name goofy
   std::shared_ptr<ServerConn> shardcontroller_querier_conn;
+  // Connection the querier Watches the config on, between process_configs.
+  // Kept apart from the one process_config queries on, since a Watch holds
+  // its connection until the config changes.
+  std::shared_ptr<ServerConn> shardcontroller_watcher_conn;
 
   // Vector of worker threads.
   std::vector<std::thread> workers;
 
-  // Per-worker queues of client connections to handle.
+  // Where a client connection is in being scheduled:
+  //  - IDLE: waiting for the client to send something.
+  //  - QUEUED: on some worker's run queue.
+  //  - RUNNING: being served by a worker.
+  //  - NOTIFIED: being served, and the client has sent more since the worker
+  //    last read from it, so it must be queued again afterwards.
+  //  - CLOSED: disconnected, waiting for its owner to drop it.
+  enum class SessionState { IDLE, QUEUED, RUNNING, NOTIFIED, CLOSED };
+
+  // A client connection, as the workers schedule it. It's registered with
+  // its owner's epoll instance, but any worker may serve it, one at a time.
+  struct Session {
+    std::shared_ptr<ClientConn> conn;
+    size_t owner;
+    std::atomic<SessionState> state{SessionState::IDLE};
+  };
+
+  // Per-worker queues of client connections the worker hasn't taken on yet,
+  // and of its sessions that other workers found closed, which only the owner
+  // may drop.
   std::vector<std::deque<std::shared_ptr<ClientConn>>> conn_queues;
+  std::vector<std::vector<Session*>> closed_queues;
   std::deque<std::mutex> conn_queue_mtxs;
 
+  // Per-worker sessions, each owned by the worker whose epoll instance it's
+  // registered with. Only touched by the owner while the server is running.
+  std::vector<std::unordered_map<Session*, std::unique_ptr<Session>>> sessions;
+
+  // Per-worker run queues of sessions with requests to serve. A worker serves
+  // its own sessions first, and steals from the others' before going idle.
+  std::vector<std::unique_ptr<WorkStealingDeque<Session*>>> run_queues;
+  // Whether each worker is (about to be) waiting in epoll_wait with nothing
+  // to do, and so could be woken up to steal.
+  std::deque<std::atomic<bool>> idle_workers;
+
+  // Per-worker epoll instances, which wait on the worker's clients and its
+  // eventfd, which is written to to wake the worker up.
+  std::vector<int> epoll_fds;
+  std::vector<int> wake_fds;
+
   // The address on which the shardcontroller is listening.
   std::string shardcontroller_address;
 
   // Number of worker threads.
   uint64_t n_workers;
 
+  // The kind of store to create when the server starts.
+  StoreType store_type;
+
+  // Where and how the store's writes are logged, if they are. Only a
+  // standalone server logs them; a sharded one hands its pairs off to other
+  // servers whenever its shards move, so a log of its own would replay pairs
+  // it no longer owns.
+  WalOptions wal_options;
+
   /**
    * In a loop, accept client connections, then pass each connection into the
    * work queue of client connections to process.
@@ -125,24 +246,113 @@ class KvServer {
   void accept_clients_loop();
 
   /**
-   * In a loop, pop a client connection from the work queue and process a
-   * request from it. The argument specifies the worker thread ID running the
-   * loop. Exits when the server has been stopped.
+   * In a loop, wait for requests from any of the worker's client connections,
+   * queue the connections that have them on the worker's run queue, and serve
+   * them, stealing from other workers' run queues when there's nothing else
+   * to do. Also takes on new connections from the worker's queue as they
+   * arrive. The argument specifies the worker thread ID running the loop.
+   * Exits when the server has been stopped.
    */
   void work_loop(size_t worker_id);
 
   /**
-   * Check whether this server is responsible for a key (or list of keys).
+   * Serves a session taken off a run queue, then queues it again on the
+   * worker's run queue if it still has requests waiting, or hands it back to
+   * its owner to drop if it's disconnected.
+   */
+  void run_session(size_t worker_id, Session* session);
+
+  /**
+   * Waits up to timeout milliseconds (-1 for as long as it takes) for any of
+   * the worker's client connections to send something, and queues those that
+   * have on the worker's run queue. Also takes on new connections from the
+   * worker's queue, and drops closed ones, if woken up. Returns false if the
+   * worker can't wait on its clients any more.
+   */
+  bool poll_sessions(size_t worker_id, int timeout);
+
+  /**
+   * Processes the requests the client has sent so far, without waiting for
+   * more, up to MAX_REQUESTS_PER_TURN of them; sets *more if it stopped there.
+   * Every SESSION_POLL_INTERVAL meanwhile, queues whichever of the worker's
+   * other clients have sent something, for idle workers to steal. Returns
+   * false once the client should be dropped.
+   */
+  bool serve_client(size_t worker_id, ClientConn& client, bool* more);
+
+  /**
+   * Takes a session off another worker's run queue, if any has one.
+   */
+  std::optional<Session*> steal_session(size_t worker_id);
+
+  /**
+   * If the worker has queued more than it can get to right away, wakes up an
+   * idle worker to steal some of it. A busy worker, in the middle of serving a
+   * client, can't get to any of it right away.
+   */
+  void share_work(size_t worker_id, bool busy = false);
+
+  /**
+   * Wakes a worker up from waiting on its clients, to take on new clients from
+   * its queue or to notice that the server has been stopped.
+   */
+  void wake_worker(size_t worker_id);
+
+  /**
+   * Check whether this server is responsible for a key (or list of keys). The
+   * caller must hold config_mtx.
    */
   bool responsible_for(const std::string& key);
   bool responsible_for(const std::vector<std::string>& keys);
 
+  /**
+   * Checks that this server can serve a request for a key (or list of keys),
+   * returning the error to answer it with if not: the key belongs to another
+   * server, or its shard's pairs are still arriving. The caller must hold
+   * config_mtx until it's done with the key(s).
+   */
+  std::optional<ErrorResponse> refusal_for(const std::string& key);
+  std::optional<ErrorResponse> refusal_for(
+      const std::vector<std::string>& keys);
+
   /**
    * Query the shardcontroller, then update the config and move outdated pairs
-   * to updated servers.
+   * to updated servers. The config is updated first, so pairs on their way out
+   * are rejected rather than changed, and they're moved MIGRATION_CHUNK_SIZE
+   * at a time afterwards, while requests for every other key carry on. Only
+   * servers given shards this server had are sent any. Once it's handed over
+   * all it holds of another server's shards, it tells that server so, whether
+   * or not the others can be reached; it returns false until all have been,
+   * and tries just those that haven't next time.
    */
   bool process_config();
 
+  /**
+   * Works out which of the server's shards under next, the config about to
+   * replace the current one, are still arriving, and which servers each is
+   * waiting on: those that had any of it under previous, the config just
+   * before next (or under the current one, if the shardcontroller didn't say),
+   * or any that it was already waiting on. The caller must hold config_mtx
+   * exclusively.
+   */
+  void update_arriving(
+      const ShardControllerConfig& next,
+      const std::optional<std::map<std::string, std::vector<Shard>>>& previous);
+
+  /**
+   * Stops waiting on servers that have handed everything over as of the
+   * epoch they're awaited for, and on shards that aren't waiting on anyone any
+   * more. The caller must hold config_mtx exclusively.
+   */
+  void prune_arriving();
+
+  /**
+   * Takes pairs another server hands over (see process_config), which are
+   * taken for the server's shards even while they're arriving, unlike
+   * clients' writes; and notes when the sender is done.
+   */
+  Response receive_transfer(TransferRequest* req);
+
   /**
    * Process an incoming request: parse its request type, call its appropriate
    * handler (Get, Put, etc.), then get a response.
@@ -154,7 +364,12 @@ class KvServer {
   std::optional<QueryResponse> query_shardcontroller(
       std::shared_ptr<ServerConn> conn);
 
-  // Wrapper function that calls process_config periodically.
+  // Waits until the shardcontroller's config is past since_epoch (or the
+  // Watch times out), returning false if the shardcontroller couldn't be
+  // reached.
+  bool watch_shardcontroller(uint64_t since_epoch);
+
+  // Wrapper function that calls process_config whenever the config changes.
   void process_config_loop();
 };
 
@@ -0,0 +1,132 @@
+#ifndef WORK_STEALING_DEQUE_HPP
+#define WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+/**
+ * A lock-free Chase-Lev deque of work items, for schedulers where each thread
+ * works through its own deque and steals from others when it runs dry.
+ *
+ * Only the thread that owns the deque may push and pop, which happen at the
+ * bottom, newest first; any thread may steal, which takes from the top, oldest
+ * first. The owner and thieves only contend over the last item left.
+ *
+ * T must be trivially copyable (it's kept in std::atomic), e.g. a pointer.
+ */
+template <typename T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(size_t capacity = 64) {
+    this->arrays.push_back(std::make_unique<Array>(capacity));
+    this->array.store(this->arrays.back().get(), std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  // Adds an item at the bottom. Owner only.
+  void push(T item) {
+    int64_t b = this->bottom.load(std::memory_order_relaxed);
+    int64_t t = this->top.load(std::memory_order_acquire);
+    Array* a = this->array.load(std::memory_order_relaxed);
+    if (b - t >= static_cast<int64_t>(a->capacity)) a = this->grow(a, t, b);
+    a->put(b, item);
+    // seq_cst rather than release, so that a thread that pushes and then
+    // checks for idle workers, and an idle worker that announces itself and
+    // then checks the deques, can't both miss each other.
+    this->bottom.store(b + 1, std::memory_order_seq_cst);
+  }
+
+  // Removes the newest item. Owner only.
+  std::optional<T> pop() {
+    int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = this->array.load(std::memory_order_relaxed);
+    // Claim the bottom item before looking at how far thieves have come.
+    this->bottom.store(b, std::memory_order_seq_cst);
+    int64_t t = this->top.load(std::memory_order_seq_cst);
+
+    if (t > b) {
+      // Empty.
+      this->bottom.store(b + 1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    T item = a->get(b);
+    if (t == b) {
+      // Last item: race the thieves for it.
+      bool won = this->top.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      this->bottom.store(b + 1, std::memory_order_relaxed);
+      if (!won) return std::nullopt;
+    }
+    return item;
+  }
+
+  // Removes the oldest item. Any thread. May come back empty-handed if it
+  // loses a race for the item, even though the deque wasn't empty.
+  std::optional<T> steal() {
+    int64_t t = this->top.load(std::memory_order_seq_cst);
+    int64_t b = this->bottom.load(std::memory_order_seq_cst);
+    if (t >= b) return std::nullopt;
+
+    Array* a = this->array.load(std::memory_order_acquire);
+    T item = a->get(t);
+    if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+      return std::nullopt;
+    }
+    return item;
+  }
+
+  // Number of items; only a snapshot if other threads are using the deque.
+  size_t size() const {
+    int64_t b = this->bottom.load(std::memory_order_seq_cst);
+    int64_t t = this->top.load(std::memory_order_seq_cst);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  bool empty() const {
+    return this->size() == 0;
+  }
+
+ private:
+  // A ring buffer of items, indexed by the ever-increasing top/bottom.
+  struct Array {
+    const size_t capacity;
+    std::unique_ptr<std::atomic<T>[]> items;
+
+    explicit Array(size_t c)
+        : capacity(c), items(std::make_unique<std::atomic<T>[]>(c)) {
+    }
+
+    T get(int64_t i) const {
+      return this->items[i % this->capacity].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T item) {
+      this->items[i % this->capacity].store(item, std::memory_order_relaxed);
+    }
+  };
+
+  std::atomic<int64_t> top{0};
+  std::atomic<int64_t> bottom{0};
+  std::atomic<Array*> array;
+  // Every array the deque has used, the current one last. Outgrown arrays are
+  // kept until the deque is destroyed, since a thief may still be reading one.
+  // Only touched by the owner.
+  std::vector<std::unique_ptr<Array>> arrays;
+
+  // Moves the items in [t, b) into an array twice the size. Owner only.
+  Array* grow(Array* a, int64_t t, int64_t b) {
+    this->arrays.push_back(std::make_unique<Array>(2 * a->capacity));
+    Array* bigger = this->arrays.back().get();
+    for (int64_t i = t; i < b; i++) bigger->put(i, a->get(i));
+    this->array.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+};
+
+#endif /* end of include guard */
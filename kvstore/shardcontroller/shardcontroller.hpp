@@ -15,6 +15,7 @@ class Shardcontroller {
   virtual bool Leave(const LeaveRequest* req, LeaveResponse* res) = 0;
   virtual bool Move(const MoveRequest* req, MoveResponse* res) = 0;
   virtual bool Query(const QueryRequest* req, QueryResponse* res) = 0;
+  virtual bool Watch(const WatchRequest* req, WatchResponse* res) = 0;
 
   virtual int start() = 0;
   virtual void stop() = 0;
@@ -1,13 +1,39 @@
 #include "static_shardcontroller.hpp"
 
 bool StaticShardController::Query(const QueryRequest*, QueryResponse* res) {
-  // TODO (Part B, Step 1): Implement!
+  std::shared_lock lock(this->config_mtx);
+  res->config = this->config;
+  res->previous = this->previous;
+  return true;
+}
 
+bool StaticShardController::Watch(const WatchRequest* req,
+                                  WatchResponse* res) {
+  std::shared_lock lock(this->config_mtx);
+  this->config_cv.wait_for(lock, WATCH_TIMEOUT, [&] {
+    return this->config.epoch > req->since_epoch || this->is_stopped;
+  });
+  res->config = this->config;
   return true;
 }
 
+void StaticShardController::config_changed(
+    std::map<std::string, std::vector<Shard>> before) {
+  this->previous = std::move(before);
+  this->config.epoch++;
+  this->config_cv.notify_all();
+}
+
 bool StaticShardController::Join(const JoinRequest* req, JoinResponse*) {
-  // TODO (Part B, Step 1): Implement!
+  std::unique_lock lock(this->config_mtx);
+  if (this->config.server_to_shards.contains(req->server)) {
+    cerr_color(RED, "Server ", req->server, " has already joined.");
+    return false;
+  }
+  auto before = this->config.server_to_shards;
+  // Servers start out responsible for nothing, until shards are moved to them
+  this->config.server_to_shards[req->server] = {};
+  this->config_changed(std::move(before));
 
   cout_color(BLUE, "Added server ", req->server,
              " to shardcontroller configuration.");
@@ -15,7 +41,23 @@ bool StaticShardController::Join(const JoinRequest* req, JoinResponse*) {
 }
 
 bool StaticShardController::Leave(const LeaveRequest* req, LeaveResponse*) {
-  // TODO (Part B, Step 1): Implement!
+  std::unique_lock lock(this->config_mtx);
+  auto it = this->config.server_to_shards.find(req->server);
+  if (it == this->config.server_to_shards.end()) {
+    cerr_color(RED, "Server ", req->server, " is not in the configuration.");
+    return false;
+  }
+  auto before = this->config.server_to_shards;
+  std::vector<Shard> orphaned = std::move(it->second);
+  this->config.server_to_shards.erase(it);
+
+  // Hand the leaving server's shards to the first of the remaining servers,
+  // so that every key still has a server responsible for it
+  if (!this->config.server_to_shards.empty()) {
+    std::vector<Shard>& heir = this->config.server_to_shards.begin()->second;
+    heir.insert(heir.end(), orphaned.begin(), orphaned.end());
+  }
+  this->config_changed(std::move(before));
 
   cout_color(BLUE, "Deleted server ", req->server,
              " on shardcontroller configuration.");
@@ -23,13 +65,16 @@ bool StaticShardController::Leave(const LeaveRequest* req, LeaveResponse*) {
 }
 
 bool StaticShardController::Move(const MoveRequest* req, MoveResponse*) {
-  // TODO (Part B, Step 1): Implement!
+  std::unique_lock lock(this->config_mtx);
+  auto target = this->config.server_to_shards.find(req->server);
+  if (target == this->config.server_to_shards.end()) {
+    cerr_color(RED, "Server ", req->server, " is not in the configuration.");
+    return false;
+  }
 
-  // TODO: For each shard to be moved, iterate over each server's shards.
-  // For each of the server's shards, if 'moved' overlaps with 'shard', compute
-  // the modified shard and insert it into 'new_shards.' Once the loop ends, we
-  // replace the server's shards with 'new_shards.' You'll find the
-  // 'split_shard' function helpful (c.f. shard.hpp).
+  auto before = this->config.server_to_shards;
+  // For each shard to be moved, iterate over each server's shards, and keep
+  // only the parts of them that don't overlap with 'moved'.
   for (Shard moved : req->shards) {
     for (auto&& [server, shards] : this->config.server_to_shards) {
       std::vector<Shard> new_shards;
@@ -40,29 +85,35 @@ bool StaticShardController::Move(const MoveRequest* req, MoveResponse*) {
           cerr_color(
               RED,
               "Moving differing shard granularities not currently supported.");
+          // Undo whatever the shards moved before this one did
+          this->config.server_to_shards = std::move(before);
           return false;
         }
         // Using overlap status, determine whether shards need to be modified
         OverlapStatus os = get_overlap(shard, moved);
         switch (os) {
           case OverlapStatus::NO_OVERLAP: {
-            // TODO
+            new_shards.push_back(shard);
             continue;
           }
           case OverlapStatus::OVERLAP_START: {
-            // TODO
+            // Keep what's after 'moved'
+            new_shards.push_back(split_shard(shard, moved.upper).second);
             continue;
           }
           case OverlapStatus::OVERLAP_END: {
-            // TODO
+            // Keep what's before 'moved'
+            new_shards.push_back(split_shard(shard, moved.lower, false).first);
             continue;
           }
           case OverlapStatus::COMPLETELY_CONTAINS: {
-            // TODO
+            // Keep what's on either side of 'moved'
+            new_shards.push_back(split_shard(shard, moved.lower, false).first);
+            new_shards.push_back(split_shard(shard, moved.upper).second);
             continue;
           }
           case OverlapStatus::COMPLETELY_CONTAINED:
-            // TODO
+            // All of it moves
             continue;
         }
       }
@@ -70,7 +121,10 @@ bool StaticShardController::Move(const MoveRequest* req, MoveResponse*) {
     }
   }
 
-  // TODO: Now, actually move the shard onto the target server!
+  // Now, actually move the shards onto the target server
+  target->second.insert(target->second.end(), req->shards.begin(),
+                        req->shards.end());
+  this->config_changed(std::move(before));
 
   cout_color(DIM, "Moved the following shards to server ", req->server, ":");
   for (auto&& s : req->shards) print_color(std::cout, DIM, s, " ");
@@ -106,6 +160,12 @@ void StaticShardController::stop() {
   cout_color(BLUE, "Joining listener thread...");
   this->client_listener.join();
 
+  // Wake anyone Watching the config, so their connections can close
+  {
+    std::unique_lock lock(this->config_mtx);
+    this->config_cv.notify_all();
+  }
+
   // Close all connections
   cout_color(BLUE, "Closing all connections...");
   std::unique_lock lock(this->conns_mtx);
@@ -140,13 +200,14 @@ void StaticShardController::accept_clients_loop() {
 
 void StaticShardController::handle_client(std::shared_ptr<ClientConn> client) {
   while (!is_stopped && client->is_connected) {
-    std::optional<Request> req = client->recv_request();
+    uint32_t id = 0;
+    std::optional<Request> req = client->recv_request(&id);
     if (!req) {
       break;
     }
 
     Response res = this->process_request(*req);
-    if (!client->send_response(res)) {
+    if (!client->send_response(res, id)) {
       break;
     }
   }
@@ -205,6 +266,13 @@ Response StaticShardController::process_request(Request req) {
     } else {
       res = ErrorResponse{"Failed to process Query request."};
     }
+  } else if (auto* watch_req = std::get_if<WatchRequest>(&req)) {
+    WatchResponse watch_res{};
+    if (this->Watch(watch_req, &watch_res)) {
+      res = watch_res;
+    } else {
+      res = ErrorResponse{"Failed to process Watch request."};
+    }
   } else {
     throw std::logic_error{"invalid request variant!"};
   }
@@ -25,6 +25,9 @@ class StaticShardController : public Shardcontroller {
   }
 
   bool Query(const QueryRequest*, QueryResponse* res) override;
+  // Waits until the config's epoch is past req->since_epoch, for at most
+  // WATCH_TIMEOUT, then answers with the config as it is.
+  bool Watch(const WatchRequest* req, WatchResponse* res) override;
   bool Join(const JoinRequest* req, JoinResponse*) override;
   bool Leave(const LeaveRequest* req, LeaveResponse*) override;
   bool Move(const MoveRequest* req, MoveResponse*) override;
@@ -36,6 +39,16 @@ class StaticShardController : public Shardcontroller {
   // Note: You'll need these fields in your Shardcontroller implementation!
   ShardControllerConfig config;
   std::shared_mutex config_mtx;
+  // Notified whenever the config changes, and when stopping, to wake Watches.
+  std::condition_variable_any config_cv;
+
+  // The config's server_to_shards just before its last change (see
+  // QueryResponse).
+  std::map<std::string, std::vector<Shard>> previous;
+
+  // Marks a change to the config from before, waking anyone Watching for one.
+  // Must be called with config_mtx held exclusively.
+  void config_changed(std::map<std::string, std::vector<Shard>> before);
 
   /* ==================================================*/
   /* === INTERNALS: DO NOT MODIFY BELOW THIS LINE ===  */
@@ -16,6 +16,8 @@
 
 #include "common/shard.hpp"
 #include "kvstore/concurrent_kvstore.hpp"
+#include "kvstore/epoch_kvstore.hpp"
+#include "kvstore/sharded_kvstore.hpp"
 #include "kvstore/simple_kvstore.hpp"
 #include "net/network_helpers.hpp"
 #include "net/server_commands.hpp"
@@ -203,8 +205,17 @@ inline std::unique_ptr<KvStore> make_kvstore(int argc, char* argv[]) {
       return std::make_unique<SimpleKvStore>();
     } else if (type == "concurrent") {
       return std::make_unique<ConcurrentKvStore>();
+    } else if (type == "epoch") {
+      return std::make_unique<EpochKvStore>();
+    } else if (type == "sharded") {
+      // Partitioned as a sharded KvServer's store is
+      return std::make_unique<ShardedKvStore>([] {
+        return std::make_unique<ConcurrentKvStore>(
+            nullptr, DbMap::DEFAULT_STRIPE_COUNT, true);
+      });
     } else {
-      cerr_color(RED, "Argument must be \"simple\" or \"concurrent\"");
+      cerr_color(RED, "Argument must be \"simple\", \"concurrent\", ",
+                 "\"epoch\" or \"sharded\"");
       exit(EXIT_FAILURE);
     }
   } else {
@@ -0,0 +1,105 @@
+#include <fstream>
+
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+// warning: N_THREADS must be < 10 because of hash function
+static constexpr size_t N_THREADS = 8;
+static constexpr size_t N_KEYS_PER_THREAD = 10'000;
+
+static const vector<size_t> BATCH_SIZES = {10, 100, 1000};
+
+int main(int argc, char* argv[]) {
+  std::ofstream output_file("performance-runtime.csv", std::ios::app);
+  if (!output_file.is_open()) {
+    std::cerr << "Failed to open output file." << std::endl;
+  }
+
+  /*
+    This test extends test_performance_multiput_multiget to smaller batches.
+    For each batch size, a single thread MultiPuts (then MultiGets) every
+    thread's keys in batches of that many keys, and then N_THREADS threads do
+    the same for their own keys concurrently. As in that test, each thread's
+    keys all fall in a single stripe that no other thread touches, so with
+    ordered per-stripe locking the threads' batches never wait on each other,
+    however many of them are in flight: on more than one core, the threads
+    should take less time than the single thread for every batch size (which
+    is asserted). On one core, they can only take turns, and take somewhat
+    longer for switching between them.
+  */
+  auto hasher = [](const string& key) {
+    return stoi(key.substr(key.size() - 1));
+  };
+
+  // As in test_performance_multiput_multiget, every key in threads_to_keys[i]
+  // ends in i, and so hashes to i.
+  unordered_map<size_t, vector<string>> threads_to_keys;
+  for (size_t i = 0; i < N_THREADS; i++) {
+    threads_to_keys[i] = make_pseudo_rand_str(N_KEYS_PER_THREAD, 32, i);
+  }
+
+  // Runs f(i) for every thread's keys, either sequentially on one thread or on
+  // N_THREADS threads at once, and returns how long that took.
+  auto time_run = [&](bool multi_threaded, auto&& f) {
+    auto start = chrono::high_resolution_clock::now();
+    if (multi_threaded) {
+      vector<thread> threads;
+      for (size_t i = 0; i < N_THREADS; i++) {
+        threads.emplace_back(f, i);
+      }
+      for (auto& t : threads) {
+        t.join();
+      }
+    } else {
+      thread single_thread([&]() {
+        for (size_t i = 0; i < N_THREADS; i++) {
+          f(i);
+        }
+      });
+      single_thread.join();
+    }
+    auto end = chrono::high_resolution_clock::now();
+    return chrono::duration_cast<chrono::milliseconds>(end - start);
+  };
+
+  for (size_t batch_size : BATCH_SIZES) {
+    for (string op : {"multiput", "multiget"}) {
+      // How long the single thread, then the N_THREADS threads, took
+      chrono::milliseconds times[2];
+      for (bool multi_threaded : {false, true}) {
+        ConcurrentKvStore store(hasher);
+
+        auto put_keys = [&](size_t i) {
+          const vector<string>& keys = threads_to_keys.at(i);
+          vector<string> values(keys.size(), to_string(i));
+          ASSERT(multiput_range(store, keys, values, 0, N_KEYS_PER_THREAD,
+                                batch_size));
+        };
+        auto get_keys = [&](size_t i) {
+          const vector<string>& keys = threads_to_keys.at(i);
+          vector<string> values(keys.size(), to_string(i));
+          ASSERT(multiget_range(store, keys, values, 0, N_KEYS_PER_THREAD,
+                                batch_size));
+        };
+
+        chrono::milliseconds time;
+        if (op == "multiput") {
+          time = time_run(multi_threaded, put_keys);
+        } else {
+          for (size_t i = 0; i < N_THREADS; i++) put_keys(i);
+          time = time_run(multi_threaded, get_keys);
+        }
+
+        output_file << (multi_threaded ? "multi" : "single") << "_thread_"
+                    << op << "_batch" << batch_size << "," << time.count()
+                    << ","
+                    << to_throughput(time, N_THREADS, N_KEYS_PER_THREAD)
+                    << "\n";
+        times[multi_threaded] = time;
+      }
+      if (thread::hardware_concurrency() > 1) ASSERT(times[1] < times[0]);
+    }
+  }
+
+  output_file.close();
+}
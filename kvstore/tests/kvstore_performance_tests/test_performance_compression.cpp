@@ -0,0 +1,123 @@
+#include <fstream>
+#include <iomanip>
+#include <random>
+
+#include "common/compression.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_BATCH_VALUES = 64;
+static constexpr size_t VALUE_SIZE = 4 << 10;
+static constexpr size_t N_BATCHES = 200;
+static constexpr size_t N_CODEC_ROUNDS = 200;
+
+static double mb_per_sec(size_t bytes, chrono::steady_clock::duration d) {
+  return bytes / double(1 << 20) / chrono::duration<double>(d).count();
+}
+
+// Values made up like the GDPR app's: lines of its database, picked at random,
+// until they're VALUE_SIZE bytes.
+static vector<string> make_values(const vector<string>& lines, size_t n) {
+  mt19937 generator(n);
+  uniform_int_distribution<size_t> dist(0, lines.size() - 1);
+  vector<string> values(n);
+  for (string& value : values) {
+    while (value.size() < VALUE_SIZE) value += lines[dist(generator)] + "\n";
+    value.resize(VALUE_SIZE);
+  }
+  return values;
+}
+
+// Times N_BATCHES MultiPuts of keys and values over a connection, compressed
+// or not.
+static chrono::steady_clock::duration time_multiputs(
+    const string& addr, bool compress, const vector<string>& keys,
+    const vector<string>& values) {
+  shared_ptr<ServerConn> conn =
+      connect_to_server(addr, PROTOCOL_LATEST, compress);
+  ASSERT(conn && conn->compressing() == compress);
+
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < N_BATCHES; i++) {
+    ASSERT(conn->send_request(MultiPutRequest{keys, values}));
+    optional<Response> res = conn->recv_response();
+    ASSERT(res && get_if<MultiPutResponse>(&*res));
+  }
+  auto elapsed = chrono::steady_clock::now() - start;
+
+  ASSERT(conn->send_request(MultiGetRequest{keys}));
+  optional<Response> res = conn->recv_response();
+  ASSERT(res);
+  auto* multiget = get_if<MultiGetResponse>(&*res);
+  ASSERT(multiget);
+  ASSERT_EQ_VECS(multiget->values, values);
+  return elapsed;
+}
+
+int main() {
+  /*
+    This benchmark measures what compressing messages costs and saves, on
+    MultiPuts of N_BATCH_VALUES text values like the GDPR app's (made up from
+    lines of gdpr/database.csv): how small the compressor gets a MultiPut's
+    body, how fast it compresses and decompresses, and how long the MultiPuts
+    take end to end over a connection that sends them as they are and one
+    that compresses them. Over loopback, fewer bytes on the wire save little
+    time, so the last mostly shows the CPU cost; over a real network they'd
+    save more. The text should compress to well under its size (the body
+    is at least asserted to shrink).
+  */
+  ifstream database("../gdpr/database.csv");
+  vector<string> lines;
+  for (string line; getline(database, line);) lines.push_back(line);
+  ASSERT(!lines.empty());
+
+  vector<string> keys = make_rand_strs(N_BATCH_VALUES, 16);
+  vector<string> values = make_values(lines, N_BATCH_VALUES);
+
+  Message msg{};
+  ASSERT(serialize_request(MultiPutRequest{keys, values}, &msg));
+  vector<byte> packed(lz_compress_bound(msg.sz));
+  vector<byte> unpacked(msg.sz);
+  size_t packed_size = 0;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < N_CODEC_ROUNDS; i++) {
+    packed_size = lz_compress(msg.buf, packed.data());
+  }
+  auto compress_time = chrono::steady_clock::now() - start;
+  span<const byte> block(packed.data(), packed_size);
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < N_CODEC_ROUNDS; i++) {
+    ASSERT(lz_decompress(block, unpacked));
+  }
+  auto decompress_time = chrono::steady_clock::now() - start;
+  ASSERT(unpacked == msg.buf);
+  ASSERT(packed_size < msg.sz);
+
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+  auto plain_time = time_multiputs(addr, false, keys, values);
+  auto compressed_time = time_multiputs(addr, true, keys, values);
+  server->stop();
+
+  cout << fixed << setprecision(1);
+  cout << "MultiPut of " << N_BATCH_VALUES << "x" << (VALUE_SIZE >> 10)
+       << "KB values\n";
+  cout << setw(24) << "body bytes" << setw(12) << msg.sz << "\n";
+  cout << setw(24) << "compressed bytes" << setw(12) << packed_size << "\n";
+  cout << setw(24) << "ratio" << setw(12) << double(msg.sz) / packed_size
+       << "\n";
+  cout << setw(24) << "compress MB/s" << setw(12)
+       << mb_per_sec(N_CODEC_ROUNDS * msg.sz, compress_time) << "\n";
+  cout << setw(24) << "decompress MB/s" << setw(12)
+       << mb_per_sec(N_CODEC_ROUNDS * msg.sz, decompress_time) << "\n";
+  cout << setprecision(3);
+  cout << setw(24) << "MultiPut (ms)" << setw(12)
+       << chrono::duration<double, milli>(plain_time).count() / N_BATCHES
+       << "\n";
+  cout << setw(24) << "compressed MultiPut (ms)" << setw(12)
+       << chrono::duration<double, milli>(compressed_time).count() / N_BATCHES
+       << "\n";
+}
@@ -0,0 +1,98 @@
+#include <iomanip>
+
+#include "client/shardkv_client.hpp"
+#include "common/shard.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_SERVERS = 2;
+static constexpr size_t N_KEYS = 200;
+static constexpr size_t N_ROUNDS = 5;
+
+struct Phase {
+  double ops_per_sec;
+  double queries_per_op;
+};
+
+// Puts and then Gets every key N_ROUNDS times, checking the values, and
+// returns how quickly that went and how many shardcontroller queries it took.
+// With query_first, the client queries the shardcontroller before every
+// operation, as it used to.
+static Phase run_load(ShardKvClient& client, const vector<string>& keys,
+                      bool query_first) {
+  size_t queries_before = client.query_count();
+  auto start = chrono::steady_clock::now();
+  for (size_t round = 0; round < N_ROUNDS; round++) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (query_first) ASSERT(client.Query());
+      ASSERT(client.Put(keys[i], to_string(round * N_KEYS + i)));
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (query_first) ASSERT(client.Query());
+      ASSERT_EQ(client.Get(keys[i]).value_or(""),
+                to_string(round * N_KEYS + i));
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  double n_ops = 2.0 * N_ROUNDS * keys.size();
+  return {n_ops / elapsed.count(),
+          (client.query_count() - queries_before) / n_ops};
+}
+
+int main() {
+  /*
+    This benchmark measures how many requests clients make of the
+    shardcontroller under a steady load of Puts and Gets, first querying it
+    before every operation, and then relying on the cached configuration. It
+    then moves every shard to one server, without the client's knowledge, and
+    checks that the client follows the servers' redirects to where the keys
+    went. With the cached configuration, the client should query the
+    shardcontroller at most a tenth as often per op (which is asserted), and
+    ops/s shows what those queries cost.
+  */
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+
+  vector<string> server_addresses = make_server_addresses(N_SERVERS);
+  vector<Shard> shards = split_into(N_SERVERS);
+  vector<shared_ptr<KvServer>> servers;
+  for (size_t i = 0; i < N_SERVERS; i++) {
+    servers.push_back(
+        start_server<KvServer, const std::string&, const std::string&,
+                     uint64_t>(server_addresses[i], sm_addr, N_WORKERS));
+    ASSERT(test_move(sm, server_addresses[i], vector<Shard>{shards[i]}));
+  }
+  // Let the servers pick up their shards
+  this_thread::sleep_for(500ms);
+
+  ShardKvClient client(sm_addr);
+  vector<string> keys =
+      make_rand_strs(N_KEYS, 8, string(VALID_CHARS.begin(), VALID_CHARS.end()));
+
+  Phase uncached = run_load(client, keys, true);
+  Phase cached = run_load(client, keys, false);
+
+  // Move everything to the last server; unless the client has heard of the
+  // move by the time the load starts, its cached configuration still has half
+  // the keys on the first one.
+  ASSERT(test_move(sm, server_addresses[N_SERVERS - 1], shards));
+  this_thread::sleep_for(1s);
+  Phase moved = run_load(client, keys, false);
+
+  for (auto&& server : servers) server->stop();
+  sm->stop();
+  ASSERT(cached.queries_per_op < uncached.queries_per_op / 10);
+
+  cout << fixed;
+  cout << setw(24) << "" << setw(12) << "ops/s" << setw(14) << "queries/op"
+       << "\n";
+  for (auto&& [name, phase] : {pair{"query before every op", uncached},
+                               pair{"cached config", cached},
+                               pair{"cached, after a move", moved}}) {
+    cout << setw(24) << name << setw(12) << setprecision(0)
+         << phase.ops_per_sec << setw(14) << setprecision(4)
+         << phase.queries_per_op << "\n";
+  }
+}
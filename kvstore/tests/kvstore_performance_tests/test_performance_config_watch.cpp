@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "client/simple_client.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_MOVES = 20;
+static constexpr chrono::milliseconds POLL_INTERVAL{1};
+// How often servers used to poll the shardcontroller for the config.
+static constexpr chrono::milliseconds OLD_CONFIG_POLL{250};
+
+// Whether the server at conn has the key, with the value, yet.
+static bool has_pair(shared_ptr<ServerConn> conn, const string& key,
+                     const string& value) {
+  ASSERT(conn->send_request(GetRequest{key}));
+  optional<Response> res = conn->recv_response();
+  ASSERT(res);
+  auto* get = get_if<GetResponse>(&*res);
+  return get && get->value == value;
+}
+
+int main() {
+  /*
+    This benchmark measures how long a move takes to reach the servers: a
+    shard with one pair in it is moved back and forth between two servers
+    N_MOVES times, and each time, the server it's moved to is asked for the
+    pair every POLL_INTERVAL until it has it, which it only can once both
+    servers have heard of the move and the pair has been migrated. Since the
+    servers watch the config rather than poll for it every OLD_CONFIG_POLL,
+    the median move should take a few milliseconds, not the 100ms or more
+    that waiting on two servers' polls would take; it's asserted to be under
+    a quarter of OLD_CONFIG_POLL. The max may still be about OLD_CONFIG_POLL,
+    from a move that caught the destination before it had picked up the
+    config, which the source retries after that long.
+  */
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+  vector<string> addrs = make_server_addresses(2);
+  vector<shared_ptr<KvServer>> servers;
+  for (auto&& addr : addrs) {
+    servers.push_back(
+        start_server<KvServer, const std::string&, const std::string&,
+                     uint64_t>(addr, sm_addr, N_WORKERS));
+  }
+  ASSERT(test_move(sm, addrs[0], vector<Shard>{{"0", "Z"}}));
+  // Let the servers pick up their shards
+  this_thread::sleep_for(500ms);
+  ASSERT(SimpleClient(addrs[0]).Put("moving", "value"));
+
+  vector<shared_ptr<ServerConn>> conns;
+  for (auto&& addr : addrs) conns.push_back(connect_to_server(addr));
+  vector<double> latencies;
+  for (size_t i = 0; i < N_MOVES; i++) {
+    size_t dest = (i + 1) % addrs.size();
+    auto start = chrono::steady_clock::now();
+    ASSERT(test_move(sm, addrs[dest], vector<Shard>{{"M", "Z"}}));
+    while (!has_pair(conns[dest], "moving", "value")) {
+      this_thread::sleep_for(POLL_INTERVAL);
+    }
+    chrono::duration<double, milli> latency =
+        chrono::steady_clock::now() - start;
+    latencies.push_back(latency.count());
+  }
+
+  for (auto&& server : servers) server->stop();
+  sm->stop();
+
+  sort(latencies.begin(), latencies.end());
+  cout << fixed << setprecision(3);
+  cout << "Move until the destination has the pair, over " << N_MOVES
+       << " moves (ms)\n";
+  cout << setw(12) << "min" << setw(12) << latencies.front() << "\n";
+  cout << setw(12) << "median" << setw(12) << latencies[N_MOVES / 2] << "\n";
+  cout << setw(12) << "max" << setw(12) << latencies.back() << "\n";
+
+  chrono::duration<double, milli> old_poll = OLD_CONFIG_POLL;
+  ASSERT(latencies[N_MOVES / 2] < old_poll.count() / 4);
+}
@@ -0,0 +1,87 @@
+#include <iomanip>
+#include <map>
+
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+// Bytes moved per value size; fewer round trips for the larger sizes.
+static constexpr size_t BYTES_PER_SIZE = 64 << 20;
+static constexpr size_t VALUE_SIZES[] = {4 << 10, 64 << 10, 1 << 20, 8 << 20};
+// MultiPuts of this many 1MB values, as a shard migration sends them.
+static constexpr size_t N_BATCH_VALUES = 16;
+
+static double mb_per_sec(size_t bytes, chrono::steady_clock::duration d) {
+  return bytes / double(1 << 20) / chrono::duration<double>(d).count();
+}
+
+int main() {
+  /*
+    This benchmark measures how fast values of a few sizes, up to many times
+    the size of a socket buffer, go to and from a server, by Putting and then
+    Getting them over one connection. Messages that big take many partial
+    sends and receives, and each one must pick up as soon as the socket's
+    ready rather than after a fixed wait, so MB/s should hold up, not fall
+    off, as values outgrow the socket buffer: 1MB values, several socket
+    buffers' worth, should go at least half as fast as 64KB ones, which fit
+    in one (which is asserted). 8MB values go slower again, not for the
+    socket's sake but for the fresh memory each one is read into.
+  */
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+  shared_ptr<ServerConn> conn = connect_to_server(addr);
+  ASSERT(conn);
+
+  // Put and Get MB/s by value size.
+  map<size_t, pair<double, double>> rates;
+  cout << fixed << setprecision(0);
+  cout << setw(16) << "value size" << setw(12) << "Put MB/s" << setw(12)
+       << "Get MB/s" << "\n";
+  for (size_t size : VALUE_SIZES) {
+    string value(size, 'v');
+    size_t n = BYTES_PER_SIZE / size;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      ASSERT(conn->send_request(PutRequest{"key" + to_string(i), value}));
+      optional<Response> res = conn->recv_response();
+      ASSERT(res && get_if<PutResponse>(&*res));
+    }
+    auto put_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      ASSERT(conn->send_request(GetRequest{"key" + to_string(i)}));
+      optional<Response> res = conn->recv_response();
+      ASSERT(res);
+      auto* get = get_if<GetResponse>(&*res);
+      ASSERT(get && get->value.size() == size);
+    }
+    auto get_time = chrono::steady_clock::now() - start;
+
+    rates[size] = {mb_per_sec(n * size, put_time),
+                   mb_per_sec(n * size, get_time)};
+    cout << setw(14) << (size >> 10) << "KB" << setw(12) << rates[size].first
+         << setw(12) << rates[size].second << "\n";
+  }
+
+  vector<string> keys = make_rand_strs(N_BATCH_VALUES, 16);
+  vector<string> values(N_BATCH_VALUES, string(1 << 20, 'v'));
+  size_t n = BYTES_PER_SIZE / (N_BATCH_VALUES << 20);
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    ASSERT(conn->send_request(MultiPutRequest{keys, values}));
+    optional<Response> res = conn->recv_response();
+    ASSERT(res && get_if<MultiPutResponse>(&*res));
+  }
+  auto multiput_time = chrono::steady_clock::now() - start;
+  cout << setw(11) << N_BATCH_VALUES << "x1MB" << setw(12)
+       << mb_per_sec(n * (N_BATCH_VALUES << 20), multiput_time) << setw(12)
+       << "-" << "\n";
+
+  server->stop();
+  ASSERT(rates[1 << 20].first >= rates[64 << 10].first / 2);
+  ASSERT(rates[1 << 20].second >= rates[64 << 10].second / 2);
+}
@@ -0,0 +1,95 @@
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_KEYS = 8'192;
+static constexpr size_t N_OPS = 400'000;
+// Out of every 100 operations, this many are Puts; the rest are Gets.
+static constexpr size_t PUT_PERCENT = 5;
+
+static const vector<size_t> STRIPE_COUNTS = {1, 4, 16, 64, 256};
+static const vector<size_t> THREAD_COUNTS = {1, 2, 4, 8};
+
+int main(int argc, char* argv[]) {
+  std::ofstream output_file("performance-striping.csv", std::ios::app);
+  if (!output_file.is_open()) {
+    std::cerr << "Failed to open output file." << std::endl;
+  }
+  output_file << "stripes,threads,time,tput\n";
+
+  /*
+    This benchmark sweeps the ConcurrentKvStore's number of lock stripes
+    against the number of client threads. Each run preloads N_KEYS keys, then
+    splits N_OPS read-mostly operations (PUT_PERCENT% Puts, the rest Gets) on
+    random keys evenly across the threads. With enough stripes, throughput
+    should grow with the thread count (up to the number of cores); with a
+    single stripe, every Put serializes against every other operation, and
+    every Get contends for the one lock's reader count. So with 8 threads on
+    more than one core, the most stripes should beat a single one (which is
+    asserted); on one core, no two operations ever run at once, and every
+    stripe count does about the same.
+  */
+  vector<string> keys = make_rand_strs(N_KEYS, 32);
+  vector<string> vals = make_rand_strs(N_KEYS, 32);
+
+  // ops/s with 8 threads, by number of stripes.
+  map<size_t, double> tput_8_threads;
+  cout << setw(8) << "stripes" << setw(8) << "threads" << setw(10) << "ms"
+       << setw(14) << "ops/s" << "\n";
+  for (size_t n_stripes : STRIPE_COUNTS) {
+    for (size_t n_threads : THREAD_COUNTS) {
+      ConcurrentKvStore store(std::hash<std::string>(), n_stripes);
+      ASSERT(put_range(store, keys, vals, 0, N_KEYS));
+
+      auto work = [&](size_t tid) {
+        std::mt19937 rng(tid);
+        std::uniform_int_distribution<size_t> pick(0, N_KEYS - 1);
+        auto get_req = GetRequest{};
+        auto get_res = GetResponse{};
+        auto put_req = PutRequest{};
+        auto put_res = PutResponse{};
+        for (size_t i = 0; i < N_OPS / n_threads; i++) {
+          size_t k = pick(rng);
+          if (i % 100 < PUT_PERCENT) {
+            put_req.key = keys[k];
+            put_req.value = vals[k];
+            ASSERT(store.Put(&put_req, &put_res));
+          } else {
+            get_req.key = keys[k];
+            ASSERT(store.Get(&get_req, &get_res));
+            ASSERT(get_res.value == vals[k]);
+          }
+        }
+      };
+
+      auto start = chrono::high_resolution_clock::now();
+      {
+        vector<thread> threads;
+        for (size_t t = 0; t < n_threads; t++) {
+          threads.emplace_back(work, t);
+        }
+        for (auto& t : threads) {
+          t.join();
+        }
+      }
+      auto end = chrono::high_resolution_clock::now();
+      auto time = chrono::duration_cast<chrono::milliseconds>(end - start);
+      double tput = to_throughput(time, 1, N_OPS);
+
+      cout << setw(8) << n_stripes << setw(8) << n_threads << setw(10)
+           << time.count() << setw(14) << static_cast<size_t>(tput) << "\n";
+      output_file << n_stripes << "," << n_threads << "," << time.count()
+                  << "," << tput << "\n";
+      if (n_threads == 8) tput_8_threads[n_stripes] = tput;
+    }
+  }
+
+  output_file.close();
+  if (thread::hardware_concurrency() > 1) {
+    ASSERT(tput_8_threads[STRIPE_COUNTS.back()] > tput_8_threads[1]);
+  }
+}
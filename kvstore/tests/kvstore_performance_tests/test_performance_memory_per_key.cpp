@@ -0,0 +1,75 @@
+#include <iomanip>
+
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+// Raise to 10'000'000 to reproduce the full-size comparison (it needs a few GB
+// of memory).
+static constexpr size_t N_KEYS = 500'000;
+static constexpr size_t KEY_LEN = 24;
+static constexpr size_t VALUE_LEN = 100;
+
+// Heap bytes a std::string of length `len` costs under libstdc++ and glibc:
+// nothing if it fits in the small-string buffer, otherwise a malloc chunk of
+// len + 1 bytes plus an 8-byte header, rounded up to 16 bytes.
+static size_t string_heap_bytes(size_t len) {
+  if (len <= 15) return 0;
+  size_t chunk = len + 1 + 8;
+  return std::max<size_t>(32, (chunk + 15) / 16 * 16);
+}
+
+int main(int argc, char* argv[]) {
+  /*
+    This test loads N_KEYS keys of KEY_LEN bytes with values of VALUE_LEN
+    bytes (our typical sizes) into a ConcurrentKvStore, then reports how many
+    bytes of memory the store uses per key, next to an estimate of what the
+    same keys cost when every DbItem held two heap-allocated std::strings.
+    Packed into the arena, a key's live bytes should be its payload plus a
+    12-byte record header, and the store as a whole, table included, should
+    take well under the std::string layout's bytes per key (which is
+    asserted), since neither string gets a malloc chunk of its own.
+  */
+  ConcurrentKvStore store;
+
+  auto key_prefixes = make_rand_strs(N_KEYS / 1000, KEY_LEN - 8);
+  string value(VALUE_LEN, 'v');
+  auto put_req = PutRequest{};
+  auto put_res = PutResponse{};
+  for (size_t i = 0; i < N_KEYS; i++) {
+    // Random prefix plus an 8-digit counter, so every key is distinct.
+    ostringstream key;
+    key << key_prefixes[i % key_prefixes.size()] << setw(8) << setfill('0')
+        << i;
+    put_req.key = key.str();
+    put_req.value = value;
+    ASSERT(store.Put(&put_req, &put_res));
+  }
+
+  DbMemoryStats stats = store.memoryStats();
+  ASSERT_EQ(stats.n_keys, N_KEYS);
+  ASSERT_EQ(stats.payload_bytes, N_KEYS * (KEY_LEN + VALUE_LEN));
+
+  // The previous layout: a slot per item holding two std::strings, each
+  // spilling to the heap, in bucket tables that are as full as ours.
+  double slot_fill = static_cast<double>(stats.table_bytes) /
+                     (N_KEYS * (sizeof(int8_t) + sizeof(DbItem)));
+  double string_layout_per_key =
+      slot_fill * (sizeof(int8_t) + 2 * sizeof(string)) +
+      string_heap_bytes(KEY_LEN) + string_heap_bytes(VALUE_LEN);
+
+  auto per_key = [&](size_t bytes) {
+    return static_cast<double>(bytes) / stats.n_keys;
+  };
+  cout << fixed << setprecision(1);
+  cout << "keys:                    " << stats.n_keys << "\n";
+  cout << "payload bytes/key:       " << per_key(stats.payload_bytes) << "\n";
+  cout << "arena bytes/key:         " << per_key(stats.arena_reserved_bytes)
+       << " (live " << per_key(stats.arena_live_bytes) << ", dead "
+       << per_key(stats.arena_dead_bytes) << ")\n";
+  cout << "table bytes/key:         " << per_key(stats.table_bytes) << "\n";
+  cout << "total bytes/key:         " << stats.bytesPerKey() << "\n";
+  cout << "std::string layout (est): " << string_layout_per_key << "\n";
+
+  ASSERT(stats.bytesPerKey() < string_layout_per_key);
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "client/simple_client.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_KEYS = 100000;
+static constexpr size_t VALUE_SIZE = 100;
+static constexpr size_t BATCH_SIZE = 1000;
+static constexpr chrono::milliseconds GET_INTERVAL{1};
+
+int main() {
+  /*
+    This benchmark measures how long a server stops serving keys that aren't
+    moving while it migrates a shard to another server. One server starts out
+    with every shard and N_KEYS pairs, half of them in [N, Z], which then
+    moves to a second server. Meanwhile, a client Gets one of the other half
+    of the keys from the first server every GET_INTERVAL, and times each Get,
+    until the second server has every moved pair. Since no chunk holds a
+    lock for long, the max Get should stay under a tenth of the migration's
+    total time (which is asserted), rather than approach it.
+  */
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+  vector<string> addrs = make_server_addresses(2);
+  vector<shared_ptr<KvServer>> servers;
+  for (auto&& addr : addrs) {
+    servers.push_back(
+        start_server<KvServer, const std::string&, const std::string&,
+                     uint64_t>(addr, sm_addr, N_WORKERS));
+  }
+  ASSERT(test_move(sm, addrs[0], vector<Shard>{{"0", "Z"}}));
+  // Let the servers pick up their shards
+  this_thread::sleep_for(500ms);
+
+  vector<string> staying = make_rand_strs(N_KEYS / 2, 8, "ABCDEFGHIJKLM");
+  vector<string> moving = make_rand_strs(N_KEYS / 2, 8, "NOPQRSTUVWXYZ");
+  vector<string> values;
+  for (size_t i = 0; i < N_KEYS / 2; i++) {
+    values.push_back(to_string(i) + string(VALUE_SIZE, 'v'));
+  }
+  SimpleClient source(addrs[0]);
+  for (auto* keys : {&staying, &moving}) {
+    for (size_t i = 0; i < keys->size(); i += BATCH_SIZE) {
+      vector<string> batch_keys(keys->begin() + i,
+                                keys->begin() + i + BATCH_SIZE);
+      vector<string> batch_values(values.begin() + i,
+                                  values.begin() + i + BATCH_SIZE);
+      ASSERT(source.MultiPut(batch_keys, batch_values));
+    }
+  }
+
+  // Get staying keys until told to stop, timing each Get.
+  atomic<bool> done = false;
+  vector<double> latencies;
+  thread reader([&] {
+    shared_ptr<ServerConn> conn = connect_to_server(addrs[0]);
+    ASSERT(conn);
+    for (size_t i = 0; !done; i = (i + 1) % staying.size()) {
+      auto start = chrono::steady_clock::now();
+      ASSERT(conn->send_request(GetRequest{staying[i]}));
+      optional<Response> res = conn->recv_response();
+      chrono::duration<double, milli> latency =
+          chrono::steady_clock::now() - start;
+      ASSERT(res);
+      auto* get = get_if<GetResponse>(&*res);
+      ASSERT(get && get->value == values[i]);
+      latencies.push_back(latency.count());
+      this_thread::sleep_for(GET_INTERVAL);
+    }
+  });
+
+  auto start = chrono::steady_clock::now();
+  ASSERT(test_move(sm, addrs[1], vector<Shard>{{"N", "Z"}}));
+  // Check the moved pairs a batch at a time, waiting for any batch that hasn't
+  // all arrived yet.
+  SimpleClient dest(addrs[1]);
+  for (size_t i = 0; i < moving.size();) {
+    vector<string> batch_keys(moving.begin() + i,
+                              moving.begin() + i + BATCH_SIZE);
+    vector<string> batch_values(values.begin() + i,
+                                values.begin() + i + BATCH_SIZE);
+    if (dest.MultiGet(batch_keys) == batch_values) {
+      i += BATCH_SIZE;
+    } else {
+      this_thread::sleep_for(1ms);
+    }
+  }
+  chrono::duration<double, milli> migration_time =
+      chrono::steady_clock::now() - start;
+  done = true;
+  reader.join();
+
+  for (auto&& server : servers) server->stop();
+  sm->stop();
+
+  sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[min(latencies.size() - 1, size_t(p * latencies.size()))];
+  };
+  cout << fixed << setprecision(3);
+  cout << "Moving " << N_KEYS / 2 << " of " << N_KEYS << " pairs (ms)\n";
+  cout << setw(24) << "migration" << setw(12) << migration_time.count()
+       << "\n";
+  cout << setw(24) << "Gets during migration" << setw(12) << latencies.size()
+       << "\n";
+  cout << setw(24) << "p50 Get" << setw(12) << percentile(0.5) << "\n";
+  cout << setw(24) << "p99 Get" << setw(12) << percentile(0.99) << "\n";
+  cout << setw(24) << "max Get" << setw(12) << latencies.back() << "\n";
+  ASSERT(latencies.back() < migration_time.count() / 10);
+}
@@ -0,0 +1,127 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+
+#include "kvstore/logged_kvstore.hpp"
+#include "kvstore/snapshot.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_KEYS = 1'000'000;
+
+static const vector<size_t> THREAD_COUNTS = {1, 2, 4, 8};
+
+template <typename F>
+static chrono::milliseconds time_it(F&& f) {
+  auto start = chrono::high_resolution_clock::now();
+  f();
+  auto end = chrono::high_resolution_clock::now();
+  return chrono::duration_cast<chrono::milliseconds>(end - start);
+}
+
+int main(int argc, char* argv[]) {
+  std::ofstream output_file("performance-recovery.csv", std::ios::app);
+  if (!output_file.is_open()) {
+    std::cerr << "Failed to open output file." << std::endl;
+  }
+  output_file << "method,threads,keys,time\n";
+
+  /*
+    This benchmark measures how long a logged ConcurrentKvStore of N_KEYS
+    keys takes to recover after a restart: by replaying its whole log, one
+    record at a time, and by loading a snapshot of it, which is read mmapped
+    and loaded a stripe per thread into a table sized up front, for each
+    thread count. It also measures how long taking the snapshot takes, and
+    the longest a Put waits meanwhile, since a stripe's writes wait while the
+    stripe is read: only that long, not the whole snapshot, so under a
+    twentieth of it (which is asserted). Loading the snapshot should be
+    several times faster than replaying the log even on one thread, since it
+    doesn't decode requests or grow the table (at least twice as fast with
+    every thread count is asserted), and scale with the number of cores.
+  */
+  string dir = filesystem::temp_directory_path();
+  string pid = to_string(getpid());
+  WalOptions options;
+  options.path = dir + "/performance_recovery_" + pid + ".log";
+  options.sync = SyncPolicy::NEVER;
+  vector<string> keys = make_rand_strs(N_KEYS, 16);
+  vector<string> vals = make_rand_strs(N_KEYS, 32);
+
+  {
+    auto store = LoggedKvStore::open(make_unique<ConcurrentKvStore>(), options);
+    ASSERT(store);
+    PutRequest req;
+    PutResponse res;
+    for (size_t i = 0; i < N_KEYS; i++) {
+      req.key = keys[i];
+      req.value = vals[i];
+      ASSERT(store->Put(&req, &res));
+    }
+  }
+
+  cout << setw(10) << "method" << setw(8) << "threads" << setw(10) << "keys"
+       << setw(10) << "ms" << "\n";
+  auto report = [&](const string& method, size_t n_threads, size_t n_keys,
+                    chrono::milliseconds time) {
+    cout << setw(10) << method << setw(8) << n_threads << setw(10) << n_keys
+         << setw(10) << time.count() << "\n";
+    output_file << method << "," << n_threads << "," << n_keys << ","
+                << time.count() << "\n";
+  };
+
+  unique_ptr<LoggedKvStore> store;
+  auto replay_time = time_it([&] {
+    store = LoggedKvStore::open(make_unique<ConcurrentKvStore>(), options);
+  });
+  ASSERT(store);
+  ASSERT_EQ(store->AllKeys().size(), N_KEYS);
+  report("replay", 1, N_KEYS, replay_time);
+  store.reset();
+
+  // Reopen as snapshotted, and snapshot while a writer keeps writing.
+  options.snapshot_path = dir + "/performance_recovery_" + pid + ".snap";
+  store = LoggedKvStore::open(make_unique<ConcurrentKvStore>(), options);
+  ASSERT(store);
+  atomic<bool> done = false;
+  chrono::microseconds max_wait{0};
+  thread writer([&] {
+    PutRequest req;
+    PutResponse res;
+    for (size_t i = 0; !done; i = (i + 1) % N_KEYS) {
+      req.key = keys[i];
+      req.value = vals[i];
+      auto start = chrono::steady_clock::now();
+      ASSERT(store->Put(&req, &res));
+      auto wait = chrono::duration_cast<chrono::microseconds>(
+          chrono::steady_clock::now() - start);
+      max_wait = max(max_wait, wait);
+    }
+  });
+  auto snapshot_time = time_it([&] { ASSERT(store->snapshot()); });
+  done = true;
+  writer.join();
+  report("snapshot", 1, N_KEYS, snapshot_time);
+  cout << "longest Put during the snapshot: " << max_wait.count() << "us\n";
+  ASSERT(max_wait < snapshot_time / 20);
+  store.reset();
+
+  for (size_t n_threads : THREAD_COUNTS) {
+    ConcurrentKvStore loaded;
+    optional<vector<uint64_t>> cuts;
+    auto load_time = time_it([&] {
+      cuts = load_snapshot(options.snapshot_path, loaded, n_threads);
+    });
+    ASSERT(cuts);
+    ASSERT_EQ(loaded.AllKeys().size(), N_KEYS);
+    report("load", n_threads, N_KEYS, load_time);
+    ASSERT(load_time < replay_time / 2);
+  }
+
+  filesystem::remove(options.snapshot_path);
+  filesystem::remove(options.path);
+  output_file.close();
+}
@@ -0,0 +1,59 @@
+#include <iomanip>
+
+#include "common/config.hpp"
+#include "common/shard.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_SERVERS = 32;
+static constexpr size_t N_LOOKUPS = 200000;
+static constexpr size_t SHARD_COUNTS[] = {8, 64, 1024};
+
+int main() {
+  /*
+    This benchmark measures how long finding the server for a key takes, as
+    every request does, with ShardControllerConfig::get_server, which walks
+    every server's shards with an upper-cased copy of the key, and with a
+    ShardTable built from the same config, which binary searches them. The
+    shards are dealt out to N_SERVERS servers in turn. The walk grows
+    linearly with the number of shards, and the search only with its log, so
+    the gap between the two columns widens down the table: the search should
+    be faster at every size, and at least 10x faster with 1024 shards (both
+    asserted).
+  */
+  string valid_chars(VALID_CHARS.begin(), VALID_CHARS.end());
+  valid_chars += "abcdefghijklmnopqrstuvwxyz";
+  vector<string> keys = make_rand_strs(N_LOOKUPS, 12, valid_chars);
+  vector<string> addrs = make_server_addresses(N_SERVERS);
+
+  cout << fixed << setprecision(1);
+  cout << setw(8) << "shards" << setw(16) << "get_server ns" << setw(16)
+       << "ShardTable ns" << "\n";
+  for (size_t n_shards : SHARD_COUNTS) {
+    ShardControllerConfig config;
+    vector<Shard> shards = split_into(n_shards);
+    for (size_t i = 0; i < shards.size(); i++) {
+      config.server_to_shards[addrs[i % N_SERVERS]].push_back(shards[i]);
+    }
+    ShardTable table(config);
+
+    size_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for (auto&& key : keys) found += config.get_server(key).has_value();
+    chrono::duration<double, nano> walk = chrono::steady_clock::now() - start;
+    ASSERT_EQ(found, N_LOOKUPS);
+
+    found = 0;
+    start = chrono::steady_clock::now();
+    for (auto&& key : keys) found += table.get_server(key) != nullptr;
+    chrono::duration<double, nano> search =
+        chrono::steady_clock::now() - start;
+    ASSERT_EQ(found, N_LOOKUPS);
+
+    cout << setw(8) << n_shards << setw(16) << walk.count() / N_LOOKUPS
+         << setw(16) << search.count() / N_LOOKUPS << "\n";
+    ASSERT(search < walk);
+    if (n_shards == 1024) ASSERT(search * 10 < walk);
+  }
+}
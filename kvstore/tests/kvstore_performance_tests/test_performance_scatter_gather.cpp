@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "client/shardkv_client.hpp"
+#include "common/shard.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_SERVERS = 8;
+static constexpr size_t N_BATCH_KEYS = 400;
+static constexpr size_t N_BATCHES = 200;
+
+// Times f, in milliseconds.
+template <typename F>
+static double time_ms(F f) {
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+static double median(vector<double> times) {
+  sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+int main() {
+  /*
+    This benchmark compares cross-shard MultiGets of N_BATCH_KEYS keys spread
+    over N_SERVERS servers made two ways: by sending each server its share of
+    the keys in turn, waiting for each response before the next request, and
+    by ShardKvClient::MultiGet, which sends every server its share at once.
+    Both find each key's server the same way, in a ShardTable. The first
+    takes about the sum of the servers' latencies, the second about the
+    slowest one's, so the second should be faster (which is asserted). Over
+    loopback, where a server's latency is mostly its own CPU time, the gap is
+    much less than that suggests: about 15% with every server on one core.
+    The two alternate, batch by batch, so that both see the same noise, and
+    the median batch of each is compared.
+  */
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+
+  vector<string> server_addresses = make_server_addresses(N_SERVERS);
+  vector<Shard> shards = split_into(N_SERVERS);
+  vector<shared_ptr<KvServer>> servers;
+  for (size_t i = 0; i < N_SERVERS; i++) {
+    servers.push_back(
+        start_server<KvServer, const std::string&, const std::string&,
+                     uint64_t>(server_addresses[i], sm_addr, N_WORKERS));
+    ASSERT(test_move(sm, server_addresses[i], vector<Shard>{shards[i]}));
+  }
+  // Let the servers pick up their shards
+  this_thread::sleep_for(500ms);
+
+  ShardKvClient client(sm_addr);
+  string valid_chars(VALID_CHARS.begin(), VALID_CHARS.end());
+  vector<string> keys = make_rand_strs(N_BATCH_KEYS, 8, valid_chars);
+  vector<string> values = make_rand_strs(N_BATCH_KEYS, 32);
+  ASSERT(client.MultiPut(keys, values));
+
+  optional<ShardControllerConfig> config = client.Query();
+  ASSERT(config);
+  ShardTable table(*config);
+
+  vector<double> sequential, scattered;
+  for (size_t b = 0; b < N_BATCHES; b++) {
+    sequential.push_back(time_ms([&] {
+      // The keys each server is responsible for, and where they go in the
+      // result
+      map<string, pair<vector<string>, vector<size_t>>> by_server;
+      for (size_t i = 0; i < N_BATCH_KEYS; i++) {
+        const string* server = table.get_server(keys[i]);
+        ASSERT(server);
+        by_server[*server].first.push_back(keys[i]);
+        by_server[*server].second.push_back(i);
+      }
+      ASSERT_EQ(by_server.size(), N_SERVERS);
+      vector<string> res(N_BATCH_KEYS);
+      for (auto&& [server, batch] : by_server) {
+        optional<vector<string>> got =
+            SimpleClient(server).MultiGet(batch.first);
+        ASSERT(got);
+        for (size_t j = 0; j < got->size(); j++) {
+          res[batch.second[j]] = (*got)[j];
+        }
+      }
+      ASSERT_EQ_VECS(res, values);
+    }));
+
+    scattered.push_back(time_ms([&] {
+      optional<vector<string>> res = client.MultiGet(keys);
+      ASSERT(res);
+      ASSERT_EQ_VECS(*res, values);
+    }));
+  }
+
+  for (auto&& server : servers) server->stop();
+  sm->stop();
+
+  cout << fixed << setprecision(3);
+  cout << "MultiGet of " << N_BATCH_KEYS << " keys over " << N_SERVERS
+       << " servers (median ms)\n";
+  cout << setw(24) << "one server at a time" << setw(10) << median(sequential)
+       << "\n";
+  cout << setw(24) << "all servers at once" << setw(10) << median(scattered)
+       << "\n";
+  ASSERT(median(scattered) < median(sequential));
+}
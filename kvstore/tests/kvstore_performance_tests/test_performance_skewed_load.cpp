@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_COLD_CLIENTS = 4 * N_WORKERS;
+static constexpr size_t N_COLD_REQUESTS = 200;
+// The hot client keeps this many MultiPuts of HOT_BATCH_KEYS keys each in
+// flight at all times.
+static constexpr size_t HOT_PIPELINE = 32;
+static constexpr size_t HOT_BATCH_KEYS = 256;
+
+// Runs N_COLD_CLIENTS clients that each send a Get every millisecond or so,
+// and returns the round-trip time of every Get, in microseconds, sorted.
+static vector<double> run_cold_clients(const string& addr) {
+  vector<vector<double>> latencies(N_COLD_CLIENTS);
+  vector<thread> threads;
+  for (size_t i = 0; i < N_COLD_CLIENTS; i++) {
+    threads.emplace_back([&, i] {
+      shared_ptr<ServerConn> conn = connect_to_server(addr);
+      ASSERT(conn);
+      string key = "cold" + to_string(i);
+      ASSERT(conn->send_request(PutRequest{key, key}));
+      ASSERT(conn->recv_response());
+      for (size_t j = 0; j < N_COLD_REQUESTS; j++) {
+        auto start = chrono::steady_clock::now();
+        ASSERT(conn->send_request(GetRequest{key}));
+        optional<Response> res = conn->recv_response();
+        auto end = chrono::steady_clock::now();
+        ASSERT(res);
+        auto* get = get_if<GetResponse>(&*res);
+        ASSERT(get && get->value == key);
+        latencies[i].push_back(
+            chrono::duration<double, micro>(end - start).count());
+        this_thread::sleep_for(1ms);
+      }
+    });
+  }
+  for (auto&& thr : threads) thr.join();
+
+  vector<double> all;
+  for (auto&& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  sort(all.begin(), all.end());
+  return all;
+}
+
+static double percentile(const vector<double>& sorted, double p) {
+  return sorted[min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+// The cold clients' Get latencies without and then with the hot client, on a
+// server with n_workers workers, and the hot client's MultiPuts/s.
+struct Run {
+  vector<double> idle;
+  vector<double> skewed;
+  double hot_rate;
+};
+
+static Run run(const string& addr, uint64_t n_workers) {
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr,
+                                                           uint64_t{n_workers});
+
+  Run r;
+  r.idle = run_cold_clients(addr);
+
+  atomic<bool> done = false;
+  size_t hot_batches = 0;
+  chrono::duration<double> hot_time;
+  thread hot([&] {
+    shared_ptr<ServerConn> conn = connect_to_server(addr);
+    ASSERT(conn);
+    vector<string> keys = make_rand_strs(HOT_BATCH_KEYS, 16);
+    vector<string> values(HOT_BATCH_KEYS, string(64, 'v'));
+    MultiPutRequest req{keys, values};
+    for (size_t i = 0; i < HOT_PIPELINE; i++) {
+      ASSERT(conn->send_request(req));
+    }
+    auto start = chrono::steady_clock::now();
+    while (!done) {
+      ASSERT(conn->recv_response());
+      ASSERT(conn->send_request(req));
+      hot_batches++;
+    }
+    hot_time = chrono::steady_clock::now() - start;
+    for (size_t i = 0; i < HOT_PIPELINE; i++) {
+      ASSERT(conn->recv_response());
+    }
+  });
+  // Let the hot client get going before measuring.
+  this_thread::sleep_for(100ms);
+  r.skewed = run_cold_clients(addr);
+  done = true;
+  hot.join();
+  server->stop();
+  r.hot_rate = hot_batches / hot_time.count();
+  return r;
+}
+
+int main() {
+  /*
+    This benchmark measures how a single hot client affects the latency of
+    many cold ones. Cold clients send a Get now and then; the hot client keeps
+    HOT_PIPELINE large MultiPuts in flight, so whichever worker owns its
+    connection always has more of its requests to process. Cold clients that
+    happen to share that worker are served by the others (which steal them)
+    instead of queuing behind the hot client. As a baseline, the same runs
+    against a server with one worker, which has no one to share with, so that
+    every cold client waits out the hot client's turn: the cold clients' p99
+    with the hot client should be lower with N_WORKERS stealing workers
+    (which is asserted; about 2ms against 15ms, even with every worker on
+    one core). The hot client's MultiPuts/s shows it was kept busy
+    throughout.
+  */
+  Run stealing = run(get_host_address("9000"), N_WORKERS);
+  Run single = run(get_host_address("9001"), 1);
+
+  cout << fixed << setprecision(0);
+  cout << setw(28) << "cold Get (us)" << setw(10) << "p50" << setw(10)
+       << "p99" << setw(10) << "max" << setw(16) << "hot MultiPuts/s"
+       << "\n";
+  for (auto&& [name, r] : {pair<string, Run&>{"stealing", stealing},
+                           pair<string, Run&>{"one worker", single}}) {
+    cout << setw(28) << name + ", alone" << setw(10) << percentile(r.idle, 0.5)
+         << setw(10) << percentile(r.idle, 0.99) << setw(10) << r.idle.back()
+         << "\n";
+    cout << setw(28) << name + ", with hot client" << setw(10)
+         << percentile(r.skewed, 0.5) << setw(10) << percentile(r.skewed, 0.99)
+         << setw(10) << r.skewed.back() << setw(16) << r.hot_rate << "\n";
+  }
+  ASSERT(percentile(stealing.skewed, 0.99) < percentile(single.skewed, 0.99));
+}
@@ -0,0 +1,103 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#include "kvstore/logged_kvstore.hpp"
+#include "test_utils/test_utils.hpp"
+
+using namespace std;
+
+static constexpr size_t N_KEYS = 8'192;
+// How long each run writes for.
+static constexpr chrono::milliseconds RUN_TIME{1000};
+
+static const vector<size_t> THREAD_COUNTS = {1, 2, 4, 8, 16, 32};
+
+int main(int argc, char* argv[]) {
+  std::ofstream output_file("performance-wal.csv", std::ios::app);
+  if (!output_file.is_open()) {
+    std::cerr << "Failed to open output file." << std::endl;
+  }
+  output_file << "sync,threads,writes,tput\n";
+
+  /*
+    This benchmark measures how many Puts a logged ConcurrentKvStore
+    acknowledges per second, under each sync policy, as the number of writer
+    threads grows. Each run writes random keys from every thread for
+    RUN_TIME. Syncing on every write costs an fdatasync per acknowledgement
+    for a single writer, but writers that arrive while a sync is under way
+    share the next one (group commit), so throughput should grow with the
+    number of writers, until the log's mutex or the disk's bandwidth is the
+    limit: 8 writers should manage at least twice what 1 does (which is
+    asserted). Syncing every 10ms, or never, only costs the write() itself.
+  */
+  string path = filesystem::temp_directory_path() /
+                ("performance_wal_" + to_string(getpid()) + ".log");
+  vector<string> keys = make_rand_strs(N_KEYS, 32);
+  vector<string> vals = make_rand_strs(N_KEYS, 32);
+
+  vector<pair<string, WalOptions>> policies = {
+      {"always", {path, SyncPolicy::ALWAYS}},
+      {"10ms", {path, SyncPolicy::INTERVAL, 10ms}},
+      {"none", {path, SyncPolicy::NEVER}},
+  };
+
+  // Writes/s syncing on every write, by number of writers.
+  map<size_t, double> always_tput;
+  cout << setw(8) << "sync" << setw(8) << "threads" << setw(10) << "writes"
+       << setw(14) << "writes/s" << "\n";
+  for (auto&& [name, options] : policies) {
+    for (size_t n_threads : THREAD_COUNTS) {
+      filesystem::remove(path);
+      auto store =
+          LoggedKvStore::open(make_unique<ConcurrentKvStore>(), options);
+      ASSERT(store);
+
+      atomic<size_t> n_writes = 0;
+      auto deadline = chrono::steady_clock::now() + RUN_TIME;
+      auto work = [&](size_t tid) {
+        std::mt19937 rng(tid);
+        std::uniform_int_distribution<size_t> pick(0, N_KEYS - 1);
+        auto put_req = PutRequest{};
+        auto put_res = PutResponse{};
+        size_t n = 0;
+        while (chrono::steady_clock::now() < deadline) {
+          size_t k = pick(rng);
+          put_req.key = keys[k];
+          put_req.value = vals[k];
+          ASSERT(store->Put(&put_req, &put_res));
+          n++;
+        }
+        n_writes += n;
+      };
+
+      auto start = chrono::high_resolution_clock::now();
+      {
+        vector<thread> threads;
+        for (size_t t = 0; t < n_threads; t++) {
+          threads.emplace_back(work, t);
+        }
+        for (auto& t : threads) {
+          t.join();
+        }
+      }
+      auto end = chrono::high_resolution_clock::now();
+      auto time = chrono::duration_cast<chrono::milliseconds>(end - start);
+      double tput = to_throughput(time, 1, n_writes);
+
+      cout << setw(8) << name << setw(8) << n_threads << setw(10) << n_writes
+           << setw(14) << static_cast<size_t>(tput) << "\n";
+      output_file << name << "," << n_threads << "," << n_writes << ","
+                  << tput << "\n";
+      if (name == "always") always_tput[n_threads] = tput;
+    }
+  }
+  filesystem::remove(path);
+
+  output_file.close();
+  ASSERT(always_tput[8] >= 2 * always_tput[1]);
+}
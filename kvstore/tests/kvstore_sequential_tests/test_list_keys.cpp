@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "test_utils/test_utils.hpp"
+
+constexpr std::size_t kNumKeys = 5000;
+constexpr std::size_t kNumAddedKeys = 40'000;
+constexpr std::size_t kPageSize = 100;
+
+// Walks every key in `store` a page at a time, calling `between_pages` after
+// each page, and returns how many times each key was seen.
+template <typename Fn>
+std::unordered_map<std::string, std::size_t> walk_keys(KvStore& store,
+                                                       Fn&& between_pages) {
+  std::unordered_map<std::string, std::size_t> seen;
+  auto list_req = ListKeysRequest{.cursor = 0, .limit = kPageSize};
+  do {
+    auto list_res = ListKeysResponse{};
+    ASSERT(store.ListKeys(&list_req, &list_res));
+    // Pages only run over the limit by part of a bucket.
+    ASSERT(list_res.keys.size() <= 2 * kPageSize);
+    for (auto&& key : list_res.keys) seen[key]++;
+    list_req.cursor = list_res.cursor;
+    between_pages();
+  } while (list_req.cursor != 0);
+  return seen;
+}
+
+int main(int argc, char* argv[]) {
+  auto store = make_kvstore(argc, argv);
+
+  auto keys = make_rand_strs(kNumKeys + kNumAddedKeys, 12);
+  std::vector<std::string> initial(keys.begin(), keys.begin() + kNumKeys);
+  ASSERT(put_range(*store, keys, keys, 0, kNumKeys));
+
+  // Without writes, a walk returns every key exactly once.
+  auto seen = walk_keys(*store, [] {});
+  ASSERT_EQ(seen.size(), kNumKeys);
+  for (auto&& key : initial) {
+    ASSERT_EQ(seen[key], std::size_t{1});
+  }
+
+  // Grow the store many times over during a walk, and delete some of the
+  // keys added along the way. Every key that was there throughout must still
+  // turn up, and nothing that was never added may.
+  std::size_t next = kNumKeys;
+  seen = walk_keys(*store, [&] {
+    std::size_t end = std::min(next + 500, keys.size());
+    ASSERT(put_range(*store, keys, keys, next, end));
+    for (std::size_t i = next; i < end; i += 4) {
+      auto delete_req = DeleteRequest{.key = keys[i]};
+      auto delete_res = DeleteResponse{};
+      ASSERT(store->Delete(&delete_req, &delete_res));
+    }
+    next = end;
+  });
+  for (auto&& key : initial) {
+    ASSERT(seen[key] >= 1);
+  }
+  std::unordered_set<std::string> all(keys.begin(), keys.end());
+  for (auto&& [key, count] : seen) {
+    ASSERT(all.count(key));
+  }
+}
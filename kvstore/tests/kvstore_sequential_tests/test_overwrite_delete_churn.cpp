@@ -0,0 +1,50 @@
+#include "test_utils/test_utils.hpp"
+
+int main(int argc, char* argv[]) {
+  auto store = make_kvstore(argc, argv);
+
+  // Repeatedly overwrite, grow, and delete the same keys, so that a store
+  // which packs values into shared memory has to move and reclaim them, and
+  // check that every key keeps its latest value throughout.
+  constexpr std::size_t n_keys = 4000;
+  constexpr std::size_t n_rounds = 20;
+  auto keys = make_rand_strs(n_keys, 16);
+  std::vector<std::string> expected(n_keys);
+
+  for (std::size_t round = 0; round < n_rounds; round++) {
+    for (std::size_t i = 0; i < n_keys; i++) {
+      // Values alternate between shrinking and growing across rounds.
+      std::string value(round % 2 ? 8 : 32 + round * 8, 'a' + round % 26);
+      if (round % 5 == 4 && i % 2 == 0) {
+        auto append_req = AppendRequest{.key = keys[i], .value = value};
+        auto append_res = AppendResponse{};
+        ASSERT(store->Append(&append_req, &append_res));
+        expected[i] += value;
+      } else {
+        auto put_req = PutRequest{.key = keys[i], .value = value};
+        auto put_res = PutResponse{};
+        ASSERT(store->Put(&put_req, &put_res));
+        expected[i] = value;
+      }
+    }
+
+    // Delete every third key, and check the rest.
+    for (std::size_t i = round % 3; i < n_keys; i += 3) {
+      auto delete_req = DeleteRequest{.key = keys[i]};
+      auto delete_res = DeleteResponse{};
+      ASSERT(store->Delete(&delete_req, &delete_res));
+      ASSERT_EQ(delete_res.value, expected[i]);
+      expected[i].clear();
+    }
+    for (std::size_t i = 0; i < n_keys; i++) {
+      auto get_req = GetRequest{.key = keys[i]};
+      auto get_res = GetResponse{};
+      if (expected[i].empty()) {
+        ASSERT(!store->Get(&get_req, &get_res));
+      } else {
+        ASSERT(store->Get(&get_req, &get_res));
+        ASSERT_EQ(get_res.value, expected[i]);
+      }
+    }
+  }
+}
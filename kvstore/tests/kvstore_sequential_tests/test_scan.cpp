@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <map>
+
+#include "test_utils/test_utils.hpp"
+
+constexpr std::size_t kNumKeys = 5000;
+constexpr std::size_t kNumShards = 7;
+
+// Checks that Scan returns exactly the pairs in each shard, in order, for a
+// store holding the pairs in `expected`.
+bool check_shard_scans(KvStore& store,
+                       const std::map<std::string, std::string>& expected) {
+  std::size_t total = 0;
+  for (auto&& shard : split_into(kNumShards)) {
+    std::vector<std::string> keys;
+    for (auto&& [key, value] : expected) {
+      if (shard.contains(to_upper(key))) keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end(), key_less);
+
+    auto [start, end] = shard.key_range();
+    auto scan_req = ScanRequest{.start = start, .end = end};
+    auto scan_res = ScanResponse{};
+    ASSERT(store.Scan(&scan_req, &scan_res));
+    ASSERT_EQ_VECS(scan_res.keys, keys);
+    ASSERT_EQ(scan_res.values.size(), keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(scan_res.values[i], expected.at(keys[i]));
+    }
+    total += keys.size();
+  }
+  // The shards cover every key between them.
+  ASSERT_EQ(total, expected.size());
+  return true;
+}
+
+bool test_scan(KvStore& store) {
+  // Mixed-case keys, so that keys differing only in case are ordered
+  // consistently with how shards bucket them.
+  auto keys = make_rand_strs(kNumKeys, 8);
+  keys.push_back("abcdefgh");
+  keys.push_back("ABCDEFGH");
+  keys.push_back("aBcDeFgH");
+
+  std::map<std::string, std::string> expected;
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    auto put_req = PutRequest{.key = keys[i], .value = std::to_string(i)};
+    auto put_res = PutResponse{};
+    ASSERT(store.Put(&put_req, &put_res));
+    expected[keys[i]] = put_req.value;
+  }
+  ASSERT(check_shard_scans(store, expected));
+
+  // Deleted keys drop out of scans, and overwritten keys show their new value.
+  for (std::size_t i = 0; i < keys.size(); i += 3) {
+    auto delete_req = DeleteRequest{.key = keys[i]};
+    auto delete_res = DeleteResponse{};
+    ASSERT(store.Delete(&delete_req, &delete_res));
+    expected.erase(keys[i]);
+  }
+  for (std::size_t i = 1; i < keys.size(); i += 3) {
+    auto append_req = AppendRequest{.key = keys[i], .value = "!"};
+    auto append_res = AppendResponse{};
+    ASSERT(store.Append(&append_req, &append_res));
+    expected[keys[i]] += "!";
+  }
+  ASSERT(check_shard_scans(store, expected));
+
+  // A limit returns a prefix of the unlimited scan.
+  auto full_req = ScanRequest{.start = "", .end = ""};
+  auto full_res = ScanResponse{};
+  ASSERT(store.Scan(&full_req, &full_res));
+  ASSERT_EQ(full_res.keys.size(), expected.size());
+
+  auto limit_req = ScanRequest{.start = "", .end = "", .limit = 100};
+  auto limit_res = ScanResponse{};
+  ASSERT(store.Scan(&limit_req, &limit_res));
+  ASSERT_EQ(limit_res.keys.size(), std::size_t{100});
+  ASSERT(std::equal(limit_res.keys.begin(), limit_res.keys.end(),
+                    full_res.keys.begin()));
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  auto store = make_kvstore(argc, argv);
+  ASSERT(test_scan(*store));
+
+  // Also exercise ConcurrentKvStore's ordered index, which make_kvstore
+  // doesn't turn on.
+  ConcurrentKvStore ordered_store(std::hash<std::string>(),
+                                  DbMap::DEFAULT_STRIPE_COUNT, true);
+  ASSERT(test_scan(ordered_store));
+}
@@ -0,0 +1,136 @@
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "common/compression.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+static vector<byte> to_bytes(const string& s) {
+  vector<byte> bytes(s.size());
+  memcpy(bytes.data(), s.data(), s.size());
+  return bytes;
+}
+
+// Incompressible data.
+static string random_bytes(size_t size) {
+  mt19937 generator(size);
+  uniform_int_distribution<int> dist(0, 255);
+  string s(size, '\0');
+  for (char& c : s) c = char(dist(generator));
+  return s;
+}
+
+// Compresses data and decompresses it again; returns the compressed size.
+static size_t round_trip(const string& data) {
+  vector<byte> src = to_bytes(data);
+  vector<byte> packed(lz_compress_bound(src.size()));
+  size_t packed_size = lz_compress(src, packed.data());
+  ASSERT(packed_size <= packed.size());
+  packed.resize(packed_size);
+
+  vector<byte> out(src.size());
+  ASSERT(lz_decompress(packed, out));
+  ASSERT(out == src);
+  // It has to be told exactly how big the data was.
+  vector<byte> bigger(src.size() + 1);
+  ASSERT(!lz_decompress(packed, bigger));
+  if (!src.empty()) {
+    vector<byte> smaller(src.size() - 1);
+    ASSERT(!lz_decompress(packed, smaller));
+  }
+  return packed_size;
+}
+
+int main() {
+  // Anything compresses and decompresses back to what it was...
+  round_trip("");
+  round_trip("a");
+  round_trip("short string");
+  for (size_t size : {size_t{100}, size_t{4096}, size_t{1} << 20}) {
+    round_trip(random_bytes(size));
+  }
+  // ... and repetitive data shrinks, including runs a match overlaps.
+  ASSERT(round_trip(string(1 << 20, 'a')) < 5000);
+  string text;
+  while (text.size() < (200 << 10)) {
+    text += "put post_" + to_string(text.size() % 97) + " " + random_string(3);
+  }
+  ASSERT(round_trip(text) < text.size() / 2);
+
+  // Corrupt blocks are rejected, not read or written past.
+  vector<byte> src = to_bytes(text);
+  vector<byte> packed(lz_compress_bound(src.size()));
+  packed.resize(lz_compress(src, packed.data()));
+  vector<byte> out(src.size());
+  for (size_t len : {size_t{0}, size_t{1}, packed.size() / 2,
+                     packed.size() - 1}) {
+    ASSERT(!lz_decompress(span<const byte>(packed.data(), len), out));
+  }
+  // An offset back past the start of the output
+  vector<byte> bad_offset = {byte{0x10}, byte{'x'}, byte{0x05}, byte{0x00},
+                             byte{0x00}};
+  vector<byte> small_out(5);
+  ASSERT(!lz_decompress(bad_offset, small_out));
+
+  // Connections only compress if the client asks to, and they're on V2.
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+  shared_ptr<ServerConn> v1 = connect_to_server(addr, PROTOCOL_V1, true);
+  ASSERT(v1 && !v1->compressing());
+  shared_ptr<ServerConn> v2 = connect_to_server(addr, PROTOCOL_V2);
+  ASSERT(v2 && !v2->compressing());
+  shared_ptr<ServerConn> compressed =
+      connect_to_server(addr, PROTOCOL_V2, true);
+  ASSERT(compressed && compressed->compressing());
+
+  // When they do, large values go compressed and come back the same; small
+  // ones and incompressible ones go as they are.
+  for (auto&& conn : {v1, v2, compressed}) {
+
+    vector<string> keys = make_rand_strs(50, 16);
+    vector<string> values;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (i % 3 == 0) {
+        values.push_back(text.substr(i * 1000, 20000));
+      } else if (i % 3 == 1) {
+        values.push_back(random_bytes(5000));
+      } else {
+        values.push_back(to_string(i));
+      }
+    }
+    ASSERT(conn->send_request(MultiPutRequest{keys, values}));
+    optional<Response> res = conn->recv_response();
+    ASSERT(res && get_if<MultiPutResponse>(&*res));
+    ASSERT(conn->send_request(MultiGetRequest{keys}, 7));
+    uint32_t id = 0;
+    res = conn->recv_response(&id);
+    ASSERT(res);
+    auto* multiget = get_if<MultiGetResponse>(&*res);
+    ASSERT(multiget);
+    ASSERT_EQ_VECS(multiget->values, values);
+    ASSERT_EQ(id, conn == v1 ? uint32_t{0} : uint32_t{7});
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT(conn->send_request(GetRequest{keys[i]}));
+      res = conn->recv_response();
+      ASSERT(res);
+      auto* get = get_if<GetResponse>(&*res);
+      ASSERT(get && get->value == values[i]);
+    }
+  }
+
+  // A client whose compressed body doesn't decompress is disconnected.
+  shared_ptr<ServerConn> bad = connect_to_server(addr, PROTOCOL_V2);
+  ASSERT(bad);
+  byte garbage[] = {byte(MessageType::GET), byte{FLAG_COMPRESSED}, byte{4},
+                    byte{100}, byte{0xf0}, byte{0xff}, byte{0xff}};
+  ASSERT_EQ(sendall(bad->fd, garbage, sizeof(garbage), MSG_NOSIGNAL),
+            int(sizeof(garbage)));
+  ASSERT(!bad->recv_response());
+
+  server->stop();
+}
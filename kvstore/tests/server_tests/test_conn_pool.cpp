@@ -0,0 +1,61 @@
+#include <string>
+
+#include "client/simple_client.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+constexpr size_t N_THREADS = 4;
+constexpr size_t N_REQUESTS = 100;
+
+int main() {
+  // A standalone server, without a shardcontroller.
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+
+  ConnPool pool(N_THREADS, 200ms);
+  SimpleClient client(addr, pool);
+
+  // Requests made one after another all go over the same connection.
+  for (size_t i = 0; i < N_REQUESTS; i++) {
+    string key = "key" + to_string(i);
+    ASSERT(client.Put(key, to_string(i)));
+    ASSERT_EQ(client.Get(key).value_or(""), to_string(i));
+    ASSERT_EQ(pool.idle_count(addr), size_t{1});
+  }
+
+  // Concurrent requests each get a connection of their own, and no more
+  // than max_idle of them are kept afterwards.
+  vector<thread> threads;
+  for (size_t t = 0; t < 2 * N_THREADS; t++) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i < N_REQUESTS; i++) {
+        string key = "key" + to_string(t) + "_" + to_string(i);
+        ASSERT(client.Put(key, key));
+        ASSERT_EQ(client.Get(key).value_or(""), string(key));
+      }
+    });
+  }
+  for (auto&& thr : threads) thr.join();
+  ASSERT(pool.idle_count(addr) >= 1);
+  ASSERT(pool.idle_count(addr) <= N_THREADS);
+
+  // Pooled connections to a server that went away are noticed and replaced.
+  server->stop();
+  server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+  ASSERT(client.Put("after restart", "1"));
+  ASSERT_EQ(client.Get("after restart").value_or(""), string("1"));
+  ASSERT_EQ(pool.idle_count(addr), size_t{1});
+
+  // Connections left idle too long are closed.
+  this_thread::sleep_for(300ms);
+  pool.evict_idle();
+  ASSERT_EQ(pool.idle_count(addr), size_t{0});
+  ASSERT_EQ(client.Get("after restart").value_or(""), string("1"));
+
+  server->stop();
+}
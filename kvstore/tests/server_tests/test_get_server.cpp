@@ -69,6 +69,35 @@ int main() {
     ASSERT(!sm_config.get_server(key));
   }
 
+  // A ShardTable built from the config finds the same server for every key,
+  // short ones included, without needing the key upper-cased...
+  ShardTable table(sm_config);
+  keys = make_rand_strs(kNumKeyValPairs, kRandStringLength);
+  for (string key : {"", "0", "7", "8", "gdpr", "S", "SZZZ", "t", "Z"}) {
+    keys.push_back(key);
+  }
+  for (string key : keys) {
+    optional<string> expected = sm_config.get_server(key);
+    const string* found = table.get_server(key);
+    ASSERT_EQ(bool(found), bool(expected));
+    if (found) ASSERT_EQ(*found, *expected);
+  }
+
+  // ... including with shards of different granularities, as moves leave.
+  sm_config.server_to_shards[server_addresses[4]] = {{"T", "T"}, {"U0", "WZ"}};
+  sm_config.server_to_shards[server_addresses[3]].push_back({"X5", "X7"});
+  table = ShardTable(sm_config);
+  for (string key : {"T", "T5", "TZZ", "U", "U0", "u5x", "W", "WZ", "X", "x5",
+                     "X6A", "X7Z", "X8", "Y"}) {
+    optional<string> expected = sm_config.get_server(key);
+    const string* found = table.get_server(key);
+    ASSERT_EQ(bool(found), bool(expected));
+    if (found) ASSERT_EQ(*found, *expected);
+  }
+  ASSERT_EQ(*table.get_server("t0"), server_addresses[4]);
+  ASSERT_EQ(*table.get_server("x6"), server_addresses[3]);
+  ASSERT(!table.get_server("x8"));
+
   cout_color(GREEN, "Test passed!");
   return 0;
 }
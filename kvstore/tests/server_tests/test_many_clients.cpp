@@ -0,0 +1,62 @@
+#include <string>
+
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+constexpr size_t N_CLIENTS = 4 * N_WORKERS;
+constexpr size_t N_ROUNDS = 2;
+constexpr size_t N_BURST = 10;
+
+int main() {
+  // A standalone server, without a shardcontroller.
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+
+  // Open many more connections than there are workers, and keep them all
+  // open. Every client must be served, even though none of them disconnects.
+  vector<shared_ptr<ServerConn>> clients;
+  for (size_t i = 0; i < N_CLIENTS; i++) {
+    shared_ptr<ServerConn> conn = connect_to_server(addr);
+    ASSERT(conn);
+    clients.push_back(conn);
+  }
+
+  // Take turns sending requests, one client at a time.
+  for (size_t round = 0; round < N_ROUNDS; round++) {
+    for (size_t i = 0; i < N_CLIENTS; i++) {
+      string key = "key" + to_string(i);
+      string value = to_string(round);
+      ASSERT(clients[i]->send_request(PutRequest{key, value}));
+      optional<Response> put_res = clients[i]->recv_response();
+      ASSERT(put_res && get_if<PutResponse>(&*put_res));
+
+      ASSERT(clients[i]->send_request(GetRequest{key}));
+      optional<Response> get_res = clients[i]->recv_response();
+      ASSERT(get_res);
+      auto* get = get_if<GetResponse>(&*get_res);
+      ASSERT(get);
+      ASSERT_EQ(get->value, value);
+    }
+  }
+
+  // Requests sent back to back without waiting are all answered, in order.
+  for (size_t i = 0; i < N_BURST; i++) {
+    ASSERT(clients[0]->send_request(PutRequest{"burst", to_string(i)}));
+    ASSERT(clients[0]->send_request(GetRequest{"burst"}));
+  }
+  for (size_t i = 0; i < N_BURST; i++) {
+    optional<Response> put_res = clients[0]->recv_response();
+    ASSERT(put_res && get_if<PutResponse>(&*put_res));
+    optional<Response> get_res = clients[0]->recv_response();
+    ASSERT(get_res);
+    auto* get = get_if<GetResponse>(&*get_res);
+    ASSERT(get);
+    ASSERT_EQ(get->value, to_string(i));
+  }
+
+  server->stop();
+}
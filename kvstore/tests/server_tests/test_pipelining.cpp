@@ -0,0 +1,100 @@
+#include <string>
+
+#include "client/simple_client.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+// Several windows' worth, so that the pipeline has to keep reading while it
+// sends.
+constexpr size_t N_KEYS = 10 * PIPELINE_WINDOW + 7;
+
+int main() {
+  // A standalone server, without a shardcontroller.
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+
+  // Responses carry the ID of the request they answer, from V2 on.
+  shared_ptr<ServerConn> conn = connect_to_server(addr, PROTOCOL_LATEST);
+  ASSERT(conn);
+  ASSERT(conn->send_request(PutRequest{"id", "1"}, 7));
+  ASSERT(conn->send_request(GetRequest{"id"}, 8));
+  ASSERT(conn->send_request(GetRequest{"no such key"}, 9));
+  uint32_t id = 0;
+  optional<Response> res = conn->recv_response(&id);
+  ASSERT(res && get_if<PutResponse>(&*res));
+  ASSERT_EQ(id, uint32_t{7});
+  res = conn->recv_response(&id);
+  ASSERT(res && get_if<GetResponse>(&*res));
+  ASSERT_EQ(id, uint32_t{8});
+  res = conn->recv_response(&id);
+  ASSERT(res && get_if<ErrorResponse>(&*res));
+  ASSERT_EQ(id, uint32_t{9});
+
+  // A request whose body can't be deserialized gets an error, in its place,
+  // and the connection carries on: by ID from V2 on, and in order on V1.
+  shared_ptr<ServerConn> v1 = connect_to_server(addr);
+  ASSERT(v1);
+  for (auto&& c : {conn, v1}) {
+    // A key whose length is far more than the body holds.
+    Message bad{};
+    bad.type = MessageType::GET;
+    bad.buf.assign(8, std::byte{0xff});
+    bad.sz = bad.buf.size();
+    bad.id = 11;
+    ASSERT(c->send_request(PutRequest{"id", "2"}, 10));
+    ASSERT(send_message(c->fd, &bad, c->protocol_version()));
+    ASSERT(c->send_request(GetRequest{"id"}, 12));
+    bool has_ids = c->protocol_version() >= PROTOCOL_V2;
+    res = c->recv_response(&id);
+    ASSERT(res && get_if<PutResponse>(&*res));
+    ASSERT_EQ(id, has_ids ? uint32_t{10} : uint32_t{0});
+    res = c->recv_response(&id);
+    ASSERT(res && get_if<ErrorResponse>(&*res));
+    ASSERT_EQ(id, has_ids ? uint32_t{11} : uint32_t{0});
+    res = c->recv_response(&id);
+    ASSERT(res && get_if<GetResponse>(&*res));
+    ASSERT_EQ(get<GetResponse>(*res).value, string("2"));
+    ASSERT_EQ(id, has_ids ? uint32_t{12} : uint32_t{0});
+  }
+
+  // A pipeline returns each request's response in its place.
+  SimpleClient client(addr);
+  vector<string> keys = make_rand_strs(N_KEYS, 12);
+  vector<Request> puts;
+  for (size_t i = 0; i < N_KEYS; i++) {
+    puts.push_back(PutRequest{keys[i], to_string(i)});
+  }
+  vector<optional<Response>> put_res = client.Pipeline(puts);
+  ASSERT_EQ(put_res.size(), N_KEYS);
+  for (auto&& res : put_res) {
+    ASSERT(res && get_if<PutResponse>(&*res));
+  }
+
+  vector<Request> gets;
+  for (size_t i = 0; i < N_KEYS; i++) {
+    gets.push_back(GetRequest{keys[i]});
+    // A failed request doesn't hold up the rest.
+    if (i % 100 == 0) gets.push_back(GetRequest{"no such key"});
+  }
+  vector<optional<Response>> get_res = client.Pipeline(gets);
+  ASSERT_EQ(get_res.size(), gets.size());
+  size_t key = 0;
+  for (size_t i = 0; i < gets.size(); i++) {
+    ASSERT(get_res[i]);
+    if (get<GetRequest>(gets[i]).key == "no such key") {
+      ASSERT(get_if<ErrorResponse>(&*get_res[i]));
+      continue;
+    }
+    auto* get = get_if<GetResponse>(&*get_res[i]);
+    ASSERT(get);
+    ASSERT_EQ(get->value, to_string(key));
+    key++;
+  }
+  ASSERT_EQ(key, N_KEYS);
+
+  server->stop();
+}
@@ -0,0 +1,169 @@
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "client/simple_client.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+// Stands in for a server from before hellos, listening on listener, for two
+// connections. The first one's opening message is a hello, whose type it
+// doesn't know, so it hangs up; the second one's is a Get in the original
+// framing, which it answers.
+static void serve_like_v1(int listener) {
+  for (int i = 0; i < 2; i++) {
+    int fd = accept(listener, nullptr, nullptr);
+    ASSERT(fd >= 0);
+    // The original 12-byte header: the type, then the size.
+    std::byte header[sizeof(MessageType) + sizeof(size_t)];
+    ASSERT_EQ(recvall(fd, header, sizeof(header), 0), int(sizeof(header)));
+    MessageType type;
+    size_t sz;
+    memcpy(&type, header, sizeof(type));
+    memcpy(&sz, header + sizeof(type), sizeof(sz));
+    sz = ntohl(sz);
+    vector<std::byte> body(sz);
+    ASSERT_EQ(recvall(fd, body.data(), sz, 0), int(sz));
+    if (i == 0) {
+      ASSERT(type == MessageType::HELLO);
+    } else {
+      ASSERT(type == MessageType::GET);
+      optional<Request> req = deserialize_request(type, body);
+      ASSERT(req && get<GetRequest>(*req).key == "old");
+      optional<Message> msg = serialize_response(GetResponse{"server"});
+      ASSERT(msg && send_message(fd, &*msg));
+    }
+    close(fd);
+  }
+}
+
+int main() {
+  // Message types keep the values they had before types were added, so that
+  // peers that predate the new ones still agree on the old ones.
+  ASSERT_EQ(int(MessageType::MULTI_PUT), 5);
+  ASSERT_EQ(int(MessageType::QUERY), 9);
+  ASSERT_EQ(int(MessageType::ERROR), 10);
+
+  // A standalone server, without a shardcontroller.
+  string addr = get_host_address("9000");
+  shared_ptr<KvServer> server =
+      start_server<KvServer, const std::string&, uint64_t>(addr, N_WORKERS);
+
+  // Connections negotiate the newest version both ends support...
+  shared_ptr<ServerConn> v2 = connect_to_server(addr, PROTOCOL_LATEST);
+  ASSERT(v2);
+  ASSERT_EQ(int(v2->protocol_version()), int(PROTOCOL_V2));
+  shared_ptr<ServerConn> newer = connect_to_server(addr, PROTOCOL_LATEST + 1);
+  ASSERT(newer);
+  ASSERT_EQ(int(newer->protocol_version()), int(PROTOCOL_LATEST));
+  // ... if the client says hello, which it only does if asked to; otherwise,
+  // it stays on V1.
+  shared_ptr<ServerConn> v1 = connect_to_server(addr);
+  ASSERT(v1);
+  ASSERT_EQ(int(v1->protocol_version()), int(PROTOCOL_V1));
+
+  // Either way, requests make it through, whatever their size, and so do their
+  // IDs from V2 on. V1 has no room for them.
+  for (auto&& conn : {v1, v2, newer}) {
+    for (size_t size : {size_t{0}, size_t{100}, size_t{1} << 20}) {
+      string key = "key" + to_string(conn->protocol_version());
+      ASSERT(conn->send_request(PutRequest{key, string(size, 'v')}, 0));
+      ASSERT(conn->send_request(GetRequest{key}, 300 + size));
+      ASSERT(conn->recv_response());
+      uint32_t id = 0;
+      optional<Response> res = conn->recv_response(&id);
+      ASSERT(res);
+      auto* get = get_if<GetResponse>(&*res);
+      ASSERT(get && get->value == string(size, 'v'));
+      bool has_ids = conn->protocol_version() >= PROTOCOL_V2;
+      ASSERT_EQ(id, has_ids ? uint32_t(300 + size) : uint32_t{0});
+    }
+  }
+  // A pipeline matches responses up by ID, or on V1, by order.
+  vector<Request> puts, gets;
+  for (size_t i = 0; i < 3 * PIPELINE_WINDOW; i++) {
+    puts.push_back(PutRequest{"pipelined" + to_string(i), to_string(i)});
+    gets.push_back(GetRequest{"pipelined" + to_string(i)});
+  }
+  for (auto&& res : v2->pipeline(puts)) {
+    ASSERT(res && get_if<PutResponse>(&*res));
+  }
+  for (auto&& conn : {v1, v2}) {
+    vector<optional<Response>> responses = conn->pipeline(gets);
+    for (size_t i = 0; i < gets.size(); i++) {
+      ASSERT(responses[i]);
+      auto* get = get_if<GetResponse>(&*responses[i]);
+      ASSERT(get && get->value == to_string(i));
+    }
+  }
+
+  // A hello is only answered as the first message on a connection; one after
+  // a request gets the client disconnected.
+  shared_ptr<ServerConn> late = connect_to_server(addr);
+  ASSERT(late->send_request(GetRequest{"key1"}));
+  ASSERT(late->recv_response());
+  ASSERT(!late->hello());
+
+  // A client that sends a malformed header is disconnected, and nobody else
+  // is.
+  shared_ptr<ServerConn> bad = connect_to_server(addr, PROTOCOL_LATEST);
+  ASSERT(bad);
+  std::byte garbage[] = {std::byte{0xff}, std::byte{0xff}};
+  ASSERT_EQ(sendall(bad->fd, garbage, sizeof(garbage), MSG_NOSIGNAL),
+            int(sizeof(garbage)));
+  ASSERT(!bad->recv_response());
+  ASSERT(v2->send_request(GetRequest{"key2"}));
+  ASSERT(v2->recv_response());
+
+  // So is one that sends a message that isn't a request, like an (empty)
+  // error response.
+  shared_ptr<ServerConn> wrong = connect_to_server(addr, PROTOCOL_LATEST);
+  ASSERT(wrong);
+  std::byte error[] = {std::byte(MessageType::ERROR), std::byte{0},
+                       std::byte{0}};
+  ASSERT_EQ(sendall(wrong->fd, error, sizeof(error), MSG_NOSIGNAL),
+            int(sizeof(error)));
+  ASSERT(!wrong->recv_response());
+  ASSERT(v2->send_request(GetRequest{"key2"}));
+  ASSERT(v2->recv_response());
+
+  // And so is one whose header claims a body bigger than any message may be
+  // (2^40 bytes, as a varint), rather than it being made room for.
+  shared_ptr<ServerConn> huge = connect_to_server(addr, PROTOCOL_LATEST);
+  ASSERT(huge);
+  std::byte huge_header[] = {std::byte(MessageType::GET), std::byte{0},
+                             std::byte{0x80},             std::byte{0x80},
+                             std::byte{0x80},             std::byte{0x80},
+                             std::byte{0x80},             std::byte{0x20}};
+  ASSERT_EQ(sendall(huge->fd, huge_header, sizeof(huge_header), MSG_NOSIGNAL),
+            int(sizeof(huge_header)));
+  ASSERT(!huge->recv_response());
+  ASSERT(v2->send_request(GetRequest{"key2"}));
+  ASSERT(v2->recv_response());
+
+  // Clients opt in to the newest version.
+  SimpleClient client(addr);
+  ASSERT(client.Put("simple", "client"));
+  ASSERT_EQ(client.Get("simple").value_or(""), string("client"));
+
+  server->stop();
+
+  // A server from before hellos hangs up on one, so the client reconnects and
+  // talks to it in the original framing.
+  string old_addr = get_host_address("9001");
+  int listener = open_listener_socket(old_addr);
+  ASSERT(listener >= 0);
+  thread old_server(serve_like_v1, listener);
+  shared_ptr<ServerConn> fallback =
+      connect_to_server(old_addr, PROTOCOL_LATEST);
+  ASSERT(fallback);
+  ASSERT_EQ(int(fallback->protocol_version()), int(PROTOCOL_V1));
+  ASSERT(fallback->send_request(GetRequest{"old"}, 5));
+  optional<Response> res = fallback->recv_response();
+  ASSERT(res && get<GetResponse>(*res).value == "server");
+  old_server.join();
+  close(listener);
+}
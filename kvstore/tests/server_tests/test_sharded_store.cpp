@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "common/shard.hpp"
+#include "kvstore/ordered_index.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+static unique_ptr<ShardedKvStore> make_store() {
+  return make_unique<ShardedKvStore>([] {
+    return make_unique<ConcurrentKvStore>(hash<string>(),
+                                          DbMap::DEFAULT_STRIPE_COUNT, true);
+  });
+}
+
+// A partition whose Puts take a while, so that a drop can catch one under way.
+class SlowPutStore : public ConcurrentKvStore {
+ public:
+  bool Put(const PutRequest* req, PutResponse* res) override {
+    this_thread::sleep_for(200ms);
+    return ConcurrentKvStore::Put(req, res);
+  }
+};
+
+int main() {
+  // Keys are partitioned by their first character, case-insensitively;
+  // anything that doesn't start with a VALID_CHAR goes in the last partition.
+  ASSERT_EQ(ShardedKvStore::partitionOf("0abc"), size_t(0));
+  ASSERT_EQ(ShardedKvStore::partitionOf("A"), size_t(10));
+  ASSERT_EQ(ShardedKvStore::partitionOf("apple"), size_t(10));
+  ASSERT_EQ(ShardedKvStore::partitionOf("zebra"), size_t(35));
+  for (string key : {"", "_x", "!", " Z", "\xff"}) {
+    ASSERT_EQ(ShardedKvStore::partitionOf(key),
+              ShardedKvStore::N_PARTITIONS - 1);
+  }
+
+  // A shard covers a partition only if it has every bucket in it.
+  auto within = [](Shard shard) {
+    return ShardedKvStore::partitionsWithin(shard);
+  };
+  ASSERT_EQ(within({"0", "Z"}).size(), VALID_CHARS.size());
+  ASSERT_EQ_VECS(within({"A", "C"}), (vector<size_t>{10, 11, 12}));
+  ASSERT_EQ_VECS(within({"U0", "WZ"}), (vector<size_t>{30, 31, 32}));
+  ASSERT_EQ_VECS(within({"U1", "WY"}), (vector<size_t>{31}));
+  ASSERT(within({"B00", "BZY"}).empty());
+
+  // Scans run in key order across partitions, with keys that start with
+  // other characters merged in where they belong, under any limit.
+  auto store = make_store();
+  vector<string> keys = {"!bang", "0zero", "9nine", "Apple", "apricot", "M",
+                         "m_lower", "_under", "zz", "~tilde", "Zed"};
+  for (auto&& key : keys) {
+    PutRequest req{key, "v" + key};
+    PutResponse res;
+    ASSERT(store->Put(&req, &res));
+  }
+  vector<string> sorted = keys;
+  sort(sorted.begin(), sorted.end(), key_less);
+  for (size_t limit = 0; limit <= keys.size(); limit++) {
+    ScanRequest req{"", "", limit};
+    ScanResponse res;
+    ASSERT(store->Scan(&req, &res));
+    size_t n = limit == 0 ? keys.size() : limit;
+    ASSERT_EQ_VECS(res.keys,
+                   vector<string>(sorted.begin(), sorted.begin() + n));
+    for (size_t i = 0; i < n; i++) ASSERT_EQ(res.values[i], "v" + res.keys[i]);
+  }
+  ScanRequest range_req{"A", "N"};
+  ScanResponse range_res;
+  ASSERT(store->Scan(&range_req, &range_res));
+  ASSERT_EQ_VECS(range_res.keys,
+                 (vector<string>{"Apple", "apricot", "M", "m_lower"}));
+
+  // MultiGet and MultiPut span partitions.
+  MultiPutRequest multiput_req{{"alpha", "beta", "_gamma"}, {"1", "2", "3"}};
+  MultiPutResponse multiput_res;
+  ASSERT(store->MultiPut(&multiput_req, &multiput_res));
+  MultiGetRequest multiget_req{{"_gamma", "beta", "alpha", "zz"}};
+  MultiGetResponse multiget_res;
+  ASSERT(store->MultiGet(&multiget_req, &multiget_res));
+  ASSERT_EQ_VECS(multiget_res.values, (vector<string>{"3", "2", "1", "vzz"}));
+  multiget_req.keys.push_back("missing");
+  ASSERT(!store->MultiGet(&multiget_req, &multiget_res));
+
+  // Dropping a partition drops its pairs, and only its pairs; it takes new
+  // ones afterwards.
+  size_t a = ShardedKvStore::partitionOf("A");
+  ListKeysRequest list_req{0, 0};
+  ListKeysResponse list_res;
+  ASSERT(store->listPartition(a, &list_req, &list_res));
+  sort(list_res.keys.begin(), list_res.keys.end());
+  ASSERT_EQ_VECS(list_res.keys, (vector<string>{"Apple", "alpha", "apricot"}));
+  store->dropPartition(a);
+  GetRequest get_req{"Apple"};
+  GetResponse get_res;
+  ASSERT(!store->Get(&get_req, &get_res));
+  get_req.key = "beta";
+  ASSERT(store->Get(&get_req, &get_res));
+  ASSERT_EQ(get_res.value, "2");
+  PutRequest put_req{"again", "1"};
+  PutResponse put_res;
+  ASSERT(store->Put(&put_req, &put_res));
+  vector<string> all = store->AllKeys();
+  // The 14 pairs put, less the 3 dropped, plus the one put since
+  ASSERT_EQ(all.size(), size_t(12));
+  ASSERT(find(all.begin(), all.end(), "again") != all.end());
+
+  // A drop waits for a write under way on the partition, which is dropped
+  // with it rather than landing on the old partition once it's swapped out.
+  ShardedKvStore slow_store([] { return make_unique<SlowPutStore>(); });
+  atomic<bool> written = false;
+  thread writer([&] {
+    PutRequest req{"slow", "1"};
+    PutResponse res;
+    ASSERT(slow_store.Put(&req, &res));
+    written = true;
+  });
+  this_thread::sleep_for(50ms);
+  slow_store.dropPartition(ShardedKvStore::partitionOf("slow"));
+  ASSERT(written);
+  writer.join();
+  get_req.key = "slow";
+  ASSERT(!slow_store.Get(&get_req, &get_res));
+
+  cout_color(GREEN, "Test passed!");
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "kvstore/logged_kvstore.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+static unique_ptr<LoggedKvStore> open_store(const WalOptions& options) {
+  return LoggedKvStore::open(make_unique<ConcurrentKvStore>(), options);
+}
+
+static map<string, string> contents(KvStore* store) {
+  map<string, string> pairs;
+  for (auto&& key : store->AllKeys()) {
+    GetRequest req{key};
+    GetResponse res;
+    ASSERT(store->Get(&req, &res));
+    pairs[key] = res.value;
+  }
+  return pairs;
+}
+
+// The log's sealed segments, which a snapshot should have deleted.
+static size_t count_sealed(const string& path) {
+  size_t n = 0;
+  string prefix = filesystem::path(path).filename().string() + ".";
+  for (auto&& entry :
+       filesystem::directory_iterator(filesystem::path(path).parent_path())) {
+    if (entry.path().filename().string().starts_with(prefix)) n++;
+  }
+  return n;
+}
+
+static void remove_log(const string& path) {
+  string prefix = filesystem::path(path).filename().string() + ".";
+  for (auto&& entry :
+       filesystem::directory_iterator(filesystem::path(path).parent_path())) {
+    if (entry.path().filename().string().starts_with(prefix)) {
+      filesystem::remove(entry.path());
+    }
+  }
+  filesystem::remove(path);
+}
+
+int main() {
+  string dir = filesystem::temp_directory_path();
+  string pid = to_string(getpid());
+  WalOptions options;
+  options.path = dir + "/test_snapshot_" + pid + ".log";
+  options.snapshot_path = dir + "/test_snapshot_" + pid + ".snap";
+  remove_log(options.path);
+  filesystem::remove(options.snapshot_path);
+
+  // Writes on either side of a snapshot all survive a restart, each exactly
+  // once: an Append the snapshot covers isn't replayed on top of it.
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    PutRequest put_req{"a", "1"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+    AppendRequest append_req{"a", "2"};
+    AppendResponse append_res;
+    ASSERT(store->Append(&append_req, &append_res));
+    MultiPutRequest multiput_req{{"b", "c", "d"}, {"4", "5", "6"}};
+    MultiPutResponse multiput_res;
+    ASSERT(store->MultiPut(&multiput_req, &multiput_res));
+
+    ASSERT(store->snapshot());
+    ASSERT(filesystem::exists(options.snapshot_path));
+    ASSERT_EQ(count_sealed(options.path), size_t(0));
+
+    append_req.value = "3";
+    ASSERT(store->Append(&append_req, &append_res));
+    DeleteRequest delete_req{"c"};
+    DeleteResponse delete_res;
+    ASSERT(store->Delete(&delete_req, &delete_res));
+  }
+  map<string, string> expected{{"a", "123"}, {"b", "4"}, {"d", "6"}};
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    ASSERT(contents(store.get()) == expected);
+    // Again, from the snapshot alone.
+    ASSERT(store->snapshot());
+  }
+  {
+    auto store = open_store(options);
+    ASSERT(contents(store.get()) == expected);
+  }
+
+  // A snapshot taken while writers are appending restores exactly what the
+  // store held once they were done, however their writes fell either side of
+  // each stripe's cut.
+  {
+    auto store = open_store(options);
+    atomic<bool> done = false;
+    vector<thread> writers;
+    for (size_t t = 0; t < 4; t++) {
+      writers.emplace_back([&, t] {
+        for (size_t i = 0; i < 500; i++) {
+          string key = to_string(t) + "_" + to_string(i % 50);
+          AppendRequest req{key, to_string(i)};
+          AppendResponse res;
+          ASSERT(store->Append(&req, &res));
+        }
+      });
+    }
+    thread snapshotter([&] {
+      while (!done) ASSERT(store->snapshot());
+    });
+    for (auto&& writer : writers) writer.join();
+    done = true;
+    snapshotter.join();
+    expected = contents(store.get());
+  }
+  ASSERT_EQ(expected.size(), size_t(203));
+  {
+    auto store = open_store(options);
+    ASSERT(contents(store.get()) == expected);
+    ASSERT(store->snapshot());
+  }
+
+  // With the log lost, the snapshot is still restored, and new writes are
+  // numbered after everything it covers, so they're replayed after a restart.
+  remove_log(options.path);
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    ASSERT(contents(store.get()) == expected);
+    PutRequest put_req{"e", "7"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+  }
+  expected["e"] = "7";
+  {
+    auto store = open_store(options);
+    ASSERT(contents(store.get()) == expected);
+  }
+
+  // Snapshots are taken in the background, once something's been written.
+  {
+    WalOptions background_options = options;
+    background_options.snapshot_interval = 1s;
+    auto taken = filesystem::last_write_time(options.snapshot_path);
+    auto store = open_store(background_options);
+    PutRequest put_req{"f", "8"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+    this_thread::sleep_for(1500ms);
+    ASSERT(filesystem::last_write_time(options.snapshot_path) != taken);
+  }
+  expected["f"] = "8";
+  remove_log(options.path);
+  {
+    auto store = open_store(options);
+    ASSERT(contents(store.get()) == expected);
+  }
+
+  // A corrupt snapshot isn't loaded.
+  {
+    fstream file(options.snapshot_path, ios::in | ios::out | ios::binary);
+    file.seekp(9);
+    file.put('\xff');
+  }
+  ASSERT(!open_store(options));
+  {
+    ofstream file(options.snapshot_path, ios::trunc);
+    file << "not a snapshot";
+  }
+  ASSERT(!open_store(options));
+  // And a store that can't be snapshotted refuses to be configured to be.
+  ASSERT(!LoggedKvStore::open(
+      unique_ptr<KvStore>(make_unique<ConcurrentKvStore>()), options));
+
+  remove_log(options.path);
+  filesystem::remove(options.snapshot_path);
+  cout_color(GREEN, "Test passed!");
+  return 0;
+}
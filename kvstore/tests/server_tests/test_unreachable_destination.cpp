@@ -0,0 +1,60 @@
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "common/config.hpp"
+#include "common/shard.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+static constexpr size_t kNumKeys = 20;
+static constexpr size_t kRandStringLength = 5;
+
+int main() {
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+
+  // The second server joins, but never comes up, so nothing can be handed
+  // over to it. It's handed over to before the third, which is up.
+  vector<string> server_addresses = make_server_addresses(3);
+  vector<shared_ptr<KvServer>> servers;
+  for (size_t i : {0, 2}) {
+    servers.push_back(
+        start_server<KvServer, const std::string&, const std::string&,
+                     uint64_t>(server_addresses[i], sm_addr, 5));
+  }
+  ASSERT(test_join(sm, server_addresses[1]));
+  ASSERT(test_move(sm, server_addresses[0], vector<Shard>{{"0", "Z"}}));
+  // Sleep to allow the config to update before issuing requests
+  this_thread::sleep_for(500ms);
+
+  vector<string> moving =
+      make_rand_strs(kNumKeys, kRandStringLength, "NOPQRSTUVWXYZ");
+  vector<string> stranded =
+      make_rand_strs(kNumKeys, kRandStringLength, "ABCDEFGHIJKLM");
+  ShardKvClient client(sm_addr);
+  for (auto&& key : moving) ASSERT(client.Put(key, key));
+  for (auto&& key : stranded) ASSERT(client.Put(key, key));
+
+  ASSERT(test_move(sm, server_addresses[2], vector<Shard>{{"N", "Z"}}));
+  ASSERT(test_move(sm, server_addresses[1], vector<Shard>{{"A", "M"}}));
+  this_thread::sleep_for(1500ms);
+
+  // The server that's up gets its shard, and is told it has all of it, even
+  // though the other destination still can't be reached.
+  for (auto&& key : moving) ASSERT(test_get(server_addresses[2], key, key));
+
+  // What couldn't be handed over stays put, to be tried again.
+  map<string, string> kept = servers[0]->all_kvpairs();
+  for (auto&& key : stranded) ASSERT(kept.contains(key));
+  for (auto&& key : moving) ASSERT(!kept.contains(key));
+
+  for (auto&& server : servers) server->stop();
+  sm->stop();
+
+  cout_color(GREEN, "Test passed!");
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "kvstore/logged_kvstore.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+static unique_ptr<LoggedKvStore> open_store(const WalOptions& options) {
+  return LoggedKvStore::open(make_unique<ConcurrentKvStore>(), options);
+}
+
+static map<string, string> contents(KvStore* store) {
+  map<string, string> pairs;
+  for (auto&& key : store->AllKeys()) {
+    GetRequest req{key};
+    GetResponse res;
+    ASSERT(store->Get(&req, &res));
+    pairs[key] = res.value;
+  }
+  return pairs;
+}
+
+int main() {
+  string path = filesystem::temp_directory_path() /
+                ("test_wal_" + to_string(getpid()) + ".log");
+  filesystem::remove(path);
+  WalOptions options{path};
+
+  // Every kind of write is replayed after a restart, in order.
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    PutRequest put_req{"a", "1"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+    AppendRequest append_req{"a", "23"};
+    AppendResponse append_res;
+    ASSERT(store->Append(&append_req, &append_res));
+    MultiPutRequest multiput_req{{"b", "c", "d"}, {"4", "5", "6"}};
+    MultiPutResponse multiput_res;
+    ASSERT(store->MultiPut(&multiput_req, &multiput_res));
+    DeleteRequest delete_req{"c"};
+    DeleteResponse delete_res;
+    ASSERT(store->Delete(&delete_req, &delete_res));
+    // A failed write still fails, and replays harmlessly.
+    delete_req.key = "missing";
+    ASSERT(!store->Delete(&delete_req, &delete_res));
+  }
+  map<string, string> expected{{"a", "123"}, {"b", "4"}, {"d", "6"}};
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    ASSERT(contents(store.get()) == expected);
+  }
+
+  // A record that was only partly written when the server died is dropped,
+  // but nothing before it is, and writes carry on after the last intact one.
+  {
+    auto store = open_store(options);
+    PutRequest put_req{"torn", "lost"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+  }
+  filesystem::resize_file(path, filesystem::file_size(path) - 3);
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    ASSERT(contents(store.get()) == expected);
+    PutRequest put_req{"e", "7"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+  }
+  expected["e"] = "7";
+  {
+    auto store = open_store(options);
+    ASSERT(contents(store.get()) == expected);
+  }
+
+  // So is a record whose bytes don't match their CRC, and everything after
+  // it: here, the last byte of the last record's value.
+  {
+    auto store = open_store(options);
+    PutRequest put_req{"f", "8"};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+  }
+  {
+    fstream file(path, ios::in | ios::out | ios::binary);
+    file.seekp(-1, ios::end);
+    file.put('9');
+  }
+  {
+    auto store = open_store(options);
+    ASSERT(store);
+    ASSERT(contents(store.get()) == expected);
+  }
+
+  // Concurrent writers all get logged, under each sync policy.
+  for (SyncPolicy sync :
+       {SyncPolicy::ALWAYS, SyncPolicy::INTERVAL, SyncPolicy::NEVER}) {
+    filesystem::remove(path);
+    WalOptions sync_options{path, sync, 1ms};
+    {
+      auto store = open_store(sync_options);
+      ASSERT(store);
+      vector<thread> writers;
+      for (size_t t = 0; t < 8; t++) {
+        writers.emplace_back([&, t] {
+          for (size_t i = 0; i < 100; i++) {
+            string key = to_string(t) + "_" + to_string(i % 10);
+            AppendRequest req{key, to_string(i)};
+            AppendResponse res;
+            ASSERT(store->Append(&req, &res));
+          }
+        });
+      }
+      for (auto&& writer : writers) writer.join();
+    }
+    auto store = open_store(sync_options);
+    map<string, string> pairs = contents(store.get());
+    ASSERT_EQ(pairs.size(), size_t(80));
+    string expected_value;
+    for (size_t i = 3; i < 100; i += 10) expected_value += to_string(i);
+    ASSERT_EQ(pairs["5_3"], expected_value);
+  }
+
+  // A file that isn't a log isn't replayed, or written to.
+  {
+    ofstream file(path, ios::trunc);
+    file << "not a write-ahead log";
+  }
+  ASSERT(!open_store(options));
+  filesystem::remove(path);
+
+  cout_color(GREEN, "Test passed!");
+  return 0;
+}
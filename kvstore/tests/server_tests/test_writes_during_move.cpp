@@ -0,0 +1,81 @@
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "common/config.hpp"
+#include "common/shard.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+constexpr size_t N_MOVES = 6;
+static constexpr size_t kNumKeys = 20;
+static constexpr size_t kRandStringLength = 5;
+
+int main() {
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+
+  vector<string> server_addresses = make_server_addresses(2);
+  vector<shared_ptr<KvServer>> servers;
+  for (auto&& addr : server_addresses) {
+    servers.push_back(
+        start_server<KvServer, const std::string&, const std::string&,
+                     uint64_t>(addr, sm_addr, 5));
+  }
+  ASSERT(test_move(sm, server_addresses[0], vector<Shard>{{"0", "Z"}}));
+  // Sleep to allow the config to update before issuing requests
+  this_thread::sleep_for(500ms);
+
+  // Keys in the shard that moves back and forth, and some that stay put.
+  vector<string> moving =
+      make_rand_strs(kNumKeys, kRandStringLength, "NOPQRSTUVWXYZ");
+  vector<string> staying =
+      make_rand_strs(kNumKeys / 4, kRandStringLength, "ABCDEFGHIJKLM");
+  vector<string> keys = moving;
+  keys.insert(keys.end(), staying.begin(), staying.end());
+
+  // Appends to every key in turn, while the shard moves. Every Append that
+  // succeeds must show up exactly once in the end: none lost to a transfer
+  // that overwrote it, or left behind on the server the shard moved from.
+  ShardKvClient client(sm_addr);
+  atomic<bool> done = false;
+  vector<string> expected(keys.size());
+  thread writer([&] {
+    for (size_t round = 0; !done; round++) {
+      for (size_t i = 0; i < keys.size(); i++) {
+        string value = to_string(round) + ",";
+        ASSERT(client.Append(keys[i], value));
+        expected[i] += value;
+      }
+    }
+  });
+
+  for (size_t i = 0; i < N_MOVES; i++) {
+    ASSERT(test_move(sm, server_addresses[(i + 1) % 2],
+                     vector<Shard>{{"N", "Z"}}));
+    this_thread::sleep_for(200ms);
+  }
+  done = true;
+  writer.join();
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    optional<string> value = client.Get(keys[i]);
+    ASSERT(value);
+    ASSERT_EQ(*value, expected[i]);
+  }
+
+  // After an even number of moves, the shard's back where it started, and
+  // nothing of it is left on the other server.
+  map<string, string> left_behind = servers[1]->all_kvpairs();
+  ASSERT(left_behind.empty());
+
+  for (auto&& server : servers) server->stop();
+  sm->stop();
+
+  cout_color(GREEN, "Test passed!");
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <map>
+#include <string>
+#include <thread>
+
+#include "common/shard.hpp"
+#include "net/network_helpers.hpp"
+#include "server/server.hpp"
+#include "test_utils/test_utils.hpp"
+
+// for simplicity
+using namespace std;
+
+static uint64_t query_epoch(shared_ptr<Shardcontroller> sm) {
+  QueryRequest req;
+  QueryResponse res;
+  ASSERT(sm->Query(&req, &res));
+  return res.config.epoch;
+}
+
+int main() {
+  string sm_addr = get_host_address("8080");
+  shared_ptr<Shardcontroller> sm = start_shardcontroller(sm_addr);
+  vector<string> server_addresses = make_server_addresses(2);
+
+  // Every change to the config bumps its epoch; failed requests don't.
+  ASSERT_EQ(query_epoch(sm), uint64_t(0));
+  ASSERT(test_join(sm, server_addresses[0], true));
+  ASSERT_EQ(query_epoch(sm), uint64_t(1));
+  ASSERT(test_join(sm, server_addresses[0], false));
+  ASSERT(test_move(sm, "nobody", vector<Shard>{{"0", "Z"}}, false));
+  ASSERT_EQ(query_epoch(sm), uint64_t(1));
+  ASSERT(test_move(sm, server_addresses[0], vector<Shard>{{"0", "Z"}}));
+  ASSERT_EQ(query_epoch(sm), uint64_t(2));
+
+  // A Watch for a config that's already changed answers right away...
+  WatchRequest req{1};
+  WatchResponse res;
+  auto start = chrono::steady_clock::now();
+  ASSERT(sm->Watch(&req, &res));
+  ASSERT(chrono::steady_clock::now() - start < 1s);
+  ASSERT_EQ(res.config.epoch, uint64_t(2));
+
+  // ... one for a config that doesn't change answers with it as it is once it
+  // times out ...
+  req.since_epoch = 2;
+  start = chrono::steady_clock::now();
+  ASSERT(sm->Watch(&req, &res));
+  ASSERT(chrono::steady_clock::now() - start >= WATCH_TIMEOUT - 100ms);
+  ASSERT_EQ(res.config.epoch, uint64_t(2));
+
+  // ... and one for a config that does change answers as soon as it does.
+  atomic<bool> answered = false;
+  chrono::steady_clock::time_point answered_at;
+  thread watcher([&] {
+    shared_ptr<ServerConn> conn = connect_to_server(sm_addr);
+    ASSERT(conn);
+    ASSERT(conn->send_request(WatchRequest{2}));
+    optional<Response> res = conn->recv_response();
+    answered_at = chrono::steady_clock::now();
+    answered = true;
+    ASSERT(res);
+    auto* watch_res = get_if<WatchResponse>(&*res);
+    ASSERT(watch_res);
+    ASSERT_EQ(watch_res->config.epoch, uint64_t(3));
+    ASSERT(watch_res->config.server_to_shards.contains(server_addresses[1]));
+  });
+  this_thread::sleep_for(200ms);
+  ASSERT(!answered);
+  start = chrono::steady_clock::now();
+  ASSERT(test_join(sm, server_addresses[1], true));
+  watcher.join();
+  ASSERT(answered_at - start < 1s);
+
+  // Stopping the shardcontroller doesn't wait out Watches.
+  thread stranded([&] {
+    shared_ptr<ServerConn> conn = connect_to_server(sm_addr);
+    ASSERT(conn);
+    ASSERT(conn->send_request(WatchRequest{3}));
+    conn->recv_response();
+  });
+  this_thread::sleep_for(200ms);
+  start = chrono::steady_clock::now();
+  sm->stop();
+  stranded.join();
+  ASSERT(chrono::steady_clock::now() - start < WATCH_TIMEOUT);
+
+  cout_color(GREEN, "Test passed!");
+
+  return 0;
+}